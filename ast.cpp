@@ -1,19 +1,27 @@
 #include "ast.hpp"
+#include "json_reader.hpp"
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 
 // --- Forward Declarations ---
-std::shared_ptr<Type> buildType(const nlohmann::json& j);
-std::unique_ptr<Exp> buildExp(const nlohmann::json& j);
-std::unique_ptr<Place> buildPlace(const nlohmann::json& j);
-std::unique_ptr<Stmt> buildStmt(const nlohmann::json& j);
-Decl buildDecl(const nlohmann::json& j);
-std::unique_ptr<FunctionDef> buildFunctionDef(const nlohmann::json& j);
-std::unique_ptr<StructDef> buildStructDef(const nlohmann::json& j);
-Extern buildExtern(const nlohmann::json& j);
+const Type* buildType(const nlohmann::json& j, TypeContext& types);
+Exp* buildExp(const nlohmann::json& j, Program& prog);
+Place* buildPlace(const nlohmann::json& j, Program& prog);
+Place* buildPlace(const std::string& key, const nlohmann::json& value, Program& prog);
+Stmt* buildStmt(const nlohmann::json& j, Program& prog);
+Decl buildDecl(const nlohmann::json& j, TypeContext& types);
+FunctionDef* buildFunctionDef(const nlohmann::json& j, Program& prog);
+StructDef* buildStructDef(const nlohmann::json& j, Program& prog);
+Extern buildExtern(const nlohmann::json& j, TypeContext& types);
 std::unique_ptr<Program> buildProgram(const nlohmann::json& j);
-std::unique_ptr<FunCall> buildFunCall(const nlohmann::json& j);
+FunCall* buildFunCall(const nlohmann::json& j, Program& prog);
 
 // Type Implementations
 
@@ -37,27 +45,27 @@ std::string FnType::toString() const {
 bool NilType::equals(const Type& other) const {
     // nil is eq to nil, ptr(_), or array(_)
     // Now PtrType and ArrayType are fully defined
-    return dynamic_cast<const NilType*>(&other) != nullptr ||
-           dynamic_cast<const PtrType*>(&other) != nullptr ||
-           dynamic_cast<const ArrayType*>(&other) != nullptr;
+    return isa<NilType>(&other) ||
+           isa<PtrType>(&other) ||
+           isa<ArrayType>(&other);
 }
 
 bool StructType::equals(const Type& other) const {
     // nil is not eq to struct types
-    if (dynamic_cast<const NilType*>(&other)) {
+    if (isa<NilType>(&other)) {
         return false;
     }
-    if (const auto* other_struct = dynamic_cast<const StructType*>(&other)) {
+    if (const auto* other_struct = dyn_cast<StructType>(&other)) {
         return name == other_struct->name;
     }
     return false;
 }
 
 bool ArrayType::equals(const Type& other) const {
-    if (dynamic_cast<const NilType*>(&other)) {
+    if (isa<NilType>(&other)) {
         return true; // array(_) eq nil
     }
-    if (const auto* other_array = dynamic_cast<const ArrayType*>(&other)) {
+    if (const auto* other_array = dyn_cast<ArrayType>(&other)) {
         // Now TypePtrEqual can be used as all types are defined
         return TypePtrEqual()(elementType, other_array->elementType);
     }
@@ -65,10 +73,10 @@ bool ArrayType::equals(const Type& other) const {
 }
 
 bool PtrType::equals(const Type& other) const {
-    if (dynamic_cast<const NilType*>(&other)) {
+    if (isa<NilType>(&other)) {
         return true; // ptr(_) eq nil
     }
-    if (const auto* other_ptr = dynamic_cast<const PtrType*>(&other)) {
+    if (const auto* other_ptr = dyn_cast<PtrType>(&other)) {
         // Now TypePtrEqual can be used as all types are defined
          return TypePtrEqual()(pointeeType, other_ptr->pointeeType);
     }
@@ -77,10 +85,10 @@ bool PtrType::equals(const Type& other) const {
 
 bool FnType::equals(const Type& other) const {
     // nil is not eq to function types
-    if (dynamic_cast<const NilType*>(&other)) {
+    if (isa<NilType>(&other)) {
         return false;
     }
-    if (const auto* other_fn = dynamic_cast<const FnType*>(&other)) {
+    if (const auto* other_fn = dyn_cast<FnType>(&other)) {
         if (paramTypes.size() != other_fn->paramTypes.size()) {
             return false;
         }
@@ -96,33 +104,133 @@ bool FnType::equals(const Type& other) const {
     return false;
 }
 
+// Type Universe Implementation
+
+const Type* TypeContext::intType() {
+    static const IntType instance;
+    return &instance;
+}
+
+const Type* TypeContext::nilType() {
+    static const NilType instance;
+    return &instance;
+}
+
+// At namespace scope, so the checks for it below compare against a constant
+static const ErrorType errorTypeInstance;
+
+const Type* TypeContext::errorType() {
+    return &errorTypeInstance;
+}
+
+size_t TypeContext::FnKeyHash::operator()(const FnKey& k) const {
+    size_t h = std::hash<const Type*>()(k.ret);
+    for (size_t i = 0; i < k.count; ++i) {
+        h ^= std::hash<const Type*>()(k.params[i]) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+    return h;
+}
+
+Symbol SymbolTable::intern(const std::string& name) {
+    auto [it, inserted] = ids.emplace(name, uint32_t(names.size()));
+    if (inserted) names.push_back(&it->first);
+    return Symbol{it->second, &it->first};
+}
+
+// Blocks double from 16 KiB to 1 MiB, so small programs stay small and large
+// ones need only a few dozen blocks; oversized requests get a block of their own
+void AstArena::grow(size_t n) {
+    size_t size = std::min<size_t>(size_t(16) << 10 << std::min<size_t>(blocks.size(), 6), size_t(1) << 20);
+    size = std::max(size, n);
+    blocks.push_back(static_cast<char*>(::operator new(size)));
+    cur = blocks.back();
+    end = cur + size;
+    allocated += size;
+}
+
+AstArena::~AstArena() {
+    for (char* block : blocks) ::operator delete(block);
+}
+
+void AstArena::adopt(AstArena& other) {
+    // This arena keeps allocating from its current block
+    blocks.insert(blocks.end(), other.blocks.begin(), other.blocks.end());
+    allocated += other.allocated;
+    other.blocks.clear();
+    other.cur = other.end = nullptr;
+    other.allocated = 0;
+}
+
+void AstArena::release() {
+    for (char* block : blocks) ::operator delete(block);
+    blocks.clear();
+    cur = end = nullptr;
+    allocated = 0;
+}
+
+const Type* TypeContext::structType(Symbol name) {
+    if (const Type* const* type = structs.find(name)) return *type;
+    owned.push_back(std::make_unique<StructType>(name, uint32_t(structs.size())));
+    return structs[name] = owned.back().get();
+}
+
+const Type* TypeContext::ptrTo(const Type* pointee) {
+    auto it = ptrs.find(pointee);
+    if (it != ptrs.end()) return it->second;
+    owned.push_back(std::make_unique<PtrType>(pointee));
+    return ptrs[pointee] = owned.back().get();
+}
+
+const Type* TypeContext::arrayOf(const Type* element) {
+    auto it = arrays.find(element);
+    if (it != arrays.end()) return it->second;
+    owned.push_back(std::make_unique<ArrayType>(element));
+    return arrays[element] = owned.back().get();
+}
+
+const FnType* TypeContext::fnType(const Type* const* params, size_t count, const Type* ret) {
+    auto it = fns.find(FnKey{params, count, ret});
+    if (it != fns.end()) return it->second;
+    auto fn = std::make_unique<FnType>(std::vector<const Type*>(params, params + count), ret);
+    const FnType* result = fn.get();
+    owned.push_back(std::move(fn));
+    // The new key views the FnType's own parameters, which never move
+    fns.emplace(FnKey{result->paramTypes.data(), count, ret}, result);
+    return result;
+}
+
 // Type Helper Implementations
 
 // Type equality function eq(τ₁, τ₂)
 // compares types s.t. two types are eq iff they are the same
 // type or if one is a pointer or array type and the other is nil.
-bool typeEq(const std::shared_ptr<Type>& t1, const std::shared_ptr<Type>& t2) {
+// Types are interned, so structural equality is pointer equality.
+#ifdef CFLAT_STATS
+HotCounters hotCounters;
+#endif
+
+bool typeEq(const Type* t1, const Type* t2) {
+    CFLAT_COUNT(typeEqCalls);
     if (!t1 || !t2) return false;
+    if (t1 == t2) return true;
     // Handle nil comparison
-    if (dynamic_cast<NilType*>(t1.get())) {
-        return dynamic_cast<NilType*>(t2.get()) != nullptr ||
-               dynamic_cast<PtrType*>(t2.get()) != nullptr ||
-               dynamic_cast<ArrayType*>(t2.get()) != nullptr;
+    if (t1 == TypeContext::nilType()) {
+        return isa<PtrType>(t2) ||
+               isa<ArrayType>(t2);
     }
-     if (dynamic_cast<NilType*>(t2.get())) {
+    if (t2 == TypeContext::nilType()) {
         // t1 is not Nil, check if it's Ptr or Array
-        return dynamic_cast<PtrType*>(t1.get()) != nullptr ||
-               dynamic_cast<ArrayType*>(t1.get()) != nullptr;
+        return isa<PtrType>(t1) ||
+               isa<ArrayType>(t1);
     }
-    // use virtual equals for deep comparison
-    return t1->equals(*t2);
+    return false;
 }
 
 // pick_nonnil helper function
 // Type × Type → Type that takes two types and returns one of the
 // arguments that isn’t nil if possible; if both arguments are nil then it returns nil.
-std::shared_ptr<Type> pickNonNil(const std::shared_ptr<Type>& t1, const std::shared_ptr<Type>& t2) {
-    if (!dynamic_cast<NilType*>(t1.get())) {
+const Type* pickNonNil(const Type* t1, const Type* t2) {
+    if (t1 != TypeContext::nilType()) {
         return t1;
     }
      // If t1 is Nil, return t2 (which might also be Nil)
@@ -132,481 +240,401 @@ std::shared_ptr<Type> pickNonNil(const std::shared_ptr<Type>& t1, const std::sha
 // Print Implementations
 inline bool isLowPrecedence(const Exp* exp) {
     if (!exp) return false;
-    
+
     // ONLY BinOp and Select are low precedence and need wrapping.
-    if (dynamic_cast<const BinOp*>(exp) ||
-        dynamic_cast<const Select*>(exp)) {
-        return true;
+    switch (exp->kind) {
+        case NodeKind::BinOp:
+        case NodeKind::Select:
+            return true;
+        default:
+            return false;
     }
-    
-    return false;
 }
 
-// Helper to get operator precedence (higher number = higher precedence)
-inline int getOperatorPrecedence(BinaryOp op) {
-    switch(op) {
-        case BinaryOp::Mul:
-        case BinaryOp::Div:
-            return 6; // Multiplicative
-        case BinaryOp::Add:
-        case BinaryOp::Sub:
-            return 5; // Additive
-        case BinaryOp::Lt:
-        case BinaryOp::Lte:
-        case BinaryOp::Gt:
-        case BinaryOp::Gte:
-            return 4; // Comparison
-        case BinaryOp::Eq:
-        case BinaryOp::NotEq:
-            return 3; // Equality
-        case BinaryOp::And:
-            return 2; // Logical AND
-        case BinaryOp::Or:
-            return 1; // Logical OR
-    }
-    return 0;
-}
-
-// Forward declaration
-std::string toStringCompact(const Exp* exp);
-
-// Helper to render expressions compactly (without spaces in Neg UnOps) for error messages
-std::string toStringCompact(const Exp* exp) {
-    if (!exp) return "";
-    
-    // Handle UnOp specially - no space after "-", but keep space after "not"
-    if (const UnOp* unop = dynamic_cast<const UnOp*>(exp)) {
-        std::string opStr;
-        switch(unop->op) {
-            case UnaryOp::Neg: opStr = "-"; break;  // No space
-            case UnaryOp::Not: opStr = "not "; break;  // Keep space
-        }
-        std::string expStr = toStringCompact(unop->exp.get());
-        if (isLowPrecedence(unop->exp.get())) {
-            return opStr + "(" + expStr + ")";
-        } else {
-            return opStr + expStr;
+UnaryOp unaryOpNamed(std::string_view name) {
+    for (const UnaryOpInfo& info : kUnaryOps) {
+        if (info.name == name) return info.op;
+    }
+    throw std::runtime_error("Unknown unary operator: " + std::string(name));
+}
+
+BinaryOp binaryOpNamed(std::string_view name) {
+    for (const BinaryOpInfo& info : kBinaryOps) {
+        if (info.name == name) return info.op;
+    }
+    throw std::runtime_error("Unknown binary operator: " + std::string(name));
+}
+
+namespace {
+
+// Renders expressions, places and calls as source text for error messages,
+// appending to one buffer. A node's text is a sequence of pieces (literal
+// text, a type, or a child in some form) that wait on an explicit stack, so
+// rendering is linear in the size of the expression and never recurses,
+// however deeply the expression is nested.
+class ExpWriter {
+public:
+    // How a node is rendered
+    enum Form : uint8_t {
+        Text,           // not a node: a literal string
+        TypeName,       // not a node: a type
+        Plain,          // the toString() form
+        Compact,        // toString(), but "-x" for Neg and BinOps parenthesized by precedence
+        SelectOperands, // a BinOp with Selects on either side parenthesized
+    };
+
+    explicit ExpWriter(std::string& out) : out(out) {}
+
+    ExpWriter& text(std::string_view s) { out += s; return *this; }
+    ExpWriter& type(const Type* t) { out += t->toString(); return *this; }
+    ExpWriter& node(const Node* n, Form form = Plain) {
+        pending.push_back({form, 0, n});
+        while (!pending.empty()) {
+            Piece piece = pending.back();
+            pending.pop_back();
+            write(piece);
         }
+        return *this;
     }
-    
-    // Handle BinOp - recursively use compact form for operands
-    if (const BinOp* binop = dynamic_cast<const BinOp*>(exp)) {
-        std::string opStr;
-        switch(binop->op) {
-            case BinaryOp::Add: opStr = " + "; break;
-            case BinaryOp::Sub: opStr = " - "; break;
-            case BinaryOp::Mul: opStr = " * "; break;
-            case BinaryOp::Div: opStr = " / "; break;
-            case BinaryOp::Eq: opStr = " == "; break;
-            case BinaryOp::NotEq: opStr = " != "; break;
-            case BinaryOp::Lt: opStr = " < "; break;
-            case BinaryOp::Lte: opStr = " <= "; break;
-            case BinaryOp::Gt: opStr = " > "; break;
-            case BinaryOp::Gte: opStr = " >= "; break;
-            case BinaryOp::And: opStr = " and "; break;
-            case BinaryOp::Or: opStr = " or "; break;
+
+private:
+    struct Piece {
+        Form form;
+        uint32_t length; // of the text, for Text
+        const void* ptr; // const char*, const Type* or const Node*, by form
+    };
+
+    std::string& out;
+    std::vector<Piece> pending;
+
+    // Queue pieces of the node being expanded, in reading order; write()
+    // reverses them so the first ends up on top
+    void lit(std::string_view s) { pending.push_back({Text, uint32_t(s.size()), s.data()}); }
+    void typeName(const Type* t) { pending.push_back({TypeName, 0, t}); }
+    void child(const Node* n, Form form = Plain) { pending.push_back({form, 0, n}); }
+    void parens(const Node* n, bool wrap, Form form = Plain) {
+        if (wrap) lit("(");
+        child(n, form);
+        if (wrap) lit(")");
+    }
+    // Select guards and allocation sizes set off Selects on both sides of a BinOp
+    void guardLike(const Exp* e) { child(e, isa<BinOp>(e) ? SelectOperands : Plain); }
+
+    void write(const Piece& piece) {
+        switch (piece.form) {
+            case Text: out.append(static_cast<const char*>(piece.ptr), piece.length); return;
+            case TypeName: out += static_cast<const Type*>(piece.ptr)->toString(); return;
+            default: break;
         }
-        
-        // Get precedence for parenthesization logic
-        int myPrecedence = getOperatorPrecedence(binop->op);
-        
-        // Left operand - wrap if strictly lower precedence
-        std::string leftStr = toStringCompact(binop->left.get());
-        if (const BinOp* leftBinOp = dynamic_cast<const BinOp*>(binop->left.get())) {
-            int leftPrecedence = getOperatorPrecedence(leftBinOp->op);
-            if (leftPrecedence < myPrecedence) {
-                leftStr = "(" + leftStr + ")";
+        size_t mark = pending.size();
+        expand(static_cast<const Node*>(piece.ptr), piece.form);
+        std::reverse(pending.begin() + mark, pending.end());
+    }
+
+    // Writes a leaf straight to the buffer, or queues the pieces of `n`
+    void expand(const Node* n, Form form) {
+        if (form == Compact) {
+            if (const UnOp* unop = dyn_cast<UnOp>(n)) {
+                // No space after "-", but keep the space after "not"
+                lit(opInfo(unop->op).compactText);
+                parens(unop->exp, isLowPrecedence(unop->exp), Compact);
+                return;
             }
+            if (const BinOp* binop = dyn_cast<BinOp>(n)) {
+                // Left operand - wrap if strictly lower precedence. Right operand -
+                // wrap if strictly lower precedence, OR if equal precedence and both
+                // are comparison operators (for chains like a <= b > c)
+                const BinaryOpInfo& info = opInfo(binop->op);
+                const BinOp* leftBinOp = dyn_cast<BinOp>(binop->left);
+                const BinOp* rightBinOp = dyn_cast<BinOp>(binop->right);
+                int rightPrecedence = rightBinOp ? opInfo(rightBinOp->op).precedence : 0;
+                parens(binop->left, leftBinOp && opInfo(leftBinOp->op).precedence < info.precedence, Compact);
+                lit(info.text);
+                parens(binop->right, rightBinOp && (rightPrecedence < info.precedence ||
+                                                    (rightPrecedence == info.precedence && info.comparison)), Compact);
+                return;
+            }
+            // For other expressions, use normal toString
+        }
+        if (form == SelectOperands) {
+            const BinOp* binop = cast<BinOp>(n);
+            parens(binop->left, isa<Select>(binop->left));
+            lit(opInfo(binop->op).text);
+            parens(binop->right, isa<Select>(binop->right));
+            return;
         }
-        
-        // Right operand - wrap if strictly lower precedence,
-        // OR if equal precedence and both are comparison operators (for chains like a < b < c)
-        std::string rightStr = toStringCompact(binop->right.get());
-        if (const BinOp* rightBinOp = dynamic_cast<const BinOp*>(binop->right.get())) {
-            int rightPrecedence = getOperatorPrecedence(rightBinOp->op);
-            bool needsParens = rightPrecedence < myPrecedence;
-            
-            // Special case: comparison chains (same precedence comparisons)
-            if (!needsParens && rightPrecedence == myPrecedence && myPrecedence == 4) {
-                // Both are comparison operators - wrap for chains like a <= b > c
-                needsParens = true;
+
+        switch (n->kind) {
+            case NodeKind::Id: out += cast<Id>(n)->name.str(); return;
+            case NodeKind::Num: out += std::to_string(cast<Num>(n)->value); return;
+            case NodeKind::Nil: out += "nil"; return;
+            case NodeKind::NewSingle: out += "new " + cast<NewSingle>(n)->type->toString(); return;
+            case NodeKind::Val: child(cast<Val>(n)->place); return;
+            case NodeKind::Call: child(cast<CallExp>(n)->fun_call); return;
+            case NodeKind::UnOp: {
+                const UnOp* unop = cast<UnOp>(n);
+                lit(opInfo(unop->op).text);
+                parens(unop->exp, isLowPrecedence(unop->exp));
+                return;
+            }
+            case NodeKind::BinOp: {
+                const BinOp* binop = cast<BinOp>(n);
+                child(binop->left);
+                lit(opInfo(binop->op).text);
+                parens(binop->right, isa<Select>(binop->right));
+                return;
+            }
+            case NodeKind::Select: {
+                // BinOp Selects in the guard are parenthesized because
+                // "a ? b : c and d ? e : f" is ambiguous without them, and
+                // so are nested Selects in the true/false branches
+                const Select* select = cast<Select>(n);
+                guardLike(select->guard);
+                lit(" ? ");
+                parens(select->tt, isa<Select>(select->tt));
+                lit(" : ");
+                parens(select->ff, isa<Select>(select->ff));
+                return;
+            }
+            case NodeKind::NewArray: {
+                const NewArray* alloc = cast<NewArray>(n);
+                lit("[");
+                typeName(alloc->type);
+                lit("; ");
+                guardLike(alloc->size);
+                lit("]");
+                return;
             }
-            
-            if (needsParens) {
-                rightStr = "(" + rightStr + ")";
+            case NodeKind::ArrayAccess: {
+                // A Select array is parenthesized; the top-level error message
+                // for an access renders it without (see TypeError::render)
+                const ArrayAccess* access = cast<ArrayAccess>(n);
+                parens(access->array, isa<Select>(access->array));
+                lit("[");
+                child(access->index);
+                lit("]");
+                return;
             }
+            case NodeKind::FieldAccess: {
+                // Parenthesize Select in ptr position because field access binds tighter than ?:
+                // "a ? b : c.field" parses as "a ? b : (c.field)" not "(a ? b : c).field"
+                const FieldAccess* access = cast<FieldAccess>(n);
+                parens(access->ptr, isa<Select>(access->ptr));
+                lit(".");
+                lit(access->field.str());
+                return;
+            }
+            case NodeKind::Deref: {
+                // Add parentheses for:
+                // - Low-precedence expressions (BinOp, Select)
+                // - Places (ArrayAccess, FieldAccess) accessed through Val - to show dereference applies to the whole place
+                // - NewSingle and NewArray - to distinguish from type syntax
+                // - But NOT for plain Deref (allows chaining like `x.*.*`)
+                const Exp* exp = cast<Deref>(n)->exp;
+                const Val* val = dyn_cast<Val>(exp);
+                bool wrap = isLowPrecedence(exp) ||
+                            (val && (isa<ArrayAccess>(val->place) || isa<FieldAccess>(val->place))) ||
+                            isa<NewArray>(exp) || isa<NewSingle>(exp);
+                parens(exp, wrap);
+                lit(".*");
+                return;
+            }
+            case NodeKind::FunCall: {
+                // Parenthesize if the CALLEE expression is low-precedence
+                const FunCall* call = cast<FunCall>(n);
+                parens(call->callee, isLowPrecedence(call->callee));
+                lit("(");
+                for (size_t i = 0; i < call->args.size(); ++i) {
+                    if (i > 0) lit(", ");
+                    child(call->args[i]);
+                }
+                lit(")");
+                return;
+            }
+            default:
+                throw std::logic_error("printer reached a non-expression node");
         }
-        
-        return leftStr + opStr + rightStr;
     }
-    
-    // For other expressions, use normal toString
-    return exp->toString();
-}
+};
 
-// std::string ArrayAccess::toString() const {
-//    std::string arrayStr = array->toString();
-    
-//     // --- Logic for the 'array' part (LHS of [...]) ---
-//     const Node* checkArrayExp = array.get();
-//     if (auto valNode = dynamic_cast<const Val*>(checkArrayExp)) {
-//         checkArrayExp = valNode->place.get();
-//     }
-
-//     // Parenthesize if the array expression has lower precedence
-//     // (Select, BinOp, Call)
-//     // *** REMOVED NewArray from this list ***
-//     if (dynamic_cast<const BinOp*>(array.get()) ||
-//         dynamic_cast<const Select*>(array.get()) || 
-//         dynamic_cast<const CallExp*>(array.get())
-//         ) {
-//         arrayStr = "(" + arrayStr + ")";
-//     }
-
-//     // --- Logic for the 'index' part (inside [...]) ---
-//     std::string indexStr = index->toString();
-    
-//     const Node* checkIndexExp = index.get();
-//     if (auto valNode = dynamic_cast<const Val*>(checkIndexExp)) {
-//          checkIndexExp = valNode->place.get();
-//     }
-
-//     // *** ADDED THIS ENTIRE BLOCK ***
-//     // Parenthesize if the index expression has lower precedence
-//     // (Select, BinOp, Call, NewArray)
-//     if (dynamic_cast<const BinOp*>(index.get()) ||
-//         dynamic_cast<const Select*>(index.get()) ||
-//         dynamic_cast<const NewArray*>(index.get()) || 
-//         dynamic_cast<const CallExp*>(index.get())
-//         ) {
-//         indexStr = "(" + indexStr + ")";
-//     }
-    
-//     // Combine the (potentially parenthesized) parts
-//     return arrayStr + "[" + indexStr + "]";
-// }
-
-std::string ArrayAccess::toString() const {
-    std::string arrayStr = array->toString();
-    std::string indexStr = index->toString();
+} // namespace
 
-    // If array is a Select that's NOT at top-level, add parens
-    // We know we're not at top-level if we're being called from a parent node
-    // But we can't detect that. So we need the parent (e.g., outer Select) to handle it.
-    
-    // Actually, just always add parens if array is Select - the top-level error
-    // message won't have an ArrayAccess wrapping the Select.
-    if (dynamic_cast<const Select*>(array.get())) {
-        arrayStr = "(" + arrayStr + ")";
-    }
-    
-    // Handle BinOp with Select on right in the index - need to re-render with parens
-    if (const BinOp* indexBinOp = dynamic_cast<const BinOp*>(index.get())) {
-        if (dynamic_cast<const Select*>(indexBinOp->right.get()) != nullptr) {
-            // Re-render the BinOp with the right Select parenthesized
-            std::string leftStr = indexBinOp->left->toString();
-            std::string rightStr = "(" + indexBinOp->right->toString() + ")";
-            
-            std::string opStr;
-            switch(indexBinOp->op) {
-                case BinaryOp::Add: opStr = "+"; break;
-                case BinaryOp::Sub: opStr = "-"; break;
-                case BinaryOp::Mul: opStr = "*"; break;
-                case BinaryOp::Div: opStr = "/"; break;
-                case BinaryOp::Eq: opStr = "=="; break;
-                case BinaryOp::NotEq: opStr = "!="; break;
-                case BinaryOp::Lt: opStr = "<"; break;
-                case BinaryOp::Lte: opStr = "<="; break;
-                case BinaryOp::Gt: opStr = ">"; break;
-                case BinaryOp::Gte: opStr = ">="; break;
-                case BinaryOp::And: opStr = "and"; break;
-                case BinaryOp::Or: opStr = "or"; break;
-            }
-            
-            indexStr = leftStr + " " + opStr + " " + rightStr;
-        }
-    }
-    
-    return arrayStr + "[" + indexStr + "]";
+std::string Exp::toString() const {
+    std::string s;
+    ExpWriter(s).node(this);
+    return s;
 }
 
-std::string FieldAccess::toString() const {
-    std::string ptrStr = ptr->toString();
-
-    // Parenthesize Select in ptr position because field access binds tighter than ?:
-    // "a ? b : c.field" parses as "a ? b : (c.field)" not "(a ? b : c).field"
-    if (dynamic_cast<const Select*>(ptr.get())) {
-        ptrStr = "(" + ptrStr + ")";
-    }
-    
-    return ptrStr + "." + field;
+std::string Place::toString() const {
+    std::string s;
+    ExpWriter(s).node(this);
+    return s;
 }
 
-void UnOp::print(std::ostream& os) const {
-    os << "UnOp(";
-    switch (op) {
-        case UnaryOp::Neg: os << "Neg"; break;
-        case UnaryOp::Not: os << "Not"; break;
-    }
-    os << ", " << exp << ")";
+std::string FunCall::toString() const {
+    std::string s;
+    ExpWriter(s).node(this);
+    return s;
 }
 
-std::string UnOp::toString() const {
-     std::string opStr;
-     switch(op) {
-         case UnaryOp::Neg: opStr = "- "; break;
-         case UnaryOp::Not: opStr = "not "; break;
-     }
-     std::string expStr = exp->toString();
-     
-     if (isLowPrecedence(exp.get())) {
-         return opStr + "(" + expStr + ")";
-     } else {
-         return opStr + expStr;
-     }
+// Type Error Rendering
+const char* TypeError::what() const noexcept {
+    if (kind == TypeErrorKind::Message) return std::runtime_error::what();
+    if (!rendered) {
+        try {
+            text = render();
+        } catch (...) {
+            text = "type error (message could not be rendered)";
+        }
+        rendered = true;
+    }
+    return text.c_str();
 }
 
-std::string NewArray::toString() const {
-    std::string sizeStr = size->toString();
-    
-    // If size is a BinOp with Select on either operand, re-render with parens on Selects
-    if (const BinOp* sizeBinOp = dynamic_cast<const BinOp*>(size.get())) {
-        bool leftIsSelect = dynamic_cast<const Select*>(sizeBinOp->left.get()) != nullptr;
-        bool rightIsSelect = dynamic_cast<const Select*>(sizeBinOp->right.get()) != nullptr;
-        
-        if (leftIsSelect || rightIsSelect) {
-            std::string leftStr = sizeBinOp->left->toString();
-            std::string rightStr = sizeBinOp->right->toString();
-            
-            if (leftIsSelect) {
-                leftStr = "(" + leftStr + ")";
-            }
-            if (rightIsSelect) {
-                rightStr = "(" + rightStr + ")";
+std::string TypeError::render() const {
+    std::string s;
+    ExpWriter w(s);
+    switch (kind) {
+        case TypeErrorKind::Message:
+            return std::runtime_error::what();
+
+        // --- Expressions and places ---
+        case TypeErrorKind::UnknownId:
+            w.text("id ").text(cast<Id>(node)->name.str()).text(" does not exist in this scope");
+            break;
+        case TypeErrorKind::NegativeNumber:
+            w.text("negative number ").text(std::to_string(cast<Num>(node)->value)).text(" is not allowed");
+            break;
+        case TypeErrorKind::DerefNonPointer:
+            // The top-level Deref without extra parens
+            w.text("non-pointer type ").type(t0).text(" for dereference '");
+            w.node(cast<Deref>(node)->exp, ExpWriter::Compact).text(".*'");
+            break;
+        case TypeErrorKind::ArrayIndexNotInt:
+        case TypeErrorKind::ArrayNotArray: {
+            // The top-level access doesn't parenthesize a Select in array position
+            const ArrayAccess* access = cast<ArrayAccess>(node);
+            w.text(kind == TypeErrorKind::ArrayIndexNotInt ? "non-int index type " : "non-array type ").type(t0);
+            w.text(" for array access '").node(access->array).text("[").node(access->index).text("]'");
+            break;
+        }
+        case TypeErrorKind::FieldBaseNotPointer:
+            w.text("<").type(t0).text("> is not a struct pointer type in field access '").node(node).text("'");
+            break;
+        case TypeErrorKind::FieldPointeeNotStruct:
+            w.text("pointer type <").type(t0).text("> does not point to a struct in field access '").node(node).text("'");
+            break;
+        case TypeErrorKind::FieldUnknownStruct:
+        case TypeErrorKind::FieldUnknownField: {
+            // t0 is the ptr(struct(id)) the field is looked up through
+            const std::string& structName = cast<StructType>(cast<PtrType>(t0)->pointeeType)->name.str();
+            if (kind == TypeErrorKind::FieldUnknownStruct) {
+                w.text("non-existent struct type ").text(structName);
+            } else {
+                w.text("non-existent field ").text(structName).text("::").text(cast<FieldAccess>(node)->field.str());
             }
-            
-            std::string opStr;
-            switch(sizeBinOp->op) {
-                case BinaryOp::Add: opStr = "+"; break;
-                case BinaryOp::Sub: opStr = "-"; break;
-                case BinaryOp::Mul: opStr = "*"; break;
-                case BinaryOp::Div: opStr = "/"; break;
-                case BinaryOp::Eq: opStr = "=="; break;
-                case BinaryOp::NotEq: opStr = "!="; break;
-                case BinaryOp::Lt: opStr = "<"; break;
-                case BinaryOp::Lte: opStr = "<="; break;
-                case BinaryOp::Gt: opStr = ">"; break;
-                case BinaryOp::Gte: opStr = ">="; break;
-                case BinaryOp::And: opStr = "and"; break;
-                case BinaryOp::Or: opStr = "or"; break;
+            w.text(" in field access '").node(node).text("'");
+            break;
+        }
+        case TypeErrorKind::SelectGuardNotInt:
+            w.text("non-int type ").type(t0).text(" for select guard '").node(cast<Select>(node)->guard).text("'");
+            break;
+        case TypeErrorKind::SelectBranchMismatch: {
+            const Select* select = cast<Select>(node);
+            w.text("incompatible types ").type(t0).text(" vs ").type(t1).text(" in select branches '");
+            w.node(select->tt).text("' vs '").node(select->ff).text("'");
+            break;
+        }
+        case TypeErrorKind::UnOpNotInt:
+            w.text("non-int operand type ").type(t0).text(" in unary op '").node(node).text("'");
+            break;
+        case TypeErrorKind::BinOpIncompatible:
+            w.text("incompatible types ").type(t0).text(" vs ").type(t1).text(" in binary op '");
+            w.node(node, ExpWriter::Compact).text("'");
+            break;
+        case TypeErrorKind::BinOpInvalidType:
+            w.text("invalid type ").type(t0).text(" used in binary op '").node(node, ExpWriter::Compact).text("'");
+            break;
+        case TypeErrorKind::BinOpLeftNotInt:
+            w.text("non-int type ").type(t0).text(" for left operand of binary op '");
+            w.node(node, ExpWriter::Compact).text("'");
+            break;
+        case TypeErrorKind::BinOpRightNotInt:
+            w.text("right operand of binary op '").node(node, ExpWriter::Compact);
+            w.text("' has type ").type(t0).text(", should be int");
+            break;
+        case TypeErrorKind::NewSingleInvalid:
+            w.text("invalid type used for allocation '").node(node).text("'");
+            break;
+        case TypeErrorKind::NewArrayAmountNotInt:
+            w.text("non-int type ").type(t0).text(" used for second argument of allocation '").node(node).text("'");
+            break;
+        case TypeErrorKind::NewArrayInvalidType:
+            w.text("invalid type used for first argument of allocation '").node(node).text("'");
+            break;
+        case TypeErrorKind::CallMain:
+            w.text("trying to call 'main'");
+            break;
+        case TypeErrorKind::CallNonFunction:
+            w.text("trying to call type ").type(t0).text(" as function pointer in call '").node(node).text("'");
+            break;
+        case TypeErrorKind::CallArity:
+            // t0 is the callee's function type
+            w.text("incorrect number of arguments (").text(std::to_string(cast<FunCall>(node)->args.size()));
+            w.text(" vs ").text(std::to_string(cast<FnType>(t0)->paramTypes.size()));
+            w.text(") in call '").node(node).text("'");
+            break;
+        case TypeErrorKind::CallArgMismatch:
+            w.text("incompatible argument type ").type(t0).text(" vs parameter type ").type(t1);
+            w.text(" for argument '").node(cast<FunCall>(node)->args[index]).text("' in call '").node(node).text("'");
+            break;
+
+        // --- Statements ---
+        case TypeErrorKind::AssignInvalidLhs:
+        case TypeErrorKind::AssignIncompatible: {
+            const Assign* assign = cast<Assign>(node);
+            if (kind == TypeErrorKind::AssignInvalidLhs) {
+                w.text("invalid type ").type(t0).text(" for left-hand side of assignment '");
+            } else {
+                w.text("incompatible types ").type(t0).text(" vs ").type(t1).text(" for assignment '");
             }
-            
-            sizeStr = leftStr + " " + opStr + " " + rightStr;
+            w.node(assign->place).text(" = ").node(assign->exp).text("'");
+            break;
         }
+        case TypeErrorKind::IfGuardNotInt:
+            w.text("non-int type ").type(t0).text(" for if guard '").node(cast<If>(node)->guard).text("'");
+            break;
+        case TypeErrorKind::WhileGuardNotInt:
+            w.text("non-int type ").type(t0).text(" for while guard '").node(cast<While>(node)->guard).text("'");
+            break;
+        case TypeErrorKind::ReturnMismatch:
+            w.text("incompatible return type ").type(t0).text(" for 'return ").node(*cast<Return>(node)->exp);
+            w.text("', should be ").type(t1);
+            break;
+        case TypeErrorKind::ReturnMissingExp:
+            w.text("missing return expression for non-int function type ").type(t0);
+            break;
+        case TypeErrorKind::ReturnNoExp:
+            w.text("return statement requires an expression in this function");
+            break;
+        case TypeErrorKind::BreakOutsideLoop:
+            w.text("break outside loop");
+            break;
+        case TypeErrorKind::ContinueOutsideLoop:
+            w.text("continue outside loop");
+            break;
     }
-    
-    return "[" + type->toString() + "; " + sizeStr + "]";
-}
-
-// std::string UnOp::toString() const {
-//      std::string opStr;
-//      switch(op) {
-//          case UnaryOp::Neg: opStr = "-"; break;
-//          case UnaryOp::Not: opStr = "not "; break;
-//      }
-//      // Get the string of the sub-expression
-//      std::string expStr = exp->toString();
-
-//      // Check if the child expression is a BinOp
-//      // We can do this by checking if the dynamic_cast succeeds.
-//      if (dynamic_cast<const BinOp*>(exp.get())) {
-//          // If it is a BinOp, add parentheses
-//          return opStr + "(" + expStr + ")";
-//      } else {
-//          // Otherwise, no parentheses
-//          return opStr + expStr;
-//      }
-//      // return opStr + exp->toString();
-// }
+    return s;
+}
 
+void UnOp::print(std::ostream& os) const {
+    os << "UnOp(" << opInfo(op).name << ", " << exp << ")";
+}
 
 void BinOp::print(std::ostream& os) const {
-    os << "BinOp { op: ";
-    switch (op) {
-        case BinaryOp::Add: os << "Add"; break;
-        case BinaryOp::Sub: os << "Sub"; break;
-        case BinaryOp::Mul: os << "Mul"; break;
-        case BinaryOp::Div: os << "Div"; break;
-        case BinaryOp::And: os << "And"; break;
-        case BinaryOp::Or: os << "Or"; break;
-        case BinaryOp::Eq: os << "Eq"; break;
-        case BinaryOp::NotEq: os << "NotEq"; break;
-        case BinaryOp::Lt: os << "Lt"; break;
-        case BinaryOp::Lte: os << "Lte"; break;
-        case BinaryOp::Gt: os << "Gt"; break;
-        case BinaryOp::Gte: os << "Gte"; break;
-    }
+    os << "BinOp { op: " << opInfo(op).name;
     os << ", left: " << left << ", right: " << right << " }";
 }
-std::string BinOp::toString() const {
-     std::string opStr;
-     switch(op) {
-        case BinaryOp::Add: opStr = "+"; break;
-        case BinaryOp::Sub: opStr = "-"; break;
-        case BinaryOp::Mul: opStr = "*"; break;
-        case BinaryOp::Div: opStr = "/"; break;
-        case BinaryOp::Eq: opStr = "=="; break;
-        case BinaryOp::NotEq: opStr = "!="; break;
-        case BinaryOp::Lt: opStr = "<"; break;
-        case BinaryOp::Lte: opStr = "<="; break;
-        case BinaryOp::Gt: opStr = ">"; break;
-        case BinaryOp::Gte: opStr = ">="; break;
-        case BinaryOp::And: opStr = "and"; break;
-        case BinaryOp::Or: opStr = "or"; break;
-     }
-     
-     std::string leftStr = left->toString();
-     std::string rightStr = right->toString();
-
-     if (dynamic_cast<const Select*>(right.get())) {
-         rightStr = "(" + rightStr + ")";
-     }
-
-     return leftStr + " " + opStr + " " + rightStr;
-}
-     
-//      // Handle operator precedence for left operand
-//      // Add parentheses if left has lower precedence
-//     //  if (const BinOp* leftBinOp = dynamic_cast<const BinOp*>(left.get())) {
-//     //      int myPrecedence = getOperatorPrecedence(op);
-//     //      int leftPrecedence = getOperatorPrecedence(leftBinOp->op);
-         
-//     //      // Left operand needs parens if it has strictly lower precedence
-//     //      if (leftPrecedence < myPrecedence) {
-//     //          leftStr = "(" + leftStr + ")";
-//     //      }
-//     //  }
-     
-//      // Handle operator precedence for right operand
-//      // Add parentheses for lower or same precedence
-//      if (const BinOp* rightBinOp = dynamic_cast<const BinOp*>(right.get())) {
-//          int myPrecedence = getOperatorPrecedence(op);
-//          int rightPrecedence = getOperatorPrecedence(rightBinOp->op);
-         
-//          bool needsParens = false;
-         
-//          // Same precedence needs parens for left-associativity
-//         //  if (rightPrecedence == myPrecedence) {
-//         //      needsParens = true;
-//         //  }
-//          // Lower precedence needs parens
-//         if (rightPrecedence < myPrecedence) {
-//              needsParens = true;
-//          }
-         
-//          if (needsParens) {
-//              rightStr = "(" + rightStr + ")";
-//          }
-//          // Also check if right BinOp has Select operands that need parens
-//          else if (dynamic_cast<const Select*>(rightBinOp->left.get()) != nullptr ||
-//                   dynamic_cast<const Select*>(rightBinOp->right.get()) != nullptr) {
-//              // Get the operator string for the right BinOp
-//              std::string rightOpStr;
-//              switch(rightBinOp->op) {
-//                 case BinaryOp::Add: rightOpStr = "+"; break;
-//                 case BinaryOp::Sub: rightOpStr = "-"; break;
-//                 case BinaryOp::Mul: rightOpStr = "*"; break;
-//                 case BinaryOp::Div: rightOpStr = "/"; break;
-//                 case BinaryOp::Eq: rightOpStr = "=="; break;
-//                 case BinaryOp::NotEq: rightOpStr = "!="; break;
-//                 case BinaryOp::Lt: rightOpStr = "<"; break;
-//                 case BinaryOp::Lte: rightOpStr = "<="; break;
-//                 case BinaryOp::Gt: rightOpStr = ">"; break;
-//                 case BinaryOp::Gte: rightOpStr = ">="; break;
-//                 case BinaryOp::And: rightOpStr = "and"; break;
-//                 case BinaryOp::Or: rightOpStr = "or"; break;
-//              }
-             
-//              // Re-render with Selects parenthesized
-//              std::string rightLeftStr = rightBinOp->left->toString();
-//              std::string rightRightStr = rightBinOp->right->toString();
-             
-//              if (dynamic_cast<const Select*>(rightBinOp->left.get()) != nullptr) {
-//                  rightLeftStr = "(" + rightLeftStr + ")";
-//              }
-             
-//              if (dynamic_cast<const Select*>(rightBinOp->right.get()) != nullptr) {
-//                  rightRightStr = "(" + rightRightStr + ")";
-//              }
-             
-//              rightStr = rightLeftStr + " " + rightOpStr + " " + rightRightStr;
-//          }
-//      }
-
-//      // Add wrapping for Select directly on the right
-//      else if (dynamic_cast<const Select*>(right.get())) {
-//           int myPrecedence = getOperatorPrecedence(op);
-//           // Assuming Select precedence is 0 or very low, wrap if right of any binary op
-//           if (myPrecedence > 0) { // Check if 'op' is actually a binary operator
-//               rightStr = "(" + rightStr + ")";
-//           }
-//      }
-     
-//      return leftStr + " " + opStr + " " + rightStr;
-// }
-
-// std::string Deref::toString() const {
-//         std::string expStr = exp->toString();
-
-//     // Unwrap Val to see the underlying Place, if it exists
-//     const Node* checkExp = exp.get();
-//     if (auto valNode = dynamic_cast<const Val*>(checkExp)) {
-//         checkExp = valNode->place.get(); // Now checkExp points to the Place
-//     }
-
-//     // Parenthesize if the inner expression has lower precedence
-//     // (BinOp, Select, NewArray, CallExp, or wrapped ArrayAccess/FieldAccess)
-//     if (dynamic_cast<const BinOp*>(exp.get()) ||
-//         dynamic_cast<const Select*>(exp.get()) ||
-//         dynamic_cast<const NewArray*>(exp.get()) ||
-//         dynamic_cast<const CallExp*>(exp.get()) ||
-//         dynamic_cast<const NewSingle*>(checkExp) ||
-//         dynamic_cast<const ArrayAccess*>(checkExp)
-//         ) {
-        
-//         return "(" + expStr + ").*";
-//     } else {
-//         // High precedence expressions (Id, Val(Id), Num, Nil, NewSingle, UnOp, Deref)
-//         // do not need parentheses.
-//         return expStr + ".*";
-//     }
-// }
-
-std::string Deref::toString() const {
-    std::string expStr = exp->toString();
-    
-    // Check if we need to unwrap Val to see the underlying Place
-    const Node* checkExp = exp.get();
-    if (auto valNode = dynamic_cast<const Val*>(checkExp)) {
-        checkExp = valNode->place.get();
-    }
-    
-    // Add parentheses for:
-    // - Low-precedence expressions (BinOp, Select) 
-    // - Places (ArrayAccess, FieldAccess) accessed through Val - to show dereference applies to the whole place
-    // - NewSingle and NewArray - to distinguish from type syntax
-    // - But NOT for plain Deref (allows chaining like `x.*.*`)
-    if (isLowPrecedence(exp.get()) ||
-        (dynamic_cast<const ArrayAccess*>(checkExp) && dynamic_cast<const Val*>(exp.get())) ||
-        (dynamic_cast<const FieldAccess*>(checkExp) && dynamic_cast<const Val*>(exp.get())) ||
-        dynamic_cast<const NewArray*>(exp.get()) ||
-        dynamic_cast<const NewSingle*>(exp.get())) {
-        return "(" + expStr + ").*";
-    } else {
-        return expStr + ".*";
-    }
-}
-
 
 void FunCall::print(std::ostream& os) const {
     os << "FunCall { callee: " << callee << ", args: [";
@@ -616,31 +644,6 @@ void FunCall::print(std::ostream& os) const {
     }
     os << "] }";
 }
-// std::string FunCall::toString() const {
-//     std::string s = callee->toString() + "(";
-//     for(size_t i = 0; i < args.size(); ++i) {
-//         s += args[i]->toString();
-//         if (i < args.size() - 1) s += ", ";
-//     }
-//     s += ")";
-//     return s;
-// }
-std::string FunCall::toString() const {
-    std::string calleeStr = callee->toString();
-    
-    // Parenthesize if the CALLEE expression is low-precedence
-    if (isLowPrecedence(callee.get())) {
-        calleeStr = "(" + calleeStr + ")";
-    }
-
-    std::string s = calleeStr + "(";
-    for(size_t i = 0; i < args.size(); ++i) {
-        s += args[i]->toString();
-        if (i < args.size() - 1) s += ", ";
-    }
-    s += ")";
-    return s;
-}
 
 void If::print(std::ostream& os) const {
     os << "If { guard: " << guard << ", tt: " << tt;
@@ -664,11 +667,11 @@ void StructDef::print(std::ostream& os) const {
 
 void Extern::print(std::ostream& os) const {
      os << "Extern { name: \"" << name << "\", prms: [";
-        for (size_t i = 0; i < param_types.size(); ++i) {
-            os << param_types[i];
-            if (i < param_types.size() - 1) os << ", ";
+        for (size_t i = 0; i < type->paramTypes.size(); ++i) {
+            os << type->paramTypes[i];
+            if (i < type->paramTypes.size() - 1) os << ", ";
         }
-        os << "], rettyp: " << rettype << " }";
+        os << "], rettyp: " << type->returnType << " }";
 }
 
 void FunctionDef::print(std::ostream& os) const {
@@ -685,7 +688,7 @@ void FunctionDef::print(std::ostream& os) const {
         if (i < locals.size() - 1) os << ", ";
     }
     os << "}, ";
-    os << "body: " << body << " }"; // Use operator<< for unique_ptr<Stmt>
+    os << "body: " << body << " }"; // Use operator<< for Stmt*
 }
 
 void Program::print(std::ostream& os) const {
@@ -707,302 +710,369 @@ void Program::print(std::ostream& os) const {
     os << "}}";
 }
 
+void Program::printTypes(std::ostream& os) const {
+    auto line = [&](const std::string& text, const Type* type) {
+        os << "  " << text << " : " << (type ? type->toString() : "<unchecked>") << "\n";
+    };
+    std::vector<const Stmt*> pending;
+    for (const FunctionDef* f : functions) {
+        os << "function " << f->name << "\n";
+        // Pre-order over the body, without recursing into nested blocks
+        pending.assign(1, f->body);
+        while (!pending.empty()) {
+            const Stmt* stmt = pending.back();
+            pending.pop_back();
+            switch (stmt->kind) {
+                case NodeKind::Stmts: {
+                    const auto& statements = cast<Stmts>(stmt)->statements;
+                    for (size_t i = statements.size(); i-- > 0;) pending.push_back(statements[i]);
+                    break;
+                }
+                case NodeKind::Assign: {
+                    const Assign* assign = cast<Assign>(stmt);
+                    line(assign->place->toString(), typeOf(assign->place));
+                    line(assign->exp->toString(), typeOf(assign->exp));
+                    break;
+                }
+                case NodeKind::CallStmt: {
+                    // The call has the return type of its callee, which is
+                    // fn(...) for externs and ptr(fn(...)) otherwise
+                    const FunCall* call = cast<CallStmt>(stmt)->fun_call;
+                    const Type* calleeType = call->callee->checkedType;
+                    if (const PtrType* ptr = dyn_cast<PtrType>(calleeType)) calleeType = ptr->pointeeType;
+                    const FnType* fn = dyn_cast<FnType>(calleeType);
+                    line(call->toString(), fn ? fn->returnType : nullptr);
+                    break;
+                }
+                case NodeKind::If: {
+                    const If* ifStmt = cast<If>(stmt);
+                    line(ifStmt->guard->toString(), typeOf(ifStmt->guard));
+                    if (ifStmt->ff) pending.push_back(*ifStmt->ff);
+                    pending.push_back(ifStmt->tt);
+                    break;
+                }
+                case NodeKind::While: {
+                    const While* loop = cast<While>(stmt);
+                    line(loop->guard->toString(), typeOf(loop->guard));
+                    pending.push_back(loop->body);
+                    break;
+                }
+                case NodeKind::Return: {
+                    const Return* ret = cast<Return>(stmt);
+                    if (ret->exp) line((*ret->exp)->toString(), typeOf(*ret->exp));
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+
+// --- Tree Walking ---
+
+const char* nodeKindName(NodeKind kind) {
+    static const char* const names[kNodeKindCount] = {
+        "Id", "Deref", "ArrayAccess", "FieldAccess",
+        "Val", "Num", "Nil", "Select", "UnOp", "BinOp", "NewSingle", "NewArray", "Call",
+        "Stmts", "Assign", "CallStmt", "If", "While", "Break", "Continue", "Return",
+        "Decl", "FunCall", "StructDef", "Extern", "FunctionDef", "Program",
+    };
+    return names[size_t(kind)];
+}
+
+void childrenOf(const Node* node, std::vector<const Node*>& kids) {
+    kids.clear();
+    switch (node->kind) {
+        case NodeKind::Deref: kids = {cast<Deref>(node)->exp}; break;
+        case NodeKind::ArrayAccess: kids = {cast<ArrayAccess>(node)->array, cast<ArrayAccess>(node)->index}; break;
+        case NodeKind::FieldAccess: kids = {cast<FieldAccess>(node)->ptr}; break;
+        case NodeKind::Val: kids = {cast<Val>(node)->place}; break;
+        case NodeKind::Select: {
+            const Select* s = cast<Select>(node);
+            kids = {s->guard, s->tt, s->ff};
+            break;
+        }
+        case NodeKind::UnOp: kids = {cast<UnOp>(node)->exp}; break;
+        case NodeKind::BinOp: kids = {cast<BinOp>(node)->left, cast<BinOp>(node)->right}; break;
+        case NodeKind::NewArray: kids = {cast<NewArray>(node)->size}; break;
+        case NodeKind::Call: kids = {cast<CallExp>(node)->fun_call}; break;
+        case NodeKind::FunCall: {
+            const FunCall* call = cast<FunCall>(node);
+            kids.push_back(call->callee);
+            kids.insert(kids.end(), call->args.begin(), call->args.end());
+            break;
+        }
+        case NodeKind::Stmts: {
+            const auto& statements = cast<Stmts>(node)->statements;
+            kids.assign(statements.begin(), statements.end());
+            break;
+        }
+        case NodeKind::Assign: kids = {cast<Assign>(node)->place, cast<Assign>(node)->exp}; break;
+        case NodeKind::CallStmt: kids = {cast<CallStmt>(node)->fun_call}; break;
+        case NodeKind::If: {
+            const If* i = cast<If>(node);
+            kids = {i->guard, i->tt};
+            if (i->ff) kids.push_back(*i->ff);
+            break;
+        }
+        case NodeKind::While: kids = {cast<While>(node)->guard, cast<While>(node)->body}; break;
+        case NodeKind::Return:
+            if (cast<Return>(node)->exp) kids = {*cast<Return>(node)->exp};
+            break;
+        default: break;
+    }
+}
+
+
+// Collecting Errors
+// Every failed premise goes through fail(), which throws the TypeError
+// unless a Diagnostics is collecting on this thread. Then it is recorded,
+// and the rule yields the error type (or, for a premise that has no type
+// of its own, simply returns). Rules given the error type for an operand
+// yield it again without checking anything, so nothing above a failed
+// expression reports it a second time.
+
+namespace {
+
+thread_local Diagnostics* collecting = nullptr;
+
+// Thrown once the collecting Diagnostics is full, to stop the check
+struct DiagnosticsFull {};
+
+// Makes diagnostics the one collecting on this thread while in scope
+class CollectingScope {
+public:
+    explicit CollectingScope(Diagnostics* diagnostics) : previous(collecting) { collecting = diagnostics; }
+    ~CollectingScope() { collecting = previous; }
+    CollectingScope(const CollectingScope&) = delete;
+    CollectingScope& operator=(const CollectingScope&) = delete;
+
+private:
+    Diagnostics* previous;
+};
+
+// Out of line and cold, so the rules' passing paths stay as small as before
+template <typename... Args>
+[[gnu::cold, gnu::noinline]] const Type* fail(Args&&... args) {
+    if (!collecting) throw TypeError(std::forward<Args>(args)...);
+    if (collecting->report(TypeError(std::forward<Args>(args)...))) throw DiagnosticsFull{};
+    return &errorTypeInstance;
+}
+
+bool failed(const Type* t) {
+    return t == &errorTypeInstance;
+}
+
+} // namespace
+
+bool Diagnostics::report(const TypeError& error) {
+    if (error.node && !seen.insert({error.node, error.kind, error.index}).second) return full();
+    errors.push_back(error);
+    return full();
+}
 
 // AST Node Check Implementations
 
 // Γ(name) = τ
 // Γ,∆ ⊢Id(name) : τ
-std::shared_ptr<Type> Id::check(const Gamma& gamma, const Delta& delta) const {
+const Type* Id::applyRule(const Gamma& gamma) const {
     // identifier name is mapped to the type τ in current scope gamma
-    auto it = gamma.find(name);
-    if (it != gamma.end()) {
+    if (const Type* type = gamma.lookup(name)) {
         // found in gamma
-        return it->second;
+        return type;
     } else {
         // not found in gamma
-        throw TypeError("id " + name + " does not exist in this scope");
+        return fail(TypeErrorKind::UnknownId, this);
     }
 }
 
 // n ≥0
 // Γ,∆ ⊢Num(n) : int
-std::shared_ptr<Type> Num::check(const Gamma& gamma, const Delta& delta) const {
+const Type* Num::applyRule() const {
     // Rule NUM
     if (value >= 0) {
         // valid number
-        return std::make_shared<IntType>();
+        return TypeContext::intType();
     } else {
-        throw TypeError("negative number " + std::to_string(value) + " is not allowed");
+        return fail(TypeErrorKind::NegativeNumber, this);
     }
 }
 
 // 
 // Γ,∆ ⊢Nil : nil
-std::shared_ptr<Type> NilExp::check(const Gamma& gamma, const Delta& delta) const {
-    return std::make_shared<NilType>();
+const Type* NilExp::applyRule() const {
+    return TypeContext::nilType();
 }
 
 // Γ,∆ ⊢e : ptr(τ)
 // Γ,∆ ⊢Deref(e) : τ
-std::shared_ptr<Type> Deref::check(const Gamma& gamma, const Delta& delta) const {
-    // Check the type of the inner expression 'e'
-    auto pointee = exp->check(gamma, delta);
+const Type* Deref::applyRule(const Type* pointee) const {
+    // 'pointee' is the type of the inner expression 'e'
     // Check if the resulting type is actually a pointer type
-    if (auto ptrType = std::dynamic_pointer_cast<PtrType>(pointee)) {
+    if (failed(pointee)) return pointee;
+    if (auto ptrType = dyn_cast<PtrType>(pointee)) {
         return ptrType->pointeeType;
     }
     // Premise failed: The type was not a PtrType
-    // Manually construct the string for top-level Deref without extra parens
-    std::string topLevelStr = toStringCompact(exp.get()) + ".*";
-    throw TypeError("non-pointer type " + pointee->toString() + " for dereference '" + topLevelStr + "'");
+    return fail(TypeErrorKind::DerefNonPointer, this, pointee);
 }
 
 // Γ,∆ ⊢arr : array(τ) Γ,∆ ⊢idx : int
 // Γ,∆ ⊢ArrayAccess(arr,idx) : τ
-std::shared_ptr<Type> ArrayAccess::check(const Gamma& gamma, const Delta& delta) const {
-    auto arrType = array->check(gamma, delta);
-    auto idxType = index->check(gamma, delta);
-
-    // Helper lambda to render top-level ArrayAccess for error messages
-    // Don't parenthesize Select in array position, but DO handle BinOp with Select in index
-    auto renderTopLevel = [this]() -> std::string {
-        std::string topLevelArrayStr = array->toString();
-        std::string topLevelIndexStr = index->toString();
-        
-        // Handle BinOp with Select on right in the index - need to re-render with parens
-        if (const BinOp* indexBinOp = dynamic_cast<const BinOp*>(index.get())) {
-            if (dynamic_cast<const Select*>(indexBinOp->right.get()) != nullptr) {
-                // Re-render the BinOp with the right Select parenthesized
-                std::string leftStr = indexBinOp->left->toString();
-                std::string rightStr = "(" + indexBinOp->right->toString() + ")";
-                
-                std::string opStr;
-                switch(indexBinOp->op) {
-                    case BinaryOp::Add: opStr = "+"; break;
-                    case BinaryOp::Sub: opStr = "-"; break;
-                    case BinaryOp::Mul: opStr = "*"; break;
-                    case BinaryOp::Div: opStr = "/"; break;
-                    case BinaryOp::Eq: opStr = "=="; break;
-                    case BinaryOp::NotEq: opStr = "!="; break;
-                    case BinaryOp::Lt: opStr = "<"; break;
-                    case BinaryOp::Lte: opStr = "<="; break;
-                    case BinaryOp::Gt: opStr = ">"; break;
-                    case BinaryOp::Gte: opStr = ">="; break;
-                    case BinaryOp::And: opStr = "and"; break;
-                    case BinaryOp::Or: opStr = "or"; break;
-                }
-                
-                topLevelIndexStr = leftStr + " " + opStr + " " + rightStr;
-            }
-        }
-        
-        return topLevelArrayStr + "[" + topLevelIndexStr + "]";
-    };
-
-    if (!typeEq(idxType, std::make_shared<IntType>())) {
-         throw TypeError("non-int index type " + idxType->toString() + " for array access '" + renderTopLevel() + "'");
+const Type* ArrayAccess::applyRule(const Type* arrType, const Type* idxType) const {
+    if (failed(arrType) || failed(idxType)) return TypeContext::errorType();
+    if (!typeEq(idxType, TypeContext::intType())) {
+         return fail(TypeErrorKind::ArrayIndexNotInt, this, idxType);
     }
 
-    if (auto actualArrayType = std::dynamic_pointer_cast<ArrayType>(arrType)) {
+    if (auto actualArrayType = dyn_cast<ArrayType>(arrType)) {
         return actualArrayType->elementType;
     }
-    if (typeEq(arrType, std::make_shared<NilType>())) {
-         throw TypeError("non-array type " + arrType->toString() + " for array access '" + renderTopLevel() + "'");
+    if (typeEq(arrType, TypeContext::nilType())) {
+         return fail(TypeErrorKind::ArrayNotArray, this, arrType);
     }
 
-    throw TypeError("non-array type " + arrType->toString() + " for array access '" + renderTopLevel() + "'");
+    return fail(TypeErrorKind::ArrayNotArray, this, arrType);
 }
 
 // Γ,∆ ⊢ptr : ptr(struct(id)) ∆(id)(fld) = τ
 // Γ,∆ ⊢FieldAccess(ptr,fld) : τ
-std::shared_ptr<Type> FieldAccess::check(const Gamma& gamma, const Delta& delta) const {
-    // Check the type of the expression 'ptr' (the expression before the '.')
-    auto baseType = ptr->check(gamma, delta); // The expression giving the pointer
+const Type* FieldAccess::applyRule(const Type* baseType, const Delta& delta) const {
+    // 'baseType' is the type of the expression 'ptr' (the expression before the '.')
     // Verify that baseType is a pointer type
-    auto ptrType = std::dynamic_pointer_cast<PtrType>(baseType);
+    if (failed(baseType)) return baseType;
+    auto ptrType = dyn_cast<PtrType>(baseType);
 
     if (!ptrType) {
         // Premise 1 failed: The type is not a pointer.
-        throw TypeError("<" + baseType->toString() + "> is not a struct pointer type in field access '" + toString() + "'");
+        return fail(TypeErrorKind::FieldBaseNotPointer, this, baseType);
     }
     // Verify that the type pointed to is specifically a struct type, struct(id)
-    auto structPtrType = std::dynamic_pointer_cast<StructType>(ptrType->pointeeType);
+    auto structPtrType = dyn_cast<StructType>(ptrType->pointeeType);
     if (!structPtrType) {
         // Premise 1 failed: The pointer does not point to a struct.
-         throw TypeError("pointer type <" + baseType->toString() + "> does not point to a struct in field access '" + toString() + "'");
+         return fail(TypeErrorKind::FieldPointeeNotStruct, this, baseType);
     }
-    // Look up the struct name 'id' in the Delta environment
-    if (!delta.count(structPtrType->name)) {
+    // Look up the struct 'id' in the Delta environment
+    const StructTable::Layout* layout = delta.find(structPtrType);
+    if (!layout) {
         // Premise 2 failed: Struct definition not found in Delta.
-         throw TypeError("non-existent struct type " + structPtrType->name + " in field access '" + toString() + "'");
+         return fail(TypeErrorKind::FieldUnknownStruct, this, baseType);
     }
 
-    // Look up the field name 'fld' within the found struct's field map
-    const auto& fields = delta.at(structPtrType->name);
-    if (!fields.count(field)) {
-         throw TypeError("non-existent field " + structPtrType->name + "::" + field + " in field access '" + toString() + "'");
+    // Look up the field name 'fld' within the found struct's field index
+    const StructTable::Field* fieldEntry = delta.field(*layout, field);
+    if (!fieldEntry) {
+         return fail(TypeErrorKind::FieldUnknownField, this, baseType);
     }
     // 'field' is the member variable holding the field name string
-    return fields.at(field);
+    return fieldEntry->type;
 }
 
 // Γ,∆ ⊢g : int Γ,∆ ⊢tt : τ1 Γ,∆ ⊢ff : τ2 eq(τ1,τ2) τ = pick-nonnil(τ1,τ2)
 // Γ,∆ ⊢Select(g,tt,ff) : τ
-std::shared_ptr<Type> Select::check(const Gamma& gamma, const Delta& delta) const {
-    auto guardType = guard->check(gamma, delta);
-    if (!typeEq(guardType, std::make_shared<IntType>())) {
-         throw TypeError("non-int type " + guardType->toString() + " for select guard '" + guard->toString() + "'");
+// The guard is checked before either branch is typed
+void Select::checkGuard(const Type* guardType) const {
+    if (!failed(guardType) && !typeEq(guardType, TypeContext::intType())) {
+         fail(TypeErrorKind::SelectGuardNotInt, this, guardType);
     }
+}
 
-    auto ttType = tt->check(gamma, delta);
-    auto ffType = ff->check(gamma, delta);
-
+const Type* Select::applyRule(const Type* ttType, const Type* ffType) const {
+    if (failed(ttType) || failed(ffType)) return TypeContext::errorType();
     if (!typeEq(ttType, ffType)) {
-         throw TypeError("incompatible types " + ttType->toString() + " vs " + ffType->toString() + " in select branches '" + tt->toString() + "' vs '" + ff->toString() + "'");
+         return fail(TypeErrorKind::SelectBranchMismatch, this, ttType, ffType);
     }
 
     return pickNonNil(ttType, ffType);
 }
 
-std::string Select::toString() const {
-    std::string guardStr = guard->toString();
-    std::string ttStr = tt->toString();
-    std::string ffStr = ff->toString();
-    
-    // If guard is a BinOp with Select operands, re-render with parens around Selects
-    // This is needed because "a ? b : c and d ? e : f" is ambiguous without parens
-    if (const BinOp* guardBinOp = dynamic_cast<const BinOp*>(guard.get())) {
-        bool leftIsSelect = dynamic_cast<const Select*>(guardBinOp->left.get()) != nullptr;
-        bool rightIsSelect = dynamic_cast<const Select*>(guardBinOp->right.get()) != nullptr;
-        
-        if (leftIsSelect || rightIsSelect) {
-            std::string leftStr = guardBinOp->left->toString();
-            std::string rightStr = guardBinOp->right->toString();
-            
-            if (leftIsSelect) {
-                leftStr = "(" + leftStr + ")";
-            }
-            if (rightIsSelect) {
-                rightStr = "(" + rightStr + ")";
-            }
-            
-            std::string opStr;
-            switch(guardBinOp->op) {
-                case BinaryOp::Add: opStr = "+"; break;
-                case BinaryOp::Sub: opStr = "-"; break;
-                case BinaryOp::Mul: opStr = "*"; break;
-                case BinaryOp::Div: opStr = "/"; break;
-                case BinaryOp::Eq: opStr = "=="; break;
-                case BinaryOp::NotEq: opStr = "!="; break;
-                case BinaryOp::Lt: opStr = "<"; break;
-                case BinaryOp::Lte: opStr = "<="; break;
-                case BinaryOp::Gt: opStr = ">"; break;
-                case BinaryOp::Gte: opStr = ">="; break;
-                case BinaryOp::And: opStr = "and"; break;
-                case BinaryOp::Or: opStr = "or"; break;
-            }
-            
-            guardStr = leftStr + " " + opStr + " " + rightStr;
-        }
-    }
-    
-    // Parenthesize nested Select expressions in the true/false branches
-    if (dynamic_cast<const Select*>(tt.get())) {
-        ttStr = "(" + ttStr + ")";
-    }
-    if (dynamic_cast<const Select*>(ff.get())) {
-        ffStr = "(" + ffStr + ")";
-    }
-    
-    return guardStr + " ? " + ttStr + " : " + ffStr;
-}
-
 // Γ,∆ ⊢e : int
 // Γ,∆ ⊢Unop(op,e) : int
-std::shared_ptr<Type> UnOp::check(const Gamma& gamma, const Delta& delta) const {
+const Type* UnOp::applyRule(const Type* operandType) const {
     // Rule UNOP
-    auto operandType = exp->check(gamma, delta);
-    if (!typeEq(operandType, std::make_shared<IntType>())) {
-         throw TypeError("non-int operand type " + operandType->toString() + " in unary op '" + toString() + "'");
+    if (failed(operandType)) return operandType;
+    if (!typeEq(operandType, TypeContext::intType())) {
+         return fail(TypeErrorKind::UnOpNotInt, this, operandType);
     }
-    return std::make_shared<IntType>();
+    return opInfo(op).result();
 }
 
 // Rules EQ/NEQ and BINOP-REST
-std::shared_ptr<Type> BinOp::check(const Gamma& gamma, const Delta& delta) const {
-    auto leftType = left->check(gamma, delta);
-    auto rightType = right->check(gamma, delta);
-
+const Type* BinOp::applyRule(const Type* leftType, const Type* rightType) const {
+    if (failed(leftType) || failed(rightType)) return TypeContext::errorType();
     // EQ/NEQ
     // op ∈{Equal,NotEq} Γ,∆ ⊢left : τ1 Γ,∆ ⊢right : τ2 eq(τ1,τ2) τ1,τ2 ̸∈{struct( ),fn(, )}
     // Γ,∆ ⊢Binop(op,left,right) : int
-    if (op == BinaryOp::Eq || op == BinaryOp::NotEq) {
+    if (opInfo(op).rule == OperandRule::Comparable) {
         if (!typeEq(leftType, rightType)) {
-            throw TypeError("incompatible types " + leftType->toString() + " vs " + rightType->toString() + " in binary op '" + toStringCompact(this) + "'");
+            return fail(TypeErrorKind::BinOpIncompatible, this, leftType, rightType);
         }
-        if (dynamic_cast<StructType*>(leftType.get()) || dynamic_cast<FnType*>(leftType.get())) {
-             throw TypeError("invalid type " + leftType->toString() + " used in binary op '" + toStringCompact(this) + "'");
+        if (isa<StructType>(leftType) || isa<FnType>(leftType)) {
+             return fail(TypeErrorKind::BinOpInvalidType, this, leftType);
         }
-        if (dynamic_cast<StructType*>(rightType.get()) || dynamic_cast<FnType*>(rightType.get())) {
-             throw TypeError("invalid type " + rightType->toString() + " used in binary op '" + toStringCompact(this) + "'");
+        if (isa<StructType>(rightType) || isa<FnType>(rightType)) {
+             return fail(TypeErrorKind::BinOpInvalidType, this, rightType);
         }
-        return std::make_shared<IntType>();
+        return opInfo(op).result();
     } else {
         // BINOP-REST applies
         // op ̸∈{Equal,NotEq} Γ,∆ ⊢left : int Γ,∆ ⊢right : int
         // Γ,∆ ⊢Binop(op,left,right) : int
-        if (!typeEq(leftType, std::make_shared<IntType>())) {
-            throw TypeError("non-int type " + leftType->toString() + " for left operand of binary op '" + toStringCompact(this) + "'");
+        if (!typeEq(leftType, TypeContext::intType())) {
+            return fail(TypeErrorKind::BinOpLeftNotInt, this, leftType);
         }
-         if (!typeEq(rightType, std::make_shared<IntType>())) {
-            throw TypeError("right operand of binary op '" + toStringCompact(this) + "' has type " + rightType->toString() + ", should be int");
+         if (!typeEq(rightType, TypeContext::intType())) {
+            return fail(TypeErrorKind::BinOpRightNotInt, this, rightType);
         }
-        return std::make_shared<IntType>();
+        return opInfo(op).result();
     }
 } // add error for different op?
 
 // typ ̸∈{nil,fn(, )}
 // Γ,∆ ⊢NewSingle(typ) : ptr(typ) 
-std::shared_ptr<Type> NewSingle::check(const Gamma& gamma, const Delta& delta) const {
-    if (dynamic_cast<NilType*>(type.get()) || dynamic_cast<FnType*>(type.get())) {
-        throw TypeError("invalid type used for allocation '" + toString() + "'");
+const Type* NewSingle::applyRule() const {
+    if (isa<NilType>(type) || isa<FnType>(type)) {
+        return fail(TypeErrorKind::NewSingleInvalid, this);
     }
     // // if struct type, does it exist in Delta? check it is defined
-    //  if (auto st = std::dynamic_pointer_cast<StructType>(type)) {
+    //  if (auto st = dynamic_cast<const StructType*>(type)) {
     //      if (delta.find(st->name) == delta.end()) {
     //          throw TypeError("allocating non-existent struct type '" + toString() + "'");
     //      }
     //  }
 
-    return std::make_shared<PtrType>(type);
+    return resultType;
 }
 
 // Γ,∆ ⊢amt : int typ ̸∈{nil,fn(, ),struct( )}
 // Γ,∆ ⊢NewArray(typ,amt) : array(typ)
-std::shared_ptr<Type> NewArray::check(const Gamma& gamma, const Delta& delta) const {
-    auto amtType = size->check(gamma, delta);
-    if (!typeEq(amtType, std::make_shared<IntType>())) {
-        throw TypeError("non-int type " + amtType->toString() + " used for second argument of allocation '" + toString() + "'");
+const Type* NewArray::applyRule(const Type* amtType) const {
+    if (failed(amtType)) return amtType;
+    if (!typeEq(amtType, TypeContext::intType())) {
+        return fail(TypeErrorKind::NewArrayAmountNotInt, this, amtType);
     }
     // Check if type is nil, fn, or struct
-     if (dynamic_cast<NilType*>(type.get()) || dynamic_cast<FnType*>(type.get()) || dynamic_cast<StructType*>(type.get())) {
-        throw TypeError("invalid type used for first argument of allocation '" + toString() + "'");
+     if (isa<NilType>(type) || isa<FnType>(type) || isa<StructType>(type)) {
+        return fail(TypeErrorKind::NewArrayInvalidType, this);
     }
 
-    return std::make_shared<ArrayType>(type);
+    return resultType;
 }
 
 // Check for FunCall (used by CallExp and CallStmt)
 // callee ̸= main ∀(e,τ1) ∈zip(args,⃗τ).[Γ,∆ ⊢e : τ2 ∧eq(τ1,τ2)]
 // Γ,∆ ⊢callee : fn(⃗τ,τ′) ∨Γ,∆ ⊢callee : ptr(fn(⃗τ,τ′))
 // Γ,∆ ⊢FunCall(callee,args) : τ′
-std::shared_ptr<Type> FunCall::check(const Gamma& gamma, const Delta& delta) const {
+void FunCall::checkCallee() const {
     // Get the type of the expression being called
     // auto calleeType = callee->check(gamma, delta);
-    // std::shared_ptr<FnType> funcType = nullptr;
+    // const FnType* funcType = nullptr;
 
     // // Direct call (identifier)? Need special handling for 'main'
-    // if (auto idExp = dynamic_cast<Id*>(callee.get())) { // Check direct Id, not Val(Id)
+    // if (auto idExp = dynamic_cast<const Id*>(callee)) { // Check direct Id, not Val(Id)
     //     if (idExp->name == "main") {
     //         throw TypeError("trying to call 'main'");
     //     }
@@ -1010,23 +1080,23 @@ std::shared_ptr<Type> FunCall::check(const Gamma& gamma, const Delta& delta) con
     //     if (gamma.count(idExp->name)) {
     //         auto potentialFnType = gamma.at(idExp->name);
     //          // Externs have type fn(...), internal functions have type ptr(fn(...))
-    //         if (auto directFn = std::dynamic_pointer_cast<FnType>(potentialFnType)) {
+    //         if (auto directFn = dynamic_cast<const FnType*>(potentialFnType)) {
     //             funcType = directFn; // Extern call
-    //         } else if (auto ptrFn = std::dynamic_pointer_cast<PtrType>(potentialFnType)) {
-    //              funcType = std::dynamic_pointer_cast<FnType>(ptrFn->pointeeType); // Internal call
+    //         } else if (auto ptrFn = dynamic_cast<const PtrType*>(potentialFnType)) {
+    //              funcType = dynamic_cast<const FnType*>(ptrFn->pointeeType); // Internal call
     //         }
     //     }
-    //  } else if (auto valExp = dynamic_cast<Val*>(callee.get())) { // Check for Val(Id) too. Val(Id) when an Id is used as an expression
+    //  } else if (auto valExp = dynamic_cast<const Val*>(callee)) { // Check for Val(Id) too. Val(Id) when an Id is used as an expression
     //      if (auto idPlace = dynamic_cast<Id*>(valExp->place.get())) {
     //          if (idPlace->name == "main") {
     //              throw TypeError("trying to call 'main'");
     //          }
     //          if (gamma.count(idPlace->name)) {
     //              auto potentialFnType = gamma.at(idPlace->name);
-    //              if (auto directFn = std::dynamic_pointer_cast<FnType>(potentialFnType)) {
+    //              if (auto directFn = dynamic_cast<const FnType*>(potentialFnType)) {
     //                  funcType = directFn;
-    //              } else if (auto ptrFn = std::dynamic_pointer_cast<PtrType>(potentialFnType)) {
-    //                  funcType = std::dynamic_pointer_cast<FnType>(ptrFn->pointeeType);
+    //              } else if (auto ptrFn = dynamic_cast<const PtrType*>(potentialFnType)) {
+    //                  funcType = dynamic_cast<const FnType*>(ptrFn->pointeeType);
     //              }
     //          }
     //      }
@@ -1037,9 +1107,9 @@ std::shared_ptr<Type> FunCall::check(const Gamma& gamma, const Delta& delta) con
     // // covers cases like (*ptr_to_func)(arg) or obj.func_ptr_field(arg)
     // if (!funcType) {
     //     // Check if 'calleeType' is PtrType(...)
-    //     if (auto ptrFn = std::dynamic_pointer_cast<PtrType>(calleeType)) {
+    //     if (auto ptrFn = dynamic_cast<const PtrType*>(calleeType)) {
     //         // Check if it points to FnType(...)
-    //         funcType = std::dynamic_pointer_cast<FnType>(ptrFn->pointeeType);
+    //         funcType = dynamic_cast<const FnType*>(ptrFn->pointeeType);
     //     }
     // }
 
@@ -1063,185 +1133,148 @@ std::shared_ptr<Type> FunCall::check(const Gamma& gamma, const Delta& delta) con
     // // All Premises Passed: Return the function's return type (τ').
     // return funcType->returnType;
 
+    // An Id callee always arrives wrapped in Val, since Id is a Place
     const Id* direct_id = nullptr;
-    if (auto idExp = dynamic_cast<Id*>(callee.get())) {
-        direct_id = idExp;
-    } else if (auto valExp = dynamic_cast<Val*>(callee.get())) {
-        direct_id = dynamic_cast<Id*>(valExp->place.get());
+    if (auto valExp = dyn_cast<Val>(callee)) {
+        direct_id = dyn_cast<Id>(valExp->place);
     }
 
     if (direct_id) {
         // It is a direct call to an Id. Check if it's 'main'.
         // This implements Premise 3: callee != 'main'
-        if (direct_id->name == "main") {
-            throw TypeError("trying to call 'main'"); //
+        if (direct_id->name.str() == "main") {
+            fail(TypeErrorKind::CallMain, this);
         }
     }
     // --- FIX END ---
+}
 
-    // 2. Now that we know it's not a call to 'main', it's safe to get the callee's type.
-    // This evaluates Premise 1: Γ, Δ ⊢ callee : fn(...) ∨ ptr(fn(...))
-    auto calleeType = callee->check(gamma, delta);
-    std::shared_ptr<FnType> funcType = nullptr;
+// 2. Once we know it's not a call to 'main', the callee's type is computed.
+// This evaluates Premise 1: Γ, Δ ⊢ callee : fn(...) ∨ ptr(fn(...))
+const FnType* FunCall::calleeFnType(const Type* calleeType) const {
+    const FnType* funcType = nullptr;
+    if (failed(calleeType)) return nullptr;
     
     // 3. Determine the actual function type (FnType) from the callee's type
     // Case 1: Direct extern call (calleeType is FnType)
-    if (auto directFn = std::dynamic_pointer_cast<FnType>(calleeType)) {
+    if (auto directFn = dyn_cast<FnType>(calleeType)) {
         funcType = directFn;
     } 
     // Case 2: Internal function call or function pointer call (calleeType is Ptr(FnType))
-    else if (auto ptrFn = std::dynamic_pointer_cast<PtrType>(calleeType)) {
-        funcType = std::dynamic_pointer_cast<FnType>(ptrFn->pointeeType);
+    else if (auto ptrFn = dyn_cast<PtrType>(calleeType)) {
+        funcType = dyn_cast<FnType>(ptrFn->pointeeType);
     }
 
     // 4. Check if a function type was found
     if (!funcType) {
          // Premise 1 failed.
-         throw TypeError("trying to call type " + calleeType->toString() + " as function pointer in call '" + toString() + "'"); //
+         fail(TypeErrorKind::CallNonFunction, this, calleeType);
+         return nullptr;
     }
 
     // 5. Check Premise 2: Argument count
     if (args.size() != funcType->paramTypes.size()) {
-         throw TypeError("incorrect number of arguments (" + std::to_string(args.size()) + " vs " + std::to_string(funcType->paramTypes.size()) + ") in call '" + toString() + "'"); //
+         fail(TypeErrorKind::CallArity, this, funcType);
+         return nullptr;
     }
 
-    // 6. Check Premise 2: Argument types
-    for (size_t i = 0; i < args.size(); ++i) {
-        auto argType = args[i]->check(gamma, delta);
-        const auto& paramType = funcType->paramTypes[i];
-        if (!typeEq(argType, paramType)) {
-             throw TypeError("incompatible argument type " + argType->toString() + " vs parameter type " + paramType->toString() + " for argument '" + args[i]->toString() + "' in call '" + toString() + "'"); //
-        }
-    }
-
-    // 7. Conclusion: Return the function's return type (τ')
-    return funcType->returnType; //
+    return funcType;
+}
 
+// 6. Check Premise 2: Argument types, one argument at a time. The caller
+// concludes with the function's return type (τ') once all have passed.
+// Without a funcType (the callee failed), the arguments are only typed.
+void FunCall::checkArg(size_t i, const Type* argType, const FnType* funcType) const {
+    if (!funcType || failed(argType)) return;
+    const auto& paramType = funcType->paramTypes[i];
+    if (!typeEq(argType, paramType)) {
+         fail(TypeErrorKind::CallArgMismatch, this, argType, paramType, i);
+    }
 }
 
 
 // Statement Check Implementations
-
-// Γ,Δ,τr,loop ⊢ stmt : ok(ret1)   Γ,Δ,τr,loop ⊢ stmts : ok(ret2)   ret = ret1 ∨ ret2
-//                      Γ,Δ,τr,loop ⊢ stmt; stmts : ok(ret)
-bool Stmts::check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const {
-    // Tracks if any statement encountered so far in this sequence *definitely* returns.
-    bool definitelyReturns = false;
-
-    // Iterate through each statement in the sequence.
-    for (const auto& stmt : statements) {
-        // If a previous statement in this block already guaranteed a return,
-        // subsequent statements are unreachable for the purpose of satisfying the function's "must return" requirement
-        if (definitelyReturns) {
-            // Check the statement but ignore its return status - already know this path guarantees a return earlier.
-            stmt->check(gamma, delta, returnType, inLoop);
-        } else {
-            // If this stmt->check returns true, then 'definitelyReturns' becomes true
-            definitelyReturns = stmt->check(gamma, delta, returnType, inLoop);
-        }
-    }
-
-    // The sequence as a whole definitely returns if any statement within it returns along the current execution path.
-    return definitelyReturns;
-}
+// Stmts sequences and Call statements have no premises of their own; the
+// engine in checker.cpp combines their children's results.
 
 // Γ,∆ ⊢lhs : τ1 Γ,∆ ⊢rhs : τ2 eq(τ1,τ2) τ1 ̸∈{nil,struct( ),fn(, )}
 // Γ,∆,τr ,loop ⊢Assign(lhs,rhs) : ok(false) 
-bool Assign::check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const {
+void Assign::applyRule(const Type* lhsType, const Type* rhsType) const {
     // Rule ASSIGN
-    auto lhsType = place->check(gamma, delta);
-    auto rhsType = exp->check(gamma, delta);
+    if (failed(lhsType) || failed(rhsType)) return;
 
     // Check for invalid types on LHS (struct/fn/nil)
-    if (dynamic_cast<StructType*>(lhsType.get()) || dynamic_cast<FnType*>(lhsType.get()) || dynamic_cast<NilType*>(lhsType.get())) {
-        throw TypeError("invalid type " + lhsType->toString() + " for left-hand side of assignment '" + place->toString() + " = " + exp->toString() + "'");
+    if (isa<StructType>(lhsType) || isa<FnType>(lhsType) || isa<NilType>(lhsType)) {
+        fail(TypeErrorKind::AssignInvalidLhs, this, lhsType);
+        return;
     }
     // // Check for invalid types on RHS (struct/fn/nil) according to rule image
-    // if (dynamic_cast<StructType*>(rhsType.get()) || dynamic_cast<FnType*>(rhsType.get()) || dynamic_cast<NilType*>(rhsType.get())) {
+    // if (dynamic_cast<const StructType*>(rhsType) || dynamic_cast<const FnType*>(rhsType) || dynamic_cast<const NilType*>(rhsType)) {
     //     throw TypeError("invalid type " + rhsType->toString() + " for right-hand side of assignment '" + place->toString() + " = " + exp->toString() + "'");
     // }
 
     if (!typeEq(lhsType, rhsType)) {
-         throw TypeError("incompatible types " + lhsType->toString() + " vs " + rhsType->toString() + " for assignment '" + place->toString() + " = " + exp->toString() + "'");
+         fail(TypeErrorKind::AssignIncompatible, this, lhsType, rhsType);
     }
-    return false; // Assignment never definitely returns
-}
-
-// Γ,∆ ⊢funcall : τ
-// Γ,∆,τr ,loop ⊢Call(funcall) : ok(false) 
-bool CallStmt::check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const {
-    fun_call->check(gamma, delta); // Check the call expression (throws on error)
-    return false; // Call statement never definitely returns
+    // Assignment never definitely returns
 }
 
 // Γ,∆ ⊢g : int Γ,∆,τr ,loop ⊢tt : ok(ret1) Γ,∆,τr ,loop ⊢ff : ok(ret1)  ret= ret1 ⊗ret2
 // Γ,∆,τr ,loop ⊢If(g,tt,ff) : ok(ret)
-bool If::check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const {
-    auto guardType = guard->check(gamma, delta);
-    if (!typeEq(guardType, std::make_shared<IntType>())) {
-         throw TypeError("non-int type " + guardType->toString() + " for if guard '" + guard->toString() + "'");
-    }
-
-    // Store whether this branch definitely returns.
-    bool ttReturns = tt->check(gamma, delta, returnType, inLoop); 
-    bool ffReturns = false;
-    if (ff.has_value()) {
-        ffReturns = (*ff)->check(gamma, delta, returnType, inLoop);
-    } else {
-        ffReturns = false; // No else branch means it doesn't definitely return
+// Definitely returns only if *both* branches definitely return; no else
+// branch means it doesn't
+void If::checkGuard(const Type* guardType) const {
+    if (!failed(guardType) && !typeEq(guardType, TypeContext::intType())) {
+         fail(TypeErrorKind::IfGuardNotInt, this, guardType);
     }
-
-    return ttReturns && ffReturns; // Definitely returns only if *both* branches definitely return
 }
 
 // Γ,∆ ⊢g : int Γ,∆,τr ,true ⊢body : ok(ret)
 // Γ,∆,τr ,loop ⊢While(g,body) : ok(false) 
-bool While::check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const {
-    auto guardType = guard->check(gamma, delta);
-    if (!typeEq(guardType, std::make_shared<IntType>())) {
-         throw TypeError("non-int type " + guardType->toString() + " for while guard '" + guard->toString() + "'");
+// The body is checked with inLoop = true; its return status doesn't matter,
+// since a while loop never definitely returns
+void While::checkGuard(const Type* guardType) const {
+    if (!failed(guardType) && !typeEq(guardType, TypeContext::intType())) {
+         fail(TypeErrorKind::WhileGuardNotInt, this, guardType);
     }
-    // Check body with inLoop = true
-    body->check(gamma, delta, returnType, true); // Body return status doesn't matter for the while loop itself
-    return false; // While loop never definitely returns
 }
 
 // Γ,∆ ⊢e : τ eq(τ,τr)
 // Γ,∆,τr ,loop ⊢Return(e) : ok(true)
-bool Return::check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const {
+void Return::applyRule(const Type* expType, const Type* returnType) const {
     if (exp.has_value()) {
-        auto expType = (*exp)->check(gamma, delta);
-        if (!typeEq(expType, returnType)) {
-             throw TypeError("incompatible return type " + expType->toString() + " for 'return " + (*exp)->toString() + "', should be " + returnType->toString());
+        if (!failed(expType) && !typeEq(expType, returnType)) {
+             fail(TypeErrorKind::ReturnMismatch, this, expType, returnType);
         }
     } else {
         // Handle void return. Let's assume non-int return types aren't allowed yet based on main's spec
-         if (!typeEq(returnType, std::make_shared<IntType>())) { // Placeholder check - adjust if void is added
-             throw TypeError("missing return expression for non-int function type " + returnType->toString());
+         if (!typeEq(returnType, TypeContext::intType())) { // Placeholder check - adjust if void is added
+             fail(TypeErrorKind::ReturnMissingExp, this, returnType);
+             return;
          }
          // If we allow void, check if returnType is void here
-         throw TypeError("return statement requires an expression in this function"); // Assuming non-void for now
+         fail(TypeErrorKind::ReturnNoExp, this); // Assuming non-void for now
     }
-    return true; // Return statement always definitely returns
+    // Return statement always definitely returns
 }
 
 // loop= true
 // Γ,∆,τr ,loop ⊢Break : ok(false)
-bool Break::check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const {
+void Break::applyRule(bool inLoop) const {
     if (!inLoop) {
-        throw TypeError("break outside loop");
+        fail(TypeErrorKind::BreakOutsideLoop, this);
     }
-    return false; // Break never definitely returns
+    // Break never definitely returns
 }
 
 // loop= true
 // Γ,∆,τr ,loop ⊢Continue : ok(false)
-bool Continue::check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const {
+void Continue::applyRule(bool inLoop) const {
     // Rule CONTINUE
     if (!inLoop) {
-        throw TypeError("continue outside loop");
+        fail(TypeErrorKind::ContinueOutsideLoop, this);
     }
-    return false; // Continue never definitely returns
+    // Continue never definitely returns
 }
 
 
@@ -1250,132 +1283,282 @@ bool Continue::check(const Gamma& gamma, const Delta& delta, const std::shared_p
 // |flds|>0 ∀Decl(name,τ) ∈flds.[τ ̸∈{nil,struct( ),fn(, )}]
 // Γ,∆ ⊢Struct(name,flds) : ok
 void StructDef::check(const Gamma& gamma, const Delta& delta) const {
+    CFLAT_PROFILE_SCOPE("StructDef::check");
     if (fields.empty()) {
-        throw TypeError("empty struct " + name);
+        fail("empty struct " + name.str());
+        return;
     }
-    std::set<std::string> fieldNames; // To check for duplicate field names locally
+    SymbolMap<bool> fieldNames; // To check for duplicate field names locally
+    fieldNames.reserve(fields.size());
     for (const auto& field : fields) {
         // Check field type validity
-        if (dynamic_cast<NilType*>(field.type.get()) || dynamic_cast<StructType*>(field.type.get()) || dynamic_cast<FnType*>(field.type.get())) {
-             throw TypeError("invalid type " + field.type->toString() + " for struct field " + name + "::" + field.name);
+        if (isa<NilType>(field.type) || isa<StructType>(field.type) || isa<FnType>(field.type)) {
+             fail("invalid type " + field.type->toString() + " for struct field " + name.str() + "::" + field.name.str());
         }
          // Check for duplicate field names within this struct
-        if (!fieldNames.insert(field.name).second) {
-             throw TypeError("Duplicate field name '" + field.name + "' in struct '" + name + "'");
+        if (!fieldNames.insert(field.name, true)) {
+             fail("Duplicate field name '" + field.name.str() + "' in struct '" + name.str() + "'");
         }
     }
 }
 
 // Γ′ = Γ + (prms ∪locals) Γ′, ∆,τr ,false ⊢stmts : ok(true) ∀(Decl(name,τ),e) ∈(prms ∪locals).[τ ̸∈{nil,struct( ),fn(, )}]
 // Γ,∆ ⊢Function(name,prms,τr,locals,stmts) : ok
-void FunctionDef::check(const Gamma& gamma, const Delta& delta) const {
-    Gamma localGamma = gamma; // Copy global gamma
-    std::set<std::string> localNames; // Check param/local duplicates
+void FunctionDef::check(const Gamma& gamma, const Delta& delta, bool flat) const {
+    CFLAT_PROFILE_SCOPE("FunctionDef::check");
+    Gamma localGamma(&gamma); // Local frame over the global gamma
+    localGamma.reserve(params.size() + locals.size());
+    SymbolMap<bool> localNames; // Check param/local duplicates
+    localNames.reserve(params.size() + locals.size());
 
     // Add parameters to localGamma and check types/duplicates
     for(const auto& p : params) {
-        if (dynamic_cast<NilType*>(p.type.get()) || dynamic_cast<StructType*>(p.type.get()) || dynamic_cast<FnType*>(p.type.get())) {
-             throw TypeError("invalid type " + p.type->toString() + " for variable " + p.name + " in function " + name);
+        if (isa<NilType>(p.type) || isa<StructType>(p.type) || isa<FnType>(p.type)) {
+             fail("invalid type " + p.type->toString() + " for variable " + p.name.str() + " in function " + name.str());
         }
-        if (!localNames.insert(p.name).second) {
-            throw TypeError("Duplicate parameter/local name '" + p.name + "' in function '" + name + "'");
+        if (!localNames.insert(p.name, true)) {
+            fail("Duplicate parameter/local name '" + p.name.str() + "' in function '" + name.str() + "'");
         }
         localGamma[p.name] = p.type;
     }
      // Add locals to localGamma and check types/duplicates
     for(const auto& l : locals) {
-        if (dynamic_cast<NilType*>(l.type.get()) || dynamic_cast<StructType*>(l.type.get()) || dynamic_cast<FnType*>(l.type.get())) {
-             throw TypeError("invalid type " + l.type->toString() + " for variable " + l.name + " in function " + name);
+        if (isa<NilType>(l.type) || isa<StructType>(l.type) || isa<FnType>(l.type)) {
+             fail("invalid type " + l.type->toString() + " for variable " + l.name.str() + " in function " + name.str());
         }
-         if (!localNames.insert(l.name).second) {
-            throw TypeError("Duplicate parameter/local name '" + l.name + "' in function '" + name + "'");
+         if (!localNames.insert(l.name, true)) {
+            fail("Duplicate parameter/local name '" + l.name.str() + "' in function '" + name.str() + "'");
         }
          localGamma[l.name] = l.type;
     }
 
     // Check if body exists (rule [stmts: ok(true)] means body must exist and return)
     if (!body) {
-        throw TypeError("function " + name + " has an empty body");
+        fail("function " + name.str() + " has an empty body");
+        return;
     }
     // check if the Stmts node is empty
-     if (auto stmtsPtr = dynamic_cast<Stmts*>(body.get())) {
+     if (auto stmtsPtr = dyn_cast<Stmts>(body)) {
          if (stmtsPtr->statements.empty()) {
-             throw TypeError("function " + name + " has an empty body");
+             fail("function " + name.str() + " has an empty body");
+             return;
          }
      } else {
          // This implies the body isn't even a Stmts node, which is likely a parsing/AST build error
-          throw TypeError("function " + name + " has an invalid body structure (expected Stmts)");
+          fail("function " + name.str() + " has an invalid body structure (expected Stmts)");
+          return;
      }
 
     // Check body with inLoop = false. Must definitely return (ok(true)).
-    bool definitelyReturns = body->check(localGamma, delta, rettype, false);
+    bool definitelyReturns;
+    if (flat) {
+        // Reused by every function this thread checks
+        thread_local FlatBody lowered;
+        lowerBody(body, lowered);
+        definitelyReturns = checkFlat(lowered, localGamma, delta, rettype);
+    } else {
+        definitelyReturns = body->check(localGamma, delta, rettype, false);
+    }
 
     if (!definitelyReturns) {
-        throw TypeError("function " + name + " may not execute a return");
+        fail("function " + name.str() + " may not execute a return");
     }
 }
 
+// Threads claim indices from a shared counter, so a few large tasks cannot
+// leave the other threads idle, and no index past a known failure is
+// started. Every lower index has already been claimed by then, so the
+// sequentially-first failure is always found.
+void forEachInOrder(size_t count, unsigned jobs, const std::function<void(size_t)>& task) {
+    if (jobs <= 1 || count <= 1) {
+        for (size_t i = 0; i < count; ++i) task(i);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> firstFailure{count};
+    std::mutex failureMutex;
+    std::exception_ptr failure;
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            if (i > firstFailure.load()) break;
+            try {
+                task(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failureMutex);
+                if (i < firstFailure.load()) {
+                    firstFailure = i;
+                    failure = std::current_exception();
+                }
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < std::min<size_t>(jobs, count); ++t) threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads) t.join();
+    if (failure) std::rethrow_exception(failure);
+}
+
+namespace {
+// Stores the seconds from construction to destruction in *into (when not
+// null), so a phase that throws is still timed
+class StatsTimer {
+public:
+    explicit StatsTimer(double* into) : into(into), start(into ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point()) {}
+    ~StatsTimer() {
+        if (into) *into = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    StatsTimer(const StatsTimer&) = delete;
+    StatsTimer& operator=(const StatsTimer&) = delete;
+
+private:
+    double* into;
+    std::chrono::steady_clock::time_point start;
+};
+} // namespace
+
 // Γ = construct-gamma(externs,funcs) ∆ = construct-delta(structs) ∃f ∈funcs.[f.name = main ∧f.prms= ⟨⟩∧f.rettyp= int] ∀s∈structs.[Γ,∆ ⊢s: ok] 
 // ∀f ∈funcs.[Γ,∆ ⊢f : ok]
 // ⊢Program(structs,externs,funcs) : ok
-void Program::check() const {
+void Program::check(unsigned jobs, CheckCache* cache, CheckStats* stats, Diagnostics* diagnostics, bool flat) {
+    CFLAT_PROFILE_SCOPE("Program::check");
+    {
+        StatsTimer timer(stats ? &stats->topLevelSeconds : nullptr);
+        CollectingScope scope(diagnostics);
+        try {
+            checkTopLevel();
+        } catch (const DiagnosticsFull&) {
+            return;
+        }
+    }
+    Gamma initial_gamma;
+    Delta initial_delta;
+    {
+        StatsTimer timer(stats ? &stats->environmentSeconds : nullptr);
+        initial_gamma = construct_gamma(types, externs, functions);
+        initial_delta = construct_delta(types, structs);
+    }
+    StatsTimer timer(stats ? &stats->definitionsSeconds : nullptr);
+    checkDefinitions(initial_gamma, initial_delta, jobs, cache, stats, diagnostics, flat);
+}
+
+// Top-level premises: unique names and a well-typed main
+void Program::checkTopLevel() {
+    CFLAT_PROFILE_SCOPE("Program::checkTopLevel");
     // Check for duplicate names among structs, externs, functions first
-    std::set<std::string> topLevelNames;
+    Symbol mainName = types.symbols.intern("main");
+    SymbolMap<bool> topLevelNames;
+    topLevelNames.reserve(structs.size() + externs.size() + functions.size());
     for (const auto& s : structs) {
-        if (!topLevelNames.insert(s->name).second) throw TypeError("Duplicate name: " + s->name);
+        if (!topLevelNames.insert(s->name, true)) fail("Duplicate name: " + s->name.str());
     }
      for (const auto& e : externs) {
-        if (!topLevelNames.insert(e.name).second) throw TypeError("Duplicate name: " + e.name);
+        if (!topLevelNames.insert(e.name, true)) fail("Duplicate name: " + e.name.str());
     }
      for (const auto& f : functions) {
          // Allow 'main' to exist even if not in the set yet, checked later
-        if (f->name != "main" && !topLevelNames.insert(f->name).second) throw TypeError("Duplicate name: " + f->name);
+        if (f->name != mainName && !topLevelNames.insert(f->name, true)) fail("Duplicate name: " + f->name.str());
     }
     // Check main again just in case it conflicts with a struct/extern
-     if(topLevelNames.count("main") && std::find_if(functions.begin(), functions.end(), [](const auto& f){ return f->name == "main"; }) != functions.end()){
+     if(topLevelNames.contains(mainName) && std::find_if(functions.begin(), functions.end(), [&](const auto& f){ return f->name == mainName; }) != functions.end()){
          // This case is tricky - technically allowed by the set check if main wasn't inserted yet.
          // construct_gamma will likely catch it too. Add a specific check?
-         throw TypeError("Duplicate name: main");
+         fail("Duplicate name: main");
      }
 
-    Gamma initial_gamma = construct_gamma(externs, functions);
-    Delta initial_delta = construct_delta(structs);
-
     bool mainFound = false;
     for (const auto& func : functions) {
-        if (func->name == "main") {
+        if (func->name == mainName) {
             // Check signature: fn((), int)
-            if (func->params.empty() && typeEq(func->rettype, std::make_shared<IntType>())) {
-                mainFound = true;
-            } else {
-                 throw TypeError("function 'main' exists but has wrong type, should be '() -> int'");
+            if (!func->params.empty() || !typeEq(func->rettype, TypeContext::intType())) {
+                 fail("function 'main' exists but has wrong type, should be '() -> int'");
             }
+            // A main of the wrong type is reported once, not also as missing
+            mainFound = true;
         }
     }
 
     if (!mainFound) {
-        throw TypeError("no 'main' function with type '() -> int' exists");
-    }
-
-    // Check structs (Rule STRUCT applied via StructDef::check)
-    for (const auto& s : structs) {
-        s->check(initial_gamma, initial_delta);
+        fail("no 'main' function with type '() -> int' exists");
     }
+}
 
-     // Check functions (Rule FUNCTION applied via FunctionDef::check)
-    for (const auto& f : functions) {
-        f->check(initial_gamma, initial_delta);
+// ∀s∈structs.[Γ,∆ ⊢s: ok] ∀f ∈funcs.[Γ,∆ ⊢f : ok]
+void Program::checkDefinitions(const Gamma& initial_gamma, const Delta& initial_delta, unsigned jobs,
+                               CheckCache* cache, CheckStats* stats, Diagnostics* diagnostics, bool flat) const {
+    CFLAT_PROFILE_SCOPE("Program::checkDefinitions");
+    // Check structs (Rule STRUCT applied via StructDef::check), then
+    // functions (Rule FUNCTION applied via FunctionDef::check). Both only
+    // read the global environments, so they can run in parallel.
+    if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+    // The cache keys name the structs a function reaches; checkTopLevel made the names unique
+    SymbolMap<const StructDef*> structsByName;
+    if (cache) {
+        structsByName.reserve(structs.size());
+        for (const StructDef* s : structs) structsByName[s->name] = s;
+    }
+    // Every thread writes only the slots of the functions it checks
+    if (stats) stats->functionSeconds.assign(functions.size(), -1.0);
+    // Collected errors are kept per struct and function, and appended to
+    // diagnostics in order at the end. A definition is not started once as
+    // many as the limit are found: with indices claimed in order, those all
+    // belong to definitions before it.
+    std::vector<std::vector<TypeError>> found(diagnostics ? structs.size() + functions.size() : 0);
+    std::atomic<size_t> foundCount{0};
+    // Runs one definition's check, collecting into its slot of `found`
+    // if diagnostics were asked for; returns whether it passed
+    auto checkOne = [&](size_t i, auto&& check) -> bool {
+        if (!diagnostics) {
+            check();
+            return true;
+        }
+        Diagnostics local(diagnostics->limit - diagnostics->errors.size());
+        {
+            CollectingScope scope(&local);
+            try {
+                check();
+            } catch (const DiagnosticsFull&) {
+            }
+        }
+        foundCount += local.errors.size();
+        found[i] = std::move(local.errors);
+        return found[i].empty();
+    };
+    forEachInOrder(structs.size() + functions.size(), jobs, [&](size_t i) {
+        if (diagnostics && foundCount.load() + diagnostics->errors.size() >= diagnostics->limit) return;
+        if (i < structs.size()) {
+            checkOne(i, [&]() { structs[i]->check(initial_gamma, initial_delta); });
+            return;
+        }
+        const FunctionDef* f = functions[i - structs.size()];
+        uint64_t key = 0;
+        if (cache) {
+            key = checkKey(*f, initial_gamma, structsByName);
+            if (cache->contains(key)) return;
+        }
+        bool passed;
+        {
+            StatsTimer timer(stats ? &stats->functionSeconds[i - structs.size()] : nullptr);
+            passed = checkOne(i, [&]() { f->check(initial_gamma, initial_delta, flat); });
+        }
+        if (cache && passed) cache->insert(key);
+    });
+    for (const auto& errors : found) {
+        for (const TypeError& error : errors) {
+            if (diagnostics->report(error)) return;
+        }
     }
 }
 
 // JSON to AST Conversion Implementations
 
-// Parses type representations from JSON
-std::shared_ptr<Type> buildType(const nlohmann::json& j) {
+// Parses type representations from JSON, interning them into 'types'
+const Type* buildType(const nlohmann::json& j, TypeContext& types) {
+    CFLAT_PROFILE_SCOPE("buildType");
     if (j.is_string()) {
         const std::string& kind = j.get<std::string>();
-        if (kind == "Int") return std::make_shared<IntType>();
-        if (kind == "Nil") return std::make_shared<NilType>();
+        if (kind == "Int") return TypeContext::intType();
+        if (kind == "Nil") return TypeContext::nilType();
         // Add other simple string types if Cflat has them (e.g., "Bool"?)
         throw std::runtime_error("Unknown simple type string: " + kind);
     }
@@ -1383,30 +1566,30 @@ std::shared_ptr<Type> buildType(const nlohmann::json& j) {
     if (j.is_object()) {
         // Use .value("key", default) for potentially missing keys if needed later
         if (j.contains("Struct")) { // Assuming {"Struct": "name"}
-             return std::make_shared<StructType>(j.at("Struct").get<std::string>());
+             return types.structType(types.symbols.intern(j.at("Struct").get<std::string>()));
         }
          if (j.contains("Ptr")) { // Assuming {"Ptr": Type}
-             return std::make_shared<PtrType>(buildType(j.at("Ptr")));
+             return types.ptrTo(buildType(j.at("Ptr"), types));
         }
          if (j.contains("Array")) { // Assuming {"Array": Type}
-             return std::make_shared<ArrayType>(buildType(j.at("Array")));
+             return types.arrayOf(buildType(j.at("Array"), types));
         }
          if (j.contains("Fn")) { // Assuming {"Fn": [ [ParamTypes], ReturnType ]}
             const auto& fn_sig = j.at("Fn");
             if (!fn_sig.is_array() || fn_sig.size() != 2 || !fn_sig[0].is_array()) {
                  throw std::runtime_error("Invalid JSON for Fn type signature");
             }
-            std::vector<std::shared_ptr<Type>> params;
+            std::vector<const Type*> params;
             for (const auto& p : fn_sig[0]) {
-                params.push_back(buildType(p));
+                params.push_back(buildType(p, types));
             }
-            return std::make_shared<FnType>(std::move(params), buildType(fn_sig[1]));
+            return types.fnType(params, buildType(fn_sig[1], types));
         }
          // Handle object representation for simple types if they exist, e.g. {"kind":"Int"}
          if(j.contains("kind")) {
              const std::string& kind = j.at("kind").get<std::string>();
-             if (kind == "Int") return std::make_shared<IntType>();
-             if (kind == "Nil") return std::make_shared<NilType>();
+             if (kind == "Int") return TypeContext::intType();
+             if (kind == "Nil") return TypeContext::nilType();
              // Add others if necessary
          }
     }
@@ -1415,45 +1598,50 @@ std::shared_ptr<Type> buildType(const nlohmann::json& j) {
 }
 
 // Parses Place representations (Id, Deref, ArrayAccess, FieldAccess) from JSON.
-std::unique_ptr<Place> buildPlace(const nlohmann::json& j) {
+Place* buildPlace(const nlohmann::json& j, Program& prog) {
     if (!j.is_object() || j.empty()) {
         throw std::runtime_error("Invalid JSON for Place: Must be non-empty object");
     }
     // The key determines the kind
-    const auto& key = j.begin().key();
-    const auto& value = j.begin().value();
+    return buildPlace(j.begin().key(), j.begin().value(), prog);
+}
 
+// Builds a Place from the kind key and its value, reading the existing JSON
+// node by reference (buildExp uses this to avoid re-wrapping the subtree)
+Place* buildPlace(const std::string& key, const nlohmann::json& value, Program& prog) {
+    CFLAT_PROFILE_SCOPE("buildPlace");
      if (key == "Id") { // {"Id": "name"}
-         return std::make_unique<Id>(value.get<std::string>());
+         return prog.arena.make<Id>(prog.types.symbols.intern(value.get<std::string>()));
      }
      if (key == "Deref") { // {"Deref": Exp}
-         return std::make_unique<Deref>(buildExp(value));
+         return prog.arena.make<Deref>(buildExp(value, prog));
      }
      if (key == "ArrayAccess") { // {"ArrayAccess": {"array": Exp, "idx": Exp}}
          if (!value.is_object() || !value.contains("array") || !value.contains("idx")) {
               throw std::runtime_error("Invalid JSON for ArrayAccess content");
          }
-         return std::make_unique<ArrayAccess>(buildExp(value.at("array")), buildExp(value.at("idx")));
+         return prog.arena.make<ArrayAccess>(buildExp(value.at("array"), prog), buildExp(value.at("idx"), prog));
      }
      if (key == "FieldAccess") { // {"FieldAccess": {"ptr": Exp, "field": "name"}}
          if (!value.is_object() || !value.contains("ptr") || !value.contains("field")) {
               throw std::runtime_error("Invalid JSON for FieldAccess content");
          }
-         return std::make_unique<FieldAccess>(buildExp(value.at("ptr")), value.at("field").get<std::string>());
+         return prog.arena.make<FieldAccess>(buildExp(value.at("ptr"), prog), prog.types.symbols.intern(value.at("field").get<std::string>()));
      }
 
      throw std::runtime_error("JSON node is not a valid Place kind: " + key);
 }
 
 // Parses Expression representations from JSON.
-std::unique_ptr<Exp> buildExp(const nlohmann::json& j) {
+Exp* buildExp(const nlohmann::json& j, Program& prog) {
+    CFLAT_PROFILE_SCOPE("buildExp");
     if (!j.is_object() || j.empty()) {
         // Allow Nil if represented differently, check specific case
         if (j.is_string() && j.get<std::string>() == "Nil") { // Check if Nil is just a string
-            return std::make_unique<NilExp>();
+            return prog.arena.make<NilExp>();
         }
          if (j.is_object() && j.contains("kind") && j.at("kind") == "Nil") { // Check if Nil uses kind
-             return std::make_unique<NilExp>();
+             return prog.arena.make<NilExp>();
          }
         throw std::runtime_error("Invalid JSON for Exp: Must be non-empty object or known literal");
     }
@@ -1464,23 +1652,20 @@ std::unique_ptr<Exp> buildExp(const nlohmann::json& j) {
     // Places wrapped in Val
     // Check if the key indicates a Place kind
     if (key == "Id" || key == "Deref" || key == "ArrayAccess" || key == "FieldAccess") {
-        // Need to reconstruct the original object for buildPlace
-        nlohmann::json place_obj;
-        place_obj[key] = value;
-        return std::make_unique<Val>(buildPlace(place_obj));
+        return prog.arena.make<Val>(buildPlace(key, value, prog));
     }
     // Direct Expressions
     if (key == "Num") { // {"Num": number}
-        return std::make_unique<Num>(value.get<long long>());
+        return prog.arena.make<Num>(value.get<long long>());
     }
     if (key == "Nil") { // {"Nil": null} or possibly just {"kind":"Nil"} handled above
-        return std::make_unique<NilExp>();
+        return prog.arena.make<NilExp>();
     }
     if (key == "Select") { // {"Select": {"guard": Exp, "tt": Exp, "ff": Exp}}
          if (!value.is_object() || !value.contains("guard") || !value.contains("tt") || !value.contains("ff")) {
               throw std::runtime_error("Invalid JSON for Select content");
          }
-        return std::make_unique<Select>(buildExp(value.at("guard")), buildExp(value.at("tt")), buildExp(value.at("ff")));
+        return prog.arena.make<Select>(buildExp(value.at("guard"), prog), buildExp(value.at("tt"), prog), buildExp(value.at("ff"), prog));
     }
     if (key == "UnOp") { // {"UnOp": [ "Neg"|"Not", Exp ]} <-- Corrected expectation
         // Check if the value is an array of size 2
@@ -1492,33 +1677,21 @@ std::unique_ptr<Exp> buildExp(const nlohmann::json& j) {
              throw std::runtime_error("Invalid JSON for UnOp content: Operator name must be a string");
         }
 
-         UnaryOp op;
-         std::string opStr = value[0].get<std::string>(); // Get operator from array[0]
-         if(opStr == "Neg") op = UnaryOp::Neg;
-         else if(opStr == "Not") op = UnaryOp::Not;
-         else throw std::runtime_error("Unknown unary operator: " + opStr);
+         UnaryOp op = unaryOpNamed(value[0].get<std::string>()); // Get operator from array[0]
 
          // Build the expression from array[1]
-         return std::make_unique<UnOp>(op, buildExp(value[1]));
+         return prog.arena.make<UnOp>(op, buildExp(value[1], prog));
     }
     if (key == "BinOp") { // {"BinOp": {"op": "Add"|..., "left": Exp, "right": Exp}}
         if (!value.is_object() || !value.contains("op") || !value.contains("left") || !value.contains("right")) {
              throw std::runtime_error("Invalid JSON for BinOp content");
         }
-         BinaryOp op;
-         std::string opStr = value.at("op").get<std::string>();
-         // Simplified - Add all ops
-         if(opStr == "Add") op = BinaryOp::Add; else if(opStr == "Sub") op = BinaryOp::Sub;
-         else if(opStr == "Mul") op = BinaryOp::Mul; else if(opStr == "Div") op = BinaryOp::Div;
-         else if(opStr == "And") op = BinaryOp::And; else if(opStr == "Or") op = BinaryOp::Or;
-         else if(opStr == "Eq") op = BinaryOp::Eq; else if(opStr == "NotEq") op = BinaryOp::NotEq;
-         else if(opStr == "Lt") op = BinaryOp::Lt; else if(opStr == "Lte") op = BinaryOp::Lte;
-         else if(opStr == "Gt") op = BinaryOp::Gt; else if(opStr == "Gte") op = BinaryOp::Gte;
-         else throw std::runtime_error("Unknown binary operator: " + opStr);
-         return std::make_unique<BinOp>(op, buildExp(value.at("left")), buildExp(value.at("right")));
+         BinaryOp op = binaryOpNamed(value.at("op").get<std::string>());
+         return prog.arena.make<BinOp>(op, buildExp(value.at("left"), prog), buildExp(value.at("right"), prog));
     }
     if (key == "NewSingle") { // {"NewSingle": Type}
-         return std::make_unique<NewSingle>(buildType(value));
+         auto type = buildType(value, prog.types);
+         return prog.arena.make<NewSingle>(type, prog.types.ptrTo(type));
     }
      if (key == "NewArray") { // {"NewArray": [ Type, Exp ]} 
          // Check if the value is an array of size 2
@@ -1526,54 +1699,56 @@ std::unique_ptr<Exp> buildExp(const nlohmann::json& j) {
              throw std::runtime_error("Invalid JSON for NewArray content: Expected 2-element array [Type, Exp]");
          }
          // Build the type from array[0]
-         auto type = buildType(value[0]);
+         auto type = buildType(value[0], prog.types);
          // Build the size expression from array[1]
-         auto sizeExp = buildExp(value[1]);
+         auto sizeExp = buildExp(value[1], prog);
          // Create the NewArray node
-         return std::make_unique<NewArray>(std::move(type), std::move(sizeExp));
+         return prog.arena.make<NewArray>(type, sizeExp, prog.types.arrayOf(type));
     }
      if (key == "Call") { // {"CallExp": FunCall}
-         return std::make_unique<CallExp>(buildFunCall(value));
+         return prog.arena.make<CallExp>(buildFunCall(value, prog));
      }
      if (key == "Val") { // Handle explicit Val if it appears: {"Val": Place}
-         return std::make_unique<Val>(buildPlace(value));
+         return prog.arena.make<Val>(buildPlace(value, prog));
      }
 
     throw std::runtime_error("Unknown/Unhandled expression kind: " + key + " with value " + value.dump());
 }
 
 // Parses FunCall representation from JSON.
-std::unique_ptr<FunCall> buildFunCall(const nlohmann::json& j) {
+FunCall* buildFunCall(const nlohmann::json& j, Program& prog) {
+    CFLAT_PROFILE_SCOPE("buildFunCall");
     // Assuming format {"callee": Exp, "args": [Exp, ...]}
     if (!j.is_object() || !j.contains("callee") || !j.contains("args") || !j.at("args").is_array()) {
          throw std::runtime_error("Invalid JSON for FunCall");
     }
-     std::vector<std::unique_ptr<Exp>> args;
+     std::vector<Exp*> args;
      for(const auto& arg : j.at("args")) {
-         args.push_back(buildExp(arg));
+         args.push_back(buildExp(arg, prog));
      }
-    return std::make_unique<FunCall>(buildExp(j.at("callee")), std::move(args));
+    return prog.arena.make<FunCall>(buildExp(j.at("callee"), prog), prog.arena.list(args));
 }
 
 // Parses Statement representations from JSON.
-std::unique_ptr<Stmt> buildStmt(const nlohmann::json& j) {
+Stmt* buildStmt(const nlohmann::json& j, Program& prog) {
+    CFLAT_PROFILE_SCOPE("buildStmt");
     // 1. Handle Array Case: If j is an array, create a Stmts node.
     if (j.is_array()) {
-        auto stmtsNode = std::make_unique<Stmts>();
+        std::vector<Stmt*> statements;
         for (const auto& element : j) {
-            stmtsNode->statements.push_back(buildStmt(element));
+            statements.push_back(buildStmt(element, prog));
         }
-        return stmtsNode;
+        return prog.arena.make<Stmts>(prog.arena.list(statements));
     }
 
     // 2. Handle Simple String Case: Check for "Break" or "Continue".
     if (j.is_string()) {
         const std::string& kind = j.get<std::string>();
         if (kind == "Break") {
-            return std::make_unique<Break>();
+            return prog.arena.make<Break>();
         }
         if (kind == "Continue") {
-            return std::make_unique<Continue>();
+            return prog.arena.make<Continue>();
         }
         // Add other simple string statements if they exist (unlikely for Cflat)
         throw std::runtime_error("Unknown simple string statement: " + kind);
@@ -1593,101 +1768,115 @@ std::unique_ptr<Stmt> buildStmt(const nlohmann::json& j) {
         if (!value.is_array() || value.size() != 2) {
              throw std::runtime_error("Invalid JSON for Assign content: Expected [Place, Exp]");
         }
-        return std::make_unique<Assign>(buildPlace(value[0]), buildExp(value[1]));
+        return prog.arena.make<Assign>(buildPlace(value[0], prog), buildExp(value[1], prog));
     }
     if (key == "Call") { // {"Call": FunCall}
-         return std::make_unique<CallStmt>(buildFunCall(value));
+         return prog.arena.make<CallStmt>(buildFunCall(value, prog));
     }
      if (key == "If") { // {"If": {"guard": Exp, "tt": StmtArray, "ff": StmtArray|null}}
         if (!value.is_object() || !value.contains("guard") || !value.contains("tt")) {
              throw std::runtime_error("Invalid JSON for If content: Missing guard or tt");
         }
-        std::optional<std::unique_ptr<Stmt>> ff = std::nullopt;
+        std::optional<Stmt*> ff = std::nullopt;
         nlohmann::json ff_json = value.value("ff", nlohmann::json());
         // Check ff is not an empty array `[]` which might represent no else branch
         if (!ff_json.is_null() && !(ff_json.is_array() && ff_json.empty())) {
-             ff = buildStmt(ff_json);
+             ff = buildStmt(ff_json, prog);
         }
-        return std::make_unique<If>(buildExp(value.at("guard")), buildStmt(value.at("tt")), std::move(ff));
+        return prog.arena.make<If>(buildExp(value.at("guard"), prog), buildStmt(value.at("tt"), prog), ff);
     }
      if (key == "While") { // {"While": [GuardExp, BodyStmtArray]}
          if (!value.is_array() || value.size() != 2) {
              throw std::runtime_error("Invalid JSON for While content: Expected [GuardExp, BodyStmtArray]");
          }
-        return std::make_unique<While>(buildExp(value[0]), buildStmt(value[1]));
+        return prog.arena.make<While>(buildExp(value[0], prog), buildStmt(value[1], prog));
     }
     if (key == "Return") { // {"Return": Exp | null}
-         std::optional<std::unique_ptr<Exp>> exp = std::nullopt;
+         std::optional<Exp*> exp = std::nullopt;
          if (!value.is_null()) {
-             exp = buildExp(value);
+             exp = buildExp(value, prog);
          }
-        return std::make_unique<Return>(std::move(exp));
+        return prog.arena.make<Return>(exp);
     }
     // Handle explicit Stmts node
     if (key == "Stmts") { // {"Stmts": [Stmt, ...]}
          if (!value.is_array()) throw std::runtime_error("Invalid JSON for nested Stmts content");
-         auto stmtsNode = std::make_unique<Stmts>();
+         std::vector<Stmt*> statements;
          for(const auto& s : value) {
-             stmtsNode->statements.push_back(buildStmt(s));
+             statements.push_back(buildStmt(s, prog));
          }
-         return stmtsNode;
+         return prog.arena.make<Stmts>(prog.arena.list(statements));
      }
 
     throw std::runtime_error("Unknown statement kind object: " + key);
 }
 
 // Parses Decl representations (used in params, locals, fields) from JSON.
-Decl buildDecl(const nlohmann::json& j) {
+Decl buildDecl(const nlohmann::json& j, TypeContext& types) {
+    CFLAT_PROFILE_SCOPE("buildDecl");
      // Assuming {"name": "...", "typ": Type}
     if (!j.is_object() || !j.contains("name") || !j.contains("typ")) {
         throw std::runtime_error("Invalid JSON for Decl");
     }
-    return {j.at("name").get<std::string>(), buildType(j.at("typ"))};
+    return {types.symbols.intern(j.at("name").get<std::string>()), buildType(j.at("typ"), types)};
+}
+
+// Builds each Decl of a JSON array straight into its slot in the arena
+static NodeList<Decl> buildDecls(const nlohmann::json& j, Program& prog) {
+    auto next = j.begin();
+    return prog.arena.list<Decl>(j.size(), [&] { return buildDecl(*next++, prog.types); });
+}
+
+const FnType* signatureOf(TypeContext& types, const NodeList<Decl>& params, const Type* ret) {
+    // Reused, so interning a signature allocates only when it is new
+    thread_local std::vector<const Type*> paramTypes;
+    paramTypes.clear();
+    for (const Decl& p : params) paramTypes.push_back(p.type);
+    return types.fnType(paramTypes, ret);
 }
 
 // Parses FunctionDef representations from JSON.
-std::unique_ptr<FunctionDef> buildFunctionDef(const nlohmann::json& j) {
+FunctionDef* buildFunctionDef(const nlohmann::json& j, Program& prog) {
+    CFLAT_PROFILE_SCOPE("buildFunctionDef");
     if (!j.is_object() || !j.contains("name") || !j.contains("prms") || !j.contains("rettyp") || !j.contains("locals") || !j.contains("stmts")) {
          throw std::runtime_error("Invalid JSON for Function definition");
     }
-    auto func = std::make_unique<FunctionDef>();
-    func->name = j.at("name").get<std::string>();
-    func->rettype = buildType(j.at("rettyp"));
-    for (const auto& p : j.at("prms")) {
-        func->params.push_back(buildDecl(p));
-    }
-    for (const auto& l : j.at("locals")) {
-        func->locals.push_back(buildDecl(l));
-    }
+    auto func = prog.arena.make<FunctionDef>();
+    func->name = prog.types.symbols.intern(j.at("name").get<std::string>());
+    func->rettype = buildType(j.at("rettyp"), prog.types);
+    func->params = buildDecls(j.at("prms"), prog);
+    func->locals = buildDecls(j.at("locals"), prog);
+    func->signature = signatureOf(prog.types, func->params, func->rettype);
     // IMPORTANT: Wrap the array of statements from JSON into a single Stmts node for the body
-    auto bodyStmts = std::make_unique<Stmts>();
     if (!j.at("stmts").is_array()){
          throw std::runtime_error("Invalid JSON: function 'stmts' must be an array");
     }
+    std::vector<Stmt*> statements;
+    statements.reserve(j.at("stmts").size());
     for(const auto& s : j.at("stmts")) {
-        bodyStmts->statements.push_back(buildStmt(s));
+        statements.push_back(buildStmt(s, prog));
     }
-    func->body = std::move(bodyStmts);
+    func->body = prog.arena.make<Stmts>(prog.arena.list(statements));
 
     return func;
 }
 
 // Parses StructDef representations from JSON.
-std::unique_ptr<StructDef> buildStructDef(const nlohmann::json& j) {
+StructDef* buildStructDef(const nlohmann::json& j, Program& prog) {
+    CFLAT_PROFILE_SCOPE("buildStructDef");
     // Assuming {"name": "...", "fields": [Decl, ...]}
     if (!j.is_object() || !j.contains("name") || !j.contains("fields") || !j.at("fields").is_array()) {
          throw std::runtime_error("Invalid JSON for Struct definition");
     }
-     auto s = std::make_unique<StructDef>();
-     s->name = j.at("name").get<std::string>();
-     for (const auto& f : j.at("fields")) {
-         s->fields.push_back(buildDecl(f));
-     }
+     auto s = prog.arena.make<StructDef>();
+     s->name = prog.types.symbols.intern(j.at("name").get<std::string>());
+     s->fields = buildDecls(j.at("fields"), prog);
      return s;
 }
 
 // Parses Extern representations from JSON.
-Extern buildExtern(const nlohmann::json& j) {
+Extern buildExtern(const nlohmann::json& j, TypeContext& types) {
+    CFLAT_PROFILE_SCOPE("buildExtern");
     // Correct JSON format is {"name": "...", "typ": TypeObject}
     // Check for keys "name" and "typ"
      if (!j.is_object() || !j.contains("name") || !j.contains("typ")) {
@@ -1695,16 +1884,15 @@ Extern buildExtern(const nlohmann::json& j) {
     }
     
     Extern e;
-    e.name = j.at("name").get<std::string>();
+    e.name = types.symbols.intern(j.at("name").get<std::string>());
     
     // Build the type from the "typ" field
-    auto built_type = buildType(j.at("typ"));
+    auto built_type = buildType(j.at("typ"), types);
     
     // Verify the type is a function type (FnType)
-    if (auto fn_type = std::dynamic_pointer_cast<FnType>(built_type)) {
-        // It's a function type, extract its components
-        e.rettype = fn_type->returnType;
-        e.param_types = fn_type->paramTypes;
+    if (auto fn_type = dyn_cast<FnType>(built_type)) {
+        // It's a function type, already interned, so it is kept as is
+        e.type = fn_type;
     } else {
         // The type specified for the extern is not a function type
         throw std::runtime_error("Invalid JSON for Extern definition: 'typ' field is not a function type (Fn)");
@@ -1713,58 +1901,139 @@ Extern buildExtern(const nlohmann::json& j) {
     return e;
 }
 
+void throwNestingTooDeep(size_t maxDepth) {
+    throw std::runtime_error("AST nesting depth exceeds the limit of " + std::to_string(maxDepth) + " (see --max-depth)");
+}
+
+namespace {
+
+// nlohmann's own DOM builder, counting open objects/arrays as it goes
+class DepthLimitedDomParser : public nlohmann::detail::json_sax_dom_parser<nlohmann::json> {
+public:
+    DepthLimitedDomParser(nlohmann::json& result, size_t maxDepth) : json_sax_dom_parser(result), maxDepth(maxDepth) {}
+
+    bool start_object(std::size_t len) { return ++depth <= maxDepth && json_sax_dom_parser::start_object(len); }
+    bool start_array(std::size_t len) { return ++depth <= maxDepth && json_sax_dom_parser::start_array(len); }
+    bool end_object() { --depth; return json_sax_dom_parser::end_object(); }
+    bool end_array() { --depth; return json_sax_dom_parser::end_array(); }
+
+    bool tooDeep() const { return depth > maxDepth; }
+
+private:
+    size_t maxDepth;
+    size_t depth = 0;
+};
+
+} // namespace
+
+bool parseJsonWithinDepth(std::istream& in, nlohmann::json& j, size_t maxDepth) {
+    CFLAT_PROFILE_SCOPE("parseJsonWithinDepth");
+    DepthLimitedDomParser sax(j, maxDepth);
+    // Not strict, like operator>>: whatever follows the top-level value is left unread
+    nlohmann::json::sax_parse(in, &sax, nlohmann::json::input_format_t::json, false);
+    return !sax.tooDeep();
+}
+
+// Read by the fast reader (json_reader.hpp) unless it gives up on the text
+bool parseJsonWithinDepth(const char* first, const char* last, nlohmann::json& j, size_t maxDepth) {
+    CFLAT_PROFILE_SCOPE("parseJsonWithinDepth");
+    {
+        DepthLimitedDomParser sax(j, maxDepth);
+        fastjson::Result read = fastjson::Reader<DepthLimitedDomParser>(first, last, sax).parse(false);
+        if (read != fastjson::Result::GaveUp) return !sax.tooDeep();
+    }
+    j = nlohmann::json();
+    DepthLimitedDomParser sax(j, maxDepth);
+    nlohmann::json::sax_parse(first, last, &sax, nlohmann::json::input_format_t::json, false);
+    return !sax.tooDeep();
+}
+
 // Parses the top-level Program object from JSON.
 std::unique_ptr<Program> buildProgram(const nlohmann::json& j) {
+    CFLAT_PROFILE_SCOPE("buildProgram");
     // Assuming {"structs": [...], "externs": [...], "functions": [...]}
     if (!j.is_object() || !j.contains("structs") || !j.contains("externs") || !j.contains("functions")) {
          throw std::runtime_error("Invalid JSON for Program root object");
     }
     auto prog = std::make_unique<Program>();
+    prog->structs.reserve(j.at("structs").size());
+    prog->externs.reserve(j.at("externs").size());
+    prog->functions.reserve(j.at("functions").size());
     for (const auto& s : j.at("structs")) {
-        prog->structs.push_back(buildStructDef(s));
+        prog->structs.push_back(buildStructDef(s, *prog));
     }
     for (const auto& e : j.at("externs")) {
-        prog->externs.push_back(buildExtern(e));
+        prog->externs.push_back(buildExtern(e, prog->types));
     }
     for (const auto& f : j.at("functions")) {
-        prog->functions.push_back(buildFunctionDef(f));
+        prog->functions.push_back(buildFunctionDef(f, *prog));
     }
     return prog;
 }
 
 // --- Environment Construction Implementations ---
 
-Gamma construct_gamma(const std::vector<Extern>& externs, const std::vector<std::unique_ptr<FunctionDef>>& functions) {
+Gamma construct_gamma(TypeContext& types, const std::vector<Extern>& externs, const std::vector<FunctionDef*>& functions) {
+    CFLAT_PROFILE_SCOPE("construct_gamma");
     Gamma gamma;
+    gamma.reserve(externs.size() + functions.size());
     // Add externs (type fn)
     for (const auto& ext : externs) {
         // Basic duplicate check (assuming no name conflicts guaranteed by parser as per spec)
-        gamma[ext.name] = std::make_shared<FnType>(ext.param_types, ext.rettype);
+        gamma[ext.name] = ext.type;
     }
     // Add internal functions (type ptr(fn)) - except main
     for (const auto& func : functions) {
-        if (func->name != "main") {
-            std::vector<std::shared_ptr<Type>> paramTypes;
-            for(const auto& p : func->params) {
-                paramTypes.push_back(p.type);
-            }
-            auto fnType = std::make_shared<FnType>(std::move(paramTypes), func->rettype);
-            gamma[func->name] = std::make_shared<PtrType>(fnType);
+        if (func->name.str() != "main") {
+            gamma[func->name] = types.ptrTo(func->signature);
         }
     }
     return gamma;
 }
 
-Delta construct_delta(const std::vector<std::unique_ptr<StructDef>>& structs) {
+Delta construct_delta(TypeContext& types, const std::vector<StructDef*>& structs) {
+    CFLAT_PROFILE_SCOPE("construct_delta");
     Delta delta;
+    size_t fieldCount = 0;
+    for (const auto& s : structs) fieldCount += s->fields.size();
+    delta.reserve(structs.size(), fieldCount);
     for (const auto& s : structs) {
-         // Basic duplicate check (assuming no name conflicts guaranteed by parser as per spec)
-        std::unordered_map<std::string, std::shared_ptr<Type>> fields;
-        for (const auto& f : s->fields) {
-            // Basic duplicate check (assuming no name conflicts guaranteed by parser as per spec)
-            fields[f.name] = f.type;
-        }
-        delta[s->name] = std::move(fields);
+        delta.add(cast<StructType>(types.structType(s->name)), *s);
     }
     return delta;
+}
+
+void StructTable::reserve(size_t structs, size_t fieldCount) {
+    layouts.reserve(structs);
+    fields.reserve(fieldCount);
+    slots.reserve(2 * fieldCount + structs);
+}
+
+void StructTable::add(const StructType* type, const StructDef& s) {
+    Layout layout{type, uint32_t(fields.size()), 0, uint32_t(slots.size()), 0};
+    uint32_t capacity = 1;
+    while (capacity < 2 * s.fields.size()) capacity *= 2;
+    layout.mask = capacity - 1;
+    slots.resize(slots.size() + capacity, 0);
+    for (const auto& f : s.fields) {
+        uint32_t i = (f.name.id * 2654435761u) & layout.mask;
+        while (slots[layout.slot + i] != 0 && fields[layout.first + slots[layout.slot + i] - 1].name != f.name) {
+            i = (i + 1) & layout.mask;
+        }
+        uint32_t& entry = slots[layout.slot + i];
+        if (entry != 0) {
+            // A repeated name: its last declaration is the one looked up
+            fields[layout.first + entry - 1].type = f.type;
+            continue;
+        }
+        fields.push_back({f.name, f.type, layout.count});
+        entry = ++layout.count;
+    }
+    if (type->id >= byType.size()) byType.resize(type->id + 1, 0);
+    if (byType[type->id] != 0) {
+        layouts[byType[type->id] - 1] = layout;
+    } else {
+        layouts.push_back(layout);
+        byType[type->id] = uint32_t(layouts.size());
+    }
 }
\ No newline at end of file
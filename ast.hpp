@@ -1,18 +1,30 @@
 #ifndef AST_HPP
 #define AST_HPP
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <new>
 #include <set>
+#include <tuple>
 #include <optional>
 #include <stdexcept>
 #include <unordered_map>
+#include <type_traits>
+#include <functional>
+#include <cassert>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
 #include "json.hpp"
+#include "profile.hpp"
 
 // Forward declarations
 struct Type;
+struct Node;
 struct Stmt;
 struct Exp;
 struct Place;
@@ -22,15 +34,157 @@ struct Program;
 struct StructDef;
 struct FunctionDef;
 struct Extern;
+class CheckCache;
+
+// Kind-tag RTTI
+// Every Type and Node records its concrete class in a `kind` tag set by the
+// constructor, and each class answers `classof(kind)`. These helpers replace
+// dynamic_cast so type comparison and error rendering never touch RTTI.
+template <typename To, typename From>
+inline bool isa(const From* p) {
+    return p && To::classof(p->kind);
+}
+
+// Checked downcast: p must be non-null and of kind To
+template <typename To, typename From>
+inline const To* cast(const From* p) {
+    assert(isa<To>(p));
+    return static_cast<const To*>(p);
+}
+
+// Downcast that yields nullptr when p is null or not of kind To
+template <typename To, typename From>
+inline const To* dyn_cast(const From* p) {
+    return isa<To>(p) ? static_cast<const To*>(p) : nullptr;
+}
+
+// Symbols
+// Identifiers, struct names and field names are interned per program. A
+// Symbol is a dense id, which is all that lookups hash or compare, plus the
+// interned spelling for AST dumps and error messages.
+struct Symbol {
+    uint32_t id = 0;
+    const std::string* text = nullptr;
+
+    const std::string& str() const { return *text; }
+    bool operator==(const Symbol& o) const { return id == o.id; }
+    bool operator!=(const Symbol& o) const { return id != o.id; }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Symbol& sym) {
+    return os << sym.str();
+}
+
+class SymbolTable {
+public:
+    SymbolTable() = default;
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    Symbol intern(const std::string& name);
+    size_t size() const { return names.size(); }
+
+private:
+    // unordered_map nodes never move, so names can point at the keys
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<const std::string*> names;
+};
+
+// Open-addressed table keyed by Symbol id: linear probing over a
+// power-of-two array, so a lookup is a multiply, a mask and a short scan.
+template <typename V>
+class SymbolMap {
+public:
+    void reserve(size_t n) {
+        if (2 * n > slots.size()) rehash(n);
+    }
+
+    const V* find(Symbol key) const {
+        if (slots.empty()) return nullptr;
+        for (size_t i = home(key); ; i = (i + 1) & (slots.size() - 1)) {
+            if (slots[i].key == key.id + 1) return &slots[i].value;
+            if (slots[i].key == 0) return nullptr;
+        }
+    }
+    bool contains(Symbol key) const { return find(key) != nullptr; }
+
+    // Inserts key -> value unless key is already present; returns whether it inserted
+    bool insert(Symbol key, V value) {
+        size_t before = count;
+        V& slot = (*this)[key];
+        if (count == before) return false;
+        slot = std::move(value);
+        return true;
+    }
+
+    V& operator[](Symbol key) {
+        if (2 * (count + 1) > slots.size()) rehash(count + 1);
+        size_t i = home(key);
+        while (slots[i].key != 0 && slots[i].key != key.id + 1) i = (i + 1) & (slots.size() - 1);
+        if (slots[i].key == 0) {
+            slots[i].key = key.id + 1;
+            ++count;
+        }
+        return slots[i].value;
+    }
+
+    size_t size() const { return count; }
+
+private:
+    struct Slot {
+        uint32_t key = 0; // id + 1, so 0 marks an empty slot
+        V value{};
+    };
+
+    size_t home(Symbol key) const {
+        return (key.id * 2654435761u) & (slots.size() - 1);
+    }
+
+    // Grow to a power of two holding n entries at most half full
+    void rehash(size_t n) {
+        size_t capacity = 8;
+        while (capacity < 2 * n) capacity *= 2;
+        std::vector<Slot> old = std::move(slots);
+        slots.assign(capacity, Slot{});
+        for (auto& slot : old) {
+            if (slot.key == 0) continue;
+            size_t i = (size_t(slot.key - 1) * 2654435761u) & (capacity - 1);
+            while (slots[i].key != 0) i = (i + 1) & (capacity - 1);
+            slots[i] = std::move(slot);
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+};
 
 // Type Representation
 // Defines the structure of types in Cflat (int, struct, ptr, etc.)
 
+// Error is only ever given to expressions whose check failed while
+// collecting errors (see Diagnostics); no program declares it
+enum class TypeKind { Int, Nil, Struct, Array, Ptr, Fn, Error };
+
 // Type equality function eq(τ₁, τ₂) handling nil - Forward Declaration
-bool typeEq(const std::shared_ptr<Type>& t1, const std::shared_ptr<Type>& t2);
+bool typeEq(const Type* t1, const Type* t2);
+
+// Counters on the checker's hot paths, reported by --stats. They exist only
+// in builds with -DCFLAT_STATS (the debug build); elsewhere CFLAT_COUNT
+// expands to nothing, so the release build does not pay for them.
+#ifdef CFLAT_STATS
+struct HotCounters {
+    std::atomic<uint64_t> typeEqCalls{0};
+};
+extern HotCounters hotCounters;
+#define CFLAT_COUNT(counter) hotCounters.counter.fetch_add(1, std::memory_order_relaxed)
+#else
+#define CFLAT_COUNT(counter) ((void)0)
+#endif
 
 // Base class for all Cflat types
 struct Type {
+    const TypeKind kind;
+    explicit Type(TypeKind k) : kind(k) {}
     virtual ~Type() = default;
     virtual std::string toString() const = 0;
     // Overload == for easier type comparison, especially with NilType
@@ -41,9 +195,9 @@ struct Type {
     }
 };
 
-// Custom comparison for shared_ptr<Type>
+// Custom structural comparison for Type pointers
 struct TypePtrEqual {
-    bool operator()(const std::shared_ptr<Type>& lhs, const std::shared_ptr<Type>& rhs) const {
+    bool operator()(const Type* lhs, const Type* rhs) const {
         if (!lhs && !rhs) return true;
         if (!lhs || !rhs) return false;
         return lhs->equals(*rhs);
@@ -51,13 +205,17 @@ struct TypePtrEqual {
 };
 
 struct IntType : Type {
+    IntType() : Type(TypeKind::Int) {}
+    static bool classof(TypeKind k) { return k == TypeKind::Int; }
     std::string toString() const override { return "int"; }
     bool equals(const Type& other) const override {
-        return dynamic_cast<const IntType*>(&other) != nullptr;
+        return other.kind == TypeKind::Int;
     }
 };
 
 struct NilType : Type {
+    NilType() : Type(TypeKind::Nil) {}
+    static bool classof(TypeKind k) { return k == TypeKind::Nil; }
     std::string toString() const override { return "nil"; }
     bool equals(const Type& other) const override;
     // bool equals(const Type& other) const override {
@@ -69,9 +227,12 @@ struct NilType : Type {
 };
 
 struct StructType : Type {
-    std::string name;
-    StructType(std::string n) : name(std::move(n)) {}
-    std::string toString() const override { return name ; }
+    Symbol name;
+    // Dense per TypeContext, in the order the struct types were interned
+    uint32_t id;
+    StructType(Symbol n, uint32_t id) : Type(TypeKind::Struct), name(n), id(id) {}
+    static bool classof(TypeKind k) { return k == TypeKind::Struct; }
+    std::string toString() const override { return name.str(); }
     bool equals(const Type& other) const override;
     // bool equals(const Type& other) const override {
     //     // nil is not eq to struct types
@@ -86,8 +247,9 @@ struct StructType : Type {
 };
 
 struct ArrayType : Type {
-    std::shared_ptr<Type> elementType;
-    ArrayType(std::shared_ptr<Type> et) : elementType(std::move(et)) {}
+    const Type* elementType;
+    ArrayType(const Type* et) : Type(TypeKind::Array), elementType(et) {}
+    static bool classof(TypeKind k) { return k == TypeKind::Array; }
     std::string toString() const override { 
         if (elementType) {
         // Wrap the element type string in brackets
@@ -109,8 +271,9 @@ struct ArrayType : Type {
 };
 
 struct PtrType : Type {
-    std::shared_ptr<Type> pointeeType;
-    PtrType(std::shared_ptr<Type> pt) : pointeeType(std::move(pt)) {}
+    const Type* pointeeType;
+    PtrType(const Type* pt) : Type(TypeKind::Ptr), pointeeType(pt) {}
+    static bool classof(TypeKind k) { return k == TypeKind::Ptr; }
     std::string toString() const override { 
         if (pointeeType) {
             return "&" + pointeeType->toString();
@@ -131,10 +294,11 @@ struct PtrType : Type {
 };
 
 struct FnType : Type {
-    std::vector<std::shared_ptr<Type>> paramTypes;
-    std::shared_ptr<Type> returnType;
-    FnType(std::vector<std::shared_ptr<Type>> pt, std::shared_ptr<Type> rt)
-        : paramTypes(std::move(pt)), returnType(std::move(rt)) {}
+    std::vector<const Type*> paramTypes;
+    const Type* returnType;
+    FnType(std::vector<const Type*> pt, const Type* rt)
+        : Type(TypeKind::Fn), paramTypes(std::move(pt)), returnType(rt) {}
+    static bool classof(TypeKind k) { return k == TypeKind::Fn; }
     std::string toString() const override;
     bool equals(const Type& other) const override;
     // bool equals(const Type& other) const override {
@@ -159,38 +323,348 @@ struct FnType : Type {
     // }
 };
 
+// The type of an expression or place whose check failed. Every rule
+// accepts it without complaint and passes it on, so the one mistake is not
+// reported again by each rule above it.
+struct ErrorType : Type {
+    ErrorType() : Type(TypeKind::Error) {}
+    static bool classof(TypeKind k) { return k == TypeKind::Error; }
+    std::string toString() const override { return "<error>"; }
+    bool equals(const Type& other) const override { return other.kind == TypeKind::Error; }
+};
+
+// Type Universe
+// Every Type is interned: int and nil are process-wide singletons, and
+// struct/ptr/array/fn types are hash-consed per program by their structure.
+// Two interned types are structurally equal iff they are the same pointer.
+// The context owns them, so plain const Type* is used everywhere. It also
+// interns the program's names, since struct types are keyed by them.
+class TypeContext {
+public:
+    TypeContext() = default;
+    TypeContext(const TypeContext&) = delete;
+    TypeContext& operator=(const TypeContext&) = delete;
+
+    SymbolTable symbols;
+
+    static const Type* intType();
+    static const Type* nilType();
+    static const Type* errorType();
+    const Type* structType(Symbol name);
+    const Type* ptrTo(const Type* pointee);
+    const Type* arrayOf(const Type* element);
+    // Looking up a signature that already exists allocates nothing
+    const FnType* fnType(const Type* const* params, size_t count, const Type* ret);
+    const FnType* fnType(const std::vector<const Type*>& params, const Type* ret) {
+        return fnType(params.data(), params.size(), ret);
+    }
+    // Types allocated so far; int, nil and the error type are shared and never counted
+    size_t allocated() const { return owned.size(); }
+
+private:
+    // Views the parameters of the FnType it maps to, or the caller's
+    // array while looking one up
+    struct FnKey {
+        const Type* const* params;
+        size_t count;
+        const Type* ret;
+        bool operator==(const FnKey& o) const {
+            return ret == o.ret && count == o.count && std::equal(params, params + count, o.params);
+        }
+    };
+    struct FnKeyHash {
+        size_t operator()(const FnKey& k) const;
+    };
+
+    std::vector<std::unique_ptr<Type>> owned;
+    SymbolMap<const Type*> structs;
+    std::unordered_map<const Type*, const Type*> ptrs;
+    std::unordered_map<const Type*, const Type*> arrays;
+    std::unordered_map<FnKey, const FnType*, FnKeyHash> fns;
+};
+
 // Type equality function eq(τ₁, τ₂) implementation
 // compares types s.t. two types are eq iff they are the same
 // type or if one is a pointer or array type and the other is nil.
-bool typeEq(const std::shared_ptr<Type>& t1, const std::shared_ptr<Type>& t2);
+// Both types must come from the same TypeContext.
+bool typeEq(const Type* t1, const Type* t2);
 
 // pick_nonnil helper function
 // Type × Type → Type that takes two types and returns one of the
 // arguments that isn’t nil if possible; if both arguments are nil then it returns nil.
-std::shared_ptr<Type> pickNonNil(const std::shared_ptr<Type>& t1, const std::shared_ptr<Type>& t2);
+const Type* pickNonNil(const Type* t1, const Type* t2);
 
 // Symbol Tables (Environments)
 // Data structures to hold type information during checking
 
 // Γ: Id → Type (Variables and Function names to Types)
-using Gamma = std::unordered_map<std::string, std::shared_ptr<Type>>;
+// A frame of bindings over an optional read-only parent frame. Each function
+// body gets its own frame for params and locals on top of the shared global
+// frame, so entering a function never copies the externs and functions.
+class Gamma {
+public:
+    Gamma() = default;
+    explicit Gamma(const Gamma* parent) : parent(parent) {}
+
+    // Innermost binding of name, or nullptr if it is unbound in every frame
+    const Type* lookup(Symbol name) const {
+        for (const Gamma* frame = this; frame; frame = frame->parent) {
+            if (const Type* const* type = frame->vars.find(name)) return *type;
+        }
+        return nullptr;
+    }
+    // Binds name in this frame, shadowing any binding in the parents
+    const Type*& operator[](Symbol name) { return vars[name]; }
+    void reserve(size_t n) { vars.reserve(n); }
+
+private:
+    const Gamma* parent = nullptr;
+    SymbolMap<const Type*> vars;
+};
 
 // Δ: Id → (Id → Type) (Struct names to [Field names to Types])
-using Delta = std::unordered_map<std::string, std::unordered_map<std::string, std::shared_ptr<Type>>>;
+// A dense table indexed by StructType::id. Each defined struct has a
+// Layout: its fields in declaration order, stored contiguously for all
+// structs, and a small open-addressed index over their names, so a field
+// lookup is two array reads and a short probe, with nothing allocated.
+class StructTable {
+public:
+    struct Field {
+        Symbol name;
+        const Type* type;
+        // Position in the struct's declaration
+        uint32_t index;
+    };
+    struct Layout {
+        const StructType* type;
+        // This struct's fields are fields[first, first + count) and its
+        // name index is slots[slot, slot + mask + 1)
+        uint32_t first, count;
+        uint32_t slot, mask;
+    };
+
+    void reserve(size_t structs, size_t fields);
+    // Adds the layout of s, whose type is `type`. A struct defined twice
+    // keeps its last definition, and a field declared twice its last
+    // declaration (both are type errors reported elsewhere).
+    void add(const StructType* type, const StructDef& s);
+
+    // The layout of the struct of type `type`, or nullptr if it is not defined
+    const Layout* find(const StructType* type) const {
+        if (type->id >= byType.size() || byType[type->id] == 0) return nullptr;
+        return &layouts[byType[type->id] - 1];
+    }
+    // The field of `layout` called name, or nullptr if it has none
+    const Field* field(const Layout& layout, Symbol name) const {
+        for (uint32_t i = (name.id * 2654435761u) & layout.mask; ; i = (i + 1) & layout.mask) {
+            uint32_t entry = slots[layout.slot + i];
+            if (entry == 0) return nullptr;
+            if (fields[layout.first + entry - 1].name == name) return &fields[layout.first + entry - 1];
+        }
+    }
+    const Field* begin(const Layout& layout) const { return fields.data() + layout.first; }
+    const Field* end(const Layout& layout) const { return fields.data() + layout.first + layout.count; }
+    size_t size() const { return layouts.size(); }
+
+private:
+    // StructType::id -> index into layouts + 1, or 0 if not defined
+    std::vector<uint32_t> byType;
+    std::vector<Layout> layouts;
+    std::vector<Field> fields;
+    // Per layout, a power-of-two run of field positions + 1, 0 if empty
+    std::vector<uint32_t> slots;
+};
+
+using Delta = StructTable;
 
 // Error Handling
+// The premise a structured TypeError reports. Each kind has one message
+// template (see TypeError::render in ast.cpp); Message is a plain-text error.
+enum class TypeErrorKind : uint8_t {
+    Message,
+    // Expressions and places
+    UnknownId, NegativeNumber, DerefNonPointer, ArrayIndexNotInt, ArrayNotArray,
+    FieldBaseNotPointer, FieldPointeeNotStruct, FieldUnknownStruct, FieldUnknownField,
+    SelectGuardNotInt, SelectBranchMismatch, UnOpNotInt,
+    BinOpIncompatible, BinOpInvalidType, BinOpLeftNotInt, BinOpRightNotInt,
+    NewSingleInvalid, NewArrayAmountNotInt, NewArrayInvalidType,
+    CallMain, CallNonFunction, CallArity, CallArgMismatch,
+    // Statements
+    AssignInvalidLhs, AssignIncompatible, IfGuardNotInt, WhileGuardNotInt,
+    ReturnMismatch, ReturnMissingExp, ReturnNoExp, BreakOutsideLoop, ContinueOutsideLoop,
+};
+
 class TypeError : public std::runtime_error {
 public:
     // Store line/col info if available from JSON later
     TypeError(const std::string& message) : std::runtime_error(message) {}
+
+    // A failed premise of the rule for `node`, involving the types t0 and t1
+    // (and argument `index` for CallArgMismatch). The text is only rendered
+    // by the first what(), so the node and types must still be alive then;
+    // they belong to the Program and its TypeContext, so catch the error
+    // while the Program is in scope.
+    TypeError(TypeErrorKind kind, const Node* node, const Type* t0 = nullptr, const Type* t1 = nullptr, size_t index = 0)
+    : std::runtime_error(std::string()), kind(kind), node(node), t0(t0), t1(t1), index(index) {}
+
+    const char* what() const noexcept override;
+
+    TypeErrorKind kind = TypeErrorKind::Message;
+    const Node* node = nullptr;
+    const Type* t0 = nullptr;
+    const Type* t1 = nullptr;
+    size_t index = 0;
+
+private:
+    std::string render() const;
+    mutable std::string text;
+    mutable bool rendered = false;
 };
 
+// Collects the TypeErrors of a check instead of stopping at the first;
+// pass one to Program::check. The typing rules still only fail by calling
+// one helper, which throws as before unless a Diagnostics is collecting on
+// its thread. A failed expression gets the error type and its statement
+// carries on, so checking continues with the next statement and function.
+// Errors come in the order the single-error check meets them, so the
+// first is always the one it would throw. Once `limit` are recorded the
+// check stops.
+class Diagnostics {
+public:
+    explicit Diagnostics(size_t limit) : limit(limit) {}
+
+    // Records error and returns whether the limit is reached. A premise of
+    // a node already recorded is ignored: the checker's inline pass may
+    // redo part of an expression it abandoned (see checker.cpp).
+    bool report(const TypeError& error);
+    bool full() const { return errors.size() >= limit; }
+
+    const size_t limit;
+    std::vector<TypeError> errors;
+
+private:
+    std::set<std::tuple<const Node*, TypeErrorKind, size_t>> seen;
+};
+
+// AST Storage
+// Every node of a program is bump-allocated from a single AstArena owned by
+// the Program, and nodes refer to their children by raw pointer. Nodes are
+// trivially destructible (child lists are NodeLists in the same arena), so
+// freeing a program releases a handful of blocks instead of walking the tree,
+// however deeply it is nested.
+template <typename T> struct NodeList;
+
+class AstArena {
+public:
+    AstArena() = default;
+    AstArena(const AstArena&) = delete;
+    AstArena& operator=(const AstArena&) = delete;
+    ~AstArena();
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena nodes are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Copies items into the arena as a NodeList
+    template <typename T>
+    NodeList<T> list(const std::vector<T>& items);
+    // Builds a NodeList of count items in place, each the value of make(),
+    // with no vector in between
+    template <typename T, typename Make>
+    NodeList<T> list(size_t count, Make&& make);
+
+    size_t bytesAllocated() const { return allocated; }
+    // Takes over every block of other, so the nodes built there live as
+    // long as this arena; other is left empty
+    void adopt(AstArena& other);
+    // Frees every node built here, for an arena that holds one function's
+    // nodes at a time
+    void release();
+
+private:
+    void* allocate(size_t size, size_t align) {
+        size_t pad = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+        if (!cur || pad + size > size_t(end - cur)) {
+            grow(size + align);
+            pad = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+        }
+        void* p = cur + pad;
+        cur += pad + size;
+        return p;
+    }
+    // Starts a new block with room for at least n bytes
+    void grow(size_t n);
+
+    std::vector<char*> blocks;
+    char* cur = nullptr;
+    char* end = nullptr;
+    size_t allocated = 0;
+};
+
+// Fixed-length array of children stored in an AstArena
+template <typename T>
+struct NodeList {
+    T* items = nullptr;
+    uint32_t count = 0;
+
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return items[i]; }
+};
+
+template <typename T>
+NodeList<T> AstArena::list(const std::vector<T>& items) {
+    static_assert(std::is_trivially_destructible_v<T>, "arena nodes are never destroyed");
+    NodeList<T> out;
+    if (items.empty()) return out;
+    if (items.size() > UINT32_MAX) throw std::length_error("too many children in one AST node");
+    out.items = static_cast<T*>(allocate(sizeof(T) * items.size(), alignof(T)));
+    for (const T& item : items) new (out.items + out.count++) T(item);
+    return out;
+}
+
+template <typename T, typename Make>
+NodeList<T> AstArena::list(size_t count, Make&& make) {
+    static_assert(std::is_trivially_destructible_v<T>, "arena nodes are never destroyed");
+    NodeList<T> out;
+    if (count == 0) return out;
+    if (count > UINT32_MAX) throw std::length_error("too many children in one AST node");
+    out.items = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    for (size_t i = 0; i < count; ++i) new (out.items + i) T(make());
+    out.count = uint32_t(count);
+    return out;
+}
+
 // AST Node Representation
 
+// Concrete node classes; Place, Exp and Stmt kinds are contiguous ranges
+enum class NodeKind {
+    // Places
+    Id, Deref, ArrayAccess, FieldAccess,
+    // Expressions
+    Val, Num, Nil, Select, UnOp, BinOp, NewSingle, NewArray, Call,
+    // Statements
+    Stmts, Assign, CallStmt, If, While, Break, Continue, Return,
+    // Everything else
+    Decl, FunCall, StructDef, Extern, FunctionDef, Program
+};
+constexpr size_t kNodeKindCount = size_t(NodeKind::Program) + 1;
+// The enumerator's name, e.g. "ArrayAccess"
+const char* nodeKindName(NodeKind kind);
+
 // Base class for all AST nodes
 struct Node {
-    virtual ~Node() = default;
+    const NodeKind kind;
+    explicit Node(NodeKind k) : kind(k) {}
     virtual void print(std::ostream& os) const = 0;
+
+protected:
+    // Nodes live in an AstArena and are never deleted through a base pointer
+    ~Node() = default;
 };
 
 // Overload << operator to make printing easy
@@ -198,11 +672,12 @@ inline std::ostream& operator<<(std::ostream& os, const Node& node) {
     node.print(os);
     return os;
 }
-inline std::ostream& operator<<(std::ostream& os, const std::unique_ptr<Node>& node) {
+template <typename T, typename = std::enable_if_t<std::is_base_of_v<Node, T>>>
+inline std::ostream& operator<<(std::ostream& os, const T* node) {
     if (node) node->print(os); else os << "<null>";
     return os;
 }
-inline std::ostream& operator<<(std::ostream& os, const std::shared_ptr<Type>& type) {
+inline std::ostream& operator<<(std::ostream& os, const Type* type) {
     if (type) type->print(os); else os << "<null>";
     return os;
 }
@@ -210,10 +685,11 @@ inline std::ostream& operator<<(std::ostream& os, const std::shared_ptr<Type>& t
 
 // Declarations (parameters, locals, struct fields)
 struct Decl : public Node {
-    std::string name;
-    std::shared_ptr<Type> type;
+    Symbol name;
+    const Type* type;
 
-    Decl(std::string n, std::shared_ptr<Type> t) : name(std::move(n)), type(std::move(t)) {}
+    Decl(Symbol n, const Type* t) : Node(NodeKind::Decl), name(n), type(t) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Decl; }
     void print(std::ostream& os) const override {
         os << "Decl { name: \"" << name << "\", typ: ";
         os << type;
@@ -225,160 +701,254 @@ struct Decl : public Node {
 enum class UnaryOp { Neg, Not };
 enum class BinaryOp { Add, Sub, Mul, Div, And, Or, Eq, NotEq, Lt, Lte, Gt, Gte };
 
+// --- Operator Tables ---
+// One row per operator, in enum order, with everything the builders,
+// checkers and printers know about it: its name in .astj, how it is
+// spelled in source text, how tightly it binds, which rule its operands
+// are checked by and the type it produces.
+
+enum class OperandRule : uint8_t {
+    Int,        // UNOP and BINOP-REST: every operand int
+    Comparable  // EQ/NEQ: operands eq, neither a struct nor a function
+};
+
+struct UnaryOpInfo {
+    UnaryOp op;
+    std::string_view name;        // "Neg"
+    std::string_view text;        // before its operand: "- "
+    std::string_view compactText; // the same, in the compact form: "-"
+    OperandRule rule;
+    const Type* (*result)();
+};
+
+struct BinaryOpInfo {
+    BinaryOp op;
+    std::string_view name;        // "Add"
+    std::string_view text;        // between its operands: " + "
+    int precedence;               // higher binds tighter
+    bool comparison;              // an equal-precedence right operand is parenthesized (a <= (b > c))
+    OperandRule rule;
+    const Type* (*result)();
+};
+
+inline constexpr UnaryOpInfo kUnaryOps[] = {
+    {UnaryOp::Neg, "Neg", "- ", "-", OperandRule::Int, &TypeContext::intType},
+    {UnaryOp::Not, "Not", "not ", "not ", OperandRule::Int, &TypeContext::intType},
+};
+
+inline constexpr BinaryOpInfo kBinaryOps[] = {
+    {BinaryOp::Add, "Add", " + ", 5, false, OperandRule::Int, &TypeContext::intType},
+    {BinaryOp::Sub, "Sub", " - ", 5, false, OperandRule::Int, &TypeContext::intType},
+    {BinaryOp::Mul, "Mul", " * ", 6, false, OperandRule::Int, &TypeContext::intType},
+    {BinaryOp::Div, "Div", " / ", 6, false, OperandRule::Int, &TypeContext::intType},
+    {BinaryOp::And, "And", " and ", 2, false, OperandRule::Int, &TypeContext::intType},
+    {BinaryOp::Or, "Or", " or ", 1, false, OperandRule::Int, &TypeContext::intType},
+    {BinaryOp::Eq, "Eq", " == ", 3, false, OperandRule::Comparable, &TypeContext::intType},
+    {BinaryOp::NotEq, "NotEq", " != ", 3, false, OperandRule::Comparable, &TypeContext::intType},
+    {BinaryOp::Lt, "Lt", " < ", 4, true, OperandRule::Int, &TypeContext::intType},
+    {BinaryOp::Lte, "Lte", " <= ", 4, true, OperandRule::Int, &TypeContext::intType},
+    {BinaryOp::Gt, "Gt", " > ", 4, true, OperandRule::Int, &TypeContext::intType},
+    {BinaryOp::Gte, "Gte", " >= ", 4, true, OperandRule::Int, &TypeContext::intType},
+};
+
+template <typename Info, size_t N>
+constexpr bool inEnumOrder(const Info (&table)[N]) {
+    for (size_t i = 0; i < N; ++i) {
+        if (size_t(table[i].op) != i) return false;
+    }
+    return true;
+}
+static_assert(inEnumOrder(kUnaryOps) && std::size(kUnaryOps) == size_t(UnaryOp::Not) + 1,
+              "kUnaryOps has one row per UnaryOp, in enum order");
+static_assert(inEnumOrder(kBinaryOps) && std::size(kBinaryOps) == size_t(BinaryOp::Gte) + 1,
+              "kBinaryOps has one row per BinaryOp, in enum order");
+
+constexpr const UnaryOpInfo& opInfo(UnaryOp op) { return kUnaryOps[size_t(op)]; }
+constexpr const BinaryOpInfo& opInfo(BinaryOp op) { return kBinaryOps[size_t(op)]; }
+
+// The operator with this .astj name; throws std::runtime_error if none
+UnaryOp unaryOpNamed(std::string_view name);
+BinaryOp binaryOpNamed(std::string_view name);
+
+// Base class for expressions and places, which have a type
+struct TypedNode : public Node {
+    // Recorded by the first successful check (see checker.cpp) and reused
+    // after that; nullptr until then, and after a failed one even when
+    // Diagnostics carried on past it. Read it with Program::typeOf.
+    mutable const Type* checkedType = nullptr;
+
+    explicit TypedNode(NodeKind k) : Node(k) {}
+    static bool classof(NodeKind k) { return k >= NodeKind::Id && k <= NodeKind::Call; }
+};
+
 // Base class for expressions
-struct Exp : public Node {
-    // Check method: Returns the type of the expression or throws TypeError
-    virtual std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const = 0;
+struct Exp : public TypedNode {
+    explicit Exp(NodeKind k) : TypedNode(k) {}
+    static bool classof(NodeKind k) { return k >= NodeKind::Val && k <= NodeKind::Call; }
+    // Returns the type of the expression or throws TypeError (see checker.cpp)
+    const Type* check(const Gamma& gamma, const Delta& delta) const;
     // Helper to get string representation for error messages
-    virtual std::string toString() const = 0;
+    std::string toString() const;
 };
 
 // Base class for places
-struct Place : public Node {
+struct Place : public TypedNode {
+    explicit Place(NodeKind k) : TypedNode(k) {}
+    static bool classof(NodeKind k) { return k >= NodeKind::Id && k <= NodeKind::FieldAccess; }
      // Check method for Places returns the type they refer to
-    virtual std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const = 0;
-    virtual std::string toString() const = 0;
+    const Type* check(const Gamma& gamma, const Delta& delta) const;
+    std::string toString() const;
 };
 
 // Specific Node Implementations
 
 struct Id : public Place {
-    std::string name;
-    explicit Id(std::string n) : name(std::move(n)) {}
+    Symbol name;
+    explicit Id(Symbol n) : Place(NodeKind::Id), name(n) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Id; }
     void print(std::ostream& os) const override { os << "Id(\"" << name << "\")"; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-    std::string toString() const override { return name; }
+    const Type* applyRule(const Gamma& gamma) const;
 };
 
 // Val wraps a Place when used as an expression
 struct Val : public Exp {
-    std::unique_ptr<Place> place;
-    explicit Val(std::unique_ptr<Place> p) : place(std::move(p)) {}
+    Place* place;
+    explicit Val(Place* p) : Exp(NodeKind::Val), place(p) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Val; }
     void print(std::ostream& os) const override { os << "Val(" << place << ")"; }
-    // Check delegates to the Place's check
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override { return place->check(gamma, delta); }
-     std::string toString() const override { return place->toString(); }
 };
 
 struct Num : public Exp {
     long long value;
-    explicit Num(long long val) : value(val) {}
+    explicit Num(long long val) : Exp(NodeKind::Num), value(val) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Num; }
     void print(std::ostream& os) const override { os << "Num(" << value << ")"; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-     std::string toString() const override { return std::to_string(value); }
+    const Type* applyRule() const;
 };
 
 struct NilExp : public Exp {
+    NilExp() : Exp(NodeKind::Nil) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Nil; }
     void print(std::ostream& os) const override { os << "Nil"; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-     std::string toString() const override { return "nil"; }
+    const Type* applyRule() const;
 };
 
 struct Select : public Exp {
-    std::unique_ptr<Exp> guard;
-    std::unique_ptr<Exp> tt;
-    std::unique_ptr<Exp> ff;
-    Select(std::unique_ptr<Exp> g, std::unique_ptr<Exp> t, std::unique_ptr<Exp> f)
-    : guard(std::move(g)), tt(std::move(t)), ff(std::move(f)) {}
+    Exp* guard;
+    Exp* tt;
+    Exp* ff;
+    Select(Exp* g, Exp* t, Exp* f)
+    : Exp(NodeKind::Select), guard(g), tt(t), ff(f) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Select; }
     void print(std::ostream& os) const override { os << "Select { guard: " << guard << ", tt: " << tt << ", ff: " << ff << " }"; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-    std::string toString() const override;
+    void checkGuard(const Type* guardType) const;
+    const Type* applyRule(const Type* ttType, const Type* ffType) const;
 };
 
 struct UnOp : public Exp {
     UnaryOp op;
-    std::unique_ptr<Exp> exp;
-    UnOp(UnaryOp o, std::unique_ptr<Exp> e) : op(o), exp(std::move(e)) {}
+    Exp* exp;
+    UnOp(UnaryOp o, Exp* e) : Exp(NodeKind::UnOp), op(o), exp(e) {}
+    static bool classof(NodeKind k) { return k == NodeKind::UnOp; }
     void print(std::ostream& os) const override;
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-    std::string toString() const override;
+    const Type* applyRule(const Type* operandType) const;
 };
 
 struct BinOp : public Exp {
     BinaryOp op;
-    std::unique_ptr<Exp> left;
-    std::unique_ptr<Exp> right;
-    BinOp(BinaryOp o, std::unique_ptr<Exp> l, std::unique_ptr<Exp> r)
-    : op(o), left(std::move(l)), right(std::move(r)) {}
+    Exp* left;
+    Exp* right;
+    BinOp(BinaryOp o, Exp* l, Exp* r)
+    : Exp(NodeKind::BinOp), op(o), left(l), right(r) {}
+    static bool classof(NodeKind k) { return k == NodeKind::BinOp; }
     void print(std::ostream& os) const override;
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-    std::string toString() const override;
+    const Type* applyRule(const Type* leftType, const Type* rightType) const;
 };
 
 struct NewSingle : public Exp {
-    std::shared_ptr<Type> type;
-    explicit NewSingle(std::shared_ptr<Type> t) : type(std::move(t)) {}
+    const Type* type;
+    const Type* resultType; // ptr(type), interned when the node is built
+    NewSingle(const Type* t, const Type* result) : Exp(NodeKind::NewSingle), type(t), resultType(result) {}
+    static bool classof(NodeKind k) { return k == NodeKind::NewSingle; }
     void print(std::ostream& os) const override { os << "new " << type; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-    std::string toString() const override { return "new " + type->toString(); }
+    const Type* applyRule() const;
 };
 
 struct NewArray : public Exp {
-    std::shared_ptr<Type> type;
-    std::unique_ptr<Exp> size;
-    NewArray(std::shared_ptr<Type> t, std::unique_ptr<Exp> s)
-    : type(std::move(t)), size(std::move(s)) {}
+    const Type* type;
+    Exp* size;
+    const Type* resultType; // array(type), interned when the node is built
+    NewArray(const Type* t, Exp* s, const Type* result)
+    : Exp(NodeKind::NewArray), type(t), size(s), resultType(result) {}
+    static bool classof(NodeKind k) { return k == NodeKind::NewArray; }
     void print(std::ostream& os) const override { os << "NewArray(" << type << ", " << size << ")"; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-    std::string toString() const override;
+    const Type* applyRule(const Type* amtType) const;
 };
 
 struct Deref : public Place {
-    std::unique_ptr<Exp> exp;
-    explicit Deref(std::unique_ptr<Exp> e) : exp(std::move(e)) {}
+    Exp* exp;
+    explicit Deref(Exp* e) : Place(NodeKind::Deref), exp(e) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Deref; }
     void print(std::ostream& os) const override { os << "Deref(" << exp << ")"; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-    std::string toString() const override;
+    const Type* applyRule(const Type* expType) const;
 };
 
 struct ArrayAccess : public Place {
-    std::unique_ptr<Exp> array;
-    std::unique_ptr<Exp> index;
-    ArrayAccess(std::unique_ptr<Exp> arr, std::unique_ptr<Exp> idx)
-    : array(std::move(arr)), index(std::move(idx)) {}
+    Exp* array;
+    Exp* index;
+    ArrayAccess(Exp* arr, Exp* idx)
+    : Place(NodeKind::ArrayAccess), array(arr), index(idx) {}
+    static bool classof(NodeKind k) { return k == NodeKind::ArrayAccess; }
     void print(std::ostream& os) const override { os << "ArrayAccess { array: " << array << ", idx: " << index << " }"; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-     std::string toString() const override; // { return array->toString() + "[" + index->toString() + "]"; }
+    const Type* applyRule(const Type* arrType, const Type* idxType) const;
 };
 
 struct FieldAccess : public Place {
-    std::unique_ptr<Exp> ptr;
-    std::string field;
-    FieldAccess(std::unique_ptr<Exp> p, std::string f)
-    : ptr(std::move(p)), field(std::move(f)) {}
+    Exp* ptr;
+    Symbol field;
+    FieldAccess(Exp* p, Symbol f)
+    : Place(NodeKind::FieldAccess), ptr(p), field(f) {}
+    static bool classof(NodeKind k) { return k == NodeKind::FieldAccess; }
     void print(std::ostream& os) const override { os << "FieldAccess { ptr: " << ptr << ", field: \"" << field << "\" }"; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override;
-    std::string toString() const override; //  { return ptr->toString() + "." + field; }
+    const Type* applyRule(const Type* baseType, const Delta& delta) const;
 };
 
 struct FunCall: Node {
-    std::unique_ptr<Exp> callee;
-    std::vector<std::unique_ptr<Exp>> args;
-    FunCall(std::unique_ptr<Exp> c, std::vector<std::unique_ptr<Exp>> a)
-    : callee(std::move(c)), args(std::move(a)) {}
+    Exp* callee;
+    NodeList<Exp*> args;
+    FunCall(Exp* c, NodeList<Exp*> a)
+    : Node(NodeKind::FunCall), callee(c), args(a) {}
+    static bool classof(NodeKind k) { return k == NodeKind::FunCall; }
     void print(std::ostream& os) const override;
-    // FunCall itself doesn't have a type, CallExp does.
-    // However, we might need a helper check method here or do it all in CallExp::check
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const; // Added check here
+    // FunCall itself doesn't have a type, CallExp does. Its premises are
+    // checked in order: callee is not main, the callee's function type and
+    // arity, then each argument as it is typed. While collecting errors,
+    // calleeFnType yields nullptr when those fail, and checkArg only types.
+    void checkCallee() const;
+    const FnType* calleeFnType(const Type* calleeType) const;
+    void checkArg(size_t i, const Type* argType, const FnType* funcType) const;
     std::string toString() const; // Added toString
 };
 
 struct CallExp : public Exp {
-    std::unique_ptr<FunCall> fun_call;
-    explicit CallExp(std::unique_ptr<FunCall> fc) : fun_call(std::move(fc)) {}
+    FunCall* fun_call;
+    explicit CallExp(FunCall* fc) : Exp(NodeKind::Call), fun_call(fc) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Call; }
     void print(std::ostream& os) const override { os << "Call(" << fun_call << ")"; }
-    std::shared_ptr<Type> check(const Gamma& gamma, const Delta& delta) const override { return fun_call->check(gamma, delta); }
-    std::string toString() const override { return fun_call->toString(); }
 };
 
 // Statement nodes
 struct Stmt : public Node {
+    explicit Stmt(NodeKind k) : Node(k) {}
+    static bool classof(NodeKind k) { return k >= NodeKind::Stmts && k <= NodeKind::Return; }
      // Check method: Returns true if the statement definitely executes a return
-    virtual bool check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const = 0;
+    bool check(const Gamma& gamma, const Delta& delta, const Type* returnType, bool inLoop) const;
 };
 
 struct Stmts : public Stmt {
-    std::vector<std::unique_ptr<Stmt>> statements;
+    NodeList<Stmt*> statements;
+    explicit Stmts(NodeList<Stmt*> s) : Stmt(NodeKind::Stmts), statements(s) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Stmts; }
     void print(std::ostream& os) const override {
         os << "[";
         for (size_t i = 0; i < statements.size(); ++i) {
@@ -387,122 +957,349 @@ struct Stmts : public Stmt {
         }
         os << "]";
     }
-    bool check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const override;
 };
 
 struct Assign : public Stmt {
-    std::unique_ptr<Place> place;
-    std::unique_ptr<Exp> exp;
-    Assign(std::unique_ptr<Place> p, std::unique_ptr<Exp> e)
-    : place(std::move(p)), exp(std::move(e)) {}
+    Place* place;
+    Exp* exp;
+    Assign(Place* p, Exp* e)
+    : Stmt(NodeKind::Assign), place(p), exp(e) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Assign; }
     void print(std::ostream& os) const override { os << "Assign(" << place << ", " << exp << ")"; }
-    bool check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const override;
+    void applyRule(const Type* lhsType, const Type* rhsType) const;
 };
 
 struct CallStmt : public Stmt {
-    std::unique_ptr<FunCall> fun_call;
-    explicit CallStmt(std::unique_ptr<FunCall> fc) : fun_call(std::move(fc)) {}
+    FunCall* fun_call;
+    explicit CallStmt(FunCall* fc) : Stmt(NodeKind::CallStmt), fun_call(fc) {}
+    static bool classof(NodeKind k) { return k == NodeKind::CallStmt; }
     void print(std::ostream& os) const override { os << "Call(" << fun_call << ")"; }
-    bool check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const override;
 };
 
 struct If : public Stmt {
-    std::unique_ptr<Exp> guard;
-    std::unique_ptr<Stmt> tt;
-    std::optional<std::unique_ptr<Stmt>> ff;
+    Exp* guard;
+    Stmt* tt;
+    std::optional<Stmt*> ff;
 
-    If(std::unique_ptr<Exp> g, std::unique_ptr<Stmt> t, std::optional<std::unique_ptr<Stmt>> f)
-    : guard(std::move(g)), tt(std::move(t)), ff(std::move(f)) {}
+    If(Exp* g, Stmt* t, std::optional<Stmt*> f)
+    : Stmt(NodeKind::If), guard(g), tt(t), ff(f) {}
+    static bool classof(NodeKind k) { return k == NodeKind::If; }
     void print(std::ostream& os) const override;
-    bool check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const override;
+    void checkGuard(const Type* guardType) const;
 };
 
 struct While : public Stmt {
-    std::unique_ptr<Exp> guard;
-    std::unique_ptr<Stmt> body;
+    Exp* guard;
+    Stmt* body;
 
-    While(std::unique_ptr<Exp> g, std::unique_ptr<Stmt> b)
-    : guard(std::move(g)), body(std::move(b)) {}
+    While(Exp* g, Stmt* b)
+    : Stmt(NodeKind::While), guard(g), body(b) {}
+    static bool classof(NodeKind k) { return k == NodeKind::While; }
     void print(std::ostream& os) const override { os << "While(" << guard << ", " << body << ")"; }
-    bool check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const override;
+    void checkGuard(const Type* guardType) const;
 };
 
 struct Break : public Stmt {
+    Break() : Stmt(NodeKind::Break) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Break; }
     void print(std::ostream& os) const override { os << "Break"; }
-    bool check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const override;
+    void applyRule(bool inLoop) const;
 };
 
 struct Continue : public Stmt {
+    Continue() : Stmt(NodeKind::Continue) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Continue; }
     void print(std::ostream& os) const override { os << "Continue"; }
-    bool check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const override;
+    void applyRule(bool inLoop) const;
 };
 
 struct Return : public Stmt {
     // Making expression optional to handle potential void returns
-    std::optional<std::unique_ptr<Exp>> exp;
-    explicit Return(std::optional<std::unique_ptr<Exp>> e) : exp(std::move(e)) {}
+    std::optional<Exp*> exp;
+    explicit Return(std::optional<Exp*> e) : Stmt(NodeKind::Return), exp(e) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Return; }
     void print(std::ostream& os) const override {
         os << "Return(";
         if(exp) os << (*exp); else os << "<void>";
         os << ")";
     }
-    bool check(const Gamma& gamma, const Delta& delta, const std::shared_ptr<Type>& returnType, bool inLoop) const override;
+    // expType is null for a bare return
+    void applyRule(const Type* expType, const Type* returnType) const;
 };
 
 // Top level nodes
 struct StructDef : public Node {
-    std::string name;
-    std::vector<Decl> fields;
+    Symbol name;
+    NodeList<Decl> fields;
+    StructDef() : Node(NodeKind::StructDef) {}
+    static bool classof(NodeKind k) { return k == NodeKind::StructDef; }
     void print(std::ostream& os) const override;
     void check(const Gamma& gamma, const Delta& delta) const;
 };
 
 struct Extern : public Node {
-    std::string name;
-    std::vector<std::shared_ptr<Type>> param_types;
-    std::shared_ptr<Type> rettype;
+    Symbol name;
+    // Interned when the extern is built; Gamma binds name to it as is
+    const FnType* type = nullptr;
+    Extern() : Node(NodeKind::Extern) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Extern; }
     void print(std::ostream& os) const override;
 };
 
 
 struct FunctionDef : public Node {
-    std::string name;
-    std::vector<Decl> params;
-    std::shared_ptr<Type> rettype;
-    std::vector<Decl> locals;
-    std::unique_ptr<Stmt> body;
-
+    Symbol name;
+    NodeList<Decl> params;
+    const Type* rettype;
+    NodeList<Decl> locals;
+    Stmt* body = nullptr;
+    // fn(params) -> rettype, interned when the function is built (see
+    // signatureOf); Gamma binds name to a pointer to it
+    const FnType* signature = nullptr;
+
+    FunctionDef() : Node(NodeKind::FunctionDef) {}
+    static bool classof(NodeKind k) { return k == NodeKind::FunctionDef; }
     void print(std::ostream& os) const override;
-    void check(const Gamma& gamma, const Delta& delta) const;
+    // With flat, the body is lowered to a FlatBody and checked over that
+    // instead of by walking the tree
+    void check(const Gamma& gamma, const Delta& delta, bool flat = false) const;
 };
 
 
-struct Program : public Node {
-    std::vector<std::unique_ptr<StructDef>> structs;
+// Where Program::check records how long it took, for --stats
+struct CheckStats {
+    // checkTopLevel, construct_gamma and construct_delta, checkDefinitions
+    double topLevelSeconds = 0, environmentSeconds = 0, definitionsSeconds = 0;
+    // By index into Program::functions; negative for a function that was
+    // not checked (cached, or after the first error)
+    std::vector<double> functionSeconds;
+};
+
+struct Program final : public Node {
+    // Own every Type and node referenced below, so they are declared first
+    TypeContext types;
+    AstArena arena;
+    std::vector<StructDef*> structs;
     std::vector<Extern> externs;
-    std::vector<std::unique_ptr<FunctionDef>> functions;
+    std::vector<FunctionDef*> functions;
 
+    Program() : Node(NodeKind::Program) {}
+    static bool classof(NodeKind k) { return k == NodeKind::Program; }
     void print(std::ostream& os) const override;
-    void check() const;
+    // Checks on up to `jobs` threads (0: one per core). The structs and
+    // function bodies are checked concurrently, but the error reported is
+    // always the one the sequential order would hit first. With a cache,
+    // functions it holds the key of are skipped (so typeOf stays nullptr
+    // in them) and the functions that pass are added to it. With stats,
+    // the time of each phase and function is recorded there. With
+    // diagnostics, errors are collected there instead of thrown, and
+    // check() returns normally once it is full or everything is checked.
+    // With flat, function bodies are checked by the flat engine (see
+    // FlatBody); the outcome is the same either way.
+    void check(unsigned jobs = 1, CheckCache* cache = nullptr, CheckStats* stats = nullptr,
+               Diagnostics* diagnostics = nullptr, bool flat = false);
+    // The phases of check(), in order: checkTopLevel, then construct_gamma
+    // and construct_delta, then checkDefinitions over those environments
+    void checkTopLevel();
+    void checkDefinitions(const Gamma& gamma, const Delta& delta, unsigned jobs, CheckCache* cache = nullptr,
+                          CheckStats* stats = nullptr, Diagnostics* diagnostics = nullptr, bool flat = false) const;
+
+    // The type check() gave an expression or place of this program, in O(1):
+    // nullptr if it has not been checked, or its check failed
+    const Type* typeOf(const Exp* exp) const { return exp->checkedType; }
+    const Type* typeOf(const Place* place) const { return place->checkedType; }
+    // Lists every function with the expressions and places its statements
+    // hold, in source order, one "text : type" line each
+    void printTypes(std::ostream& os) const;
 };
 
 // --- JSON to AST Conversion ---
 // Forward declarations for functions needed to build the AST from JSON
-std::shared_ptr<Type> buildType(const nlohmann::json& j);
-std::unique_ptr<Exp> buildExp(const nlohmann::json& j);
-std::unique_ptr<Place> buildPlace(const nlohmann::json& j);
-std::unique_ptr<Stmt> buildStmt(const nlohmann::json& j);
-Decl buildDecl(const nlohmann::json& j);
-std::unique_ptr<FunctionDef> buildFunctionDef(const nlohmann::json& j);
-std::unique_ptr<StructDef> buildStructDef(const nlohmann::json& j);
-Extern buildExtern(const nlohmann::json& j);
+// Nodes are allocated in prog.arena and types interned into prog.types
+const Type* buildType(const nlohmann::json& j, TypeContext& types);
+Exp* buildExp(const nlohmann::json& j, Program& prog);
+Place* buildPlace(const nlohmann::json& j, Program& prog);
+Place* buildPlace(const std::string& key, const nlohmann::json& value, Program& prog);
+Stmt* buildStmt(const nlohmann::json& j, Program& prog);
+Decl buildDecl(const nlohmann::json& j, TypeContext& types);
+FunctionDef* buildFunctionDef(const nlohmann::json& j, Program& prog);
+StructDef* buildStructDef(const nlohmann::json& j, Program& prog);
+Extern buildExtern(const nlohmann::json& j, TypeContext& types);
+// The interned type fn(params) -> ret, for FunctionDef::signature
+const FnType* signatureOf(TypeContext& types, const NodeList<Decl>& params, const Type* ret);
+
 std::unique_ptr<Program> buildProgram(const nlohmann::json& j);
-std::unique_ptr<FunCall> buildFunCall(const nlohmann::json& j);
+
+// Building recurses once per level of the tree, so input whose JSON
+// objects/arrays nest deeper than maxDepth is rejected first; checking and
+// rendering error messages do not recurse (see checker.cpp, ExpWriter).
+// An AST level is about two JSON levels. buildProgramSax checks as it
+// reads; buildProgram relies on its DOM having been parsed by
+// parseJsonWithinDepth, which reads `in` like `in >> j` but stops at the
+// first container past maxDepth and returns false.
+constexpr size_t kDefaultMaxDepth = 10000;
+bool parseJsonWithinDepth(std::istream& in, nlohmann::json& j, size_t maxDepth);
+bool parseJsonWithinDepth(const char* first, const char* last, nlohmann::json& j, size_t maxDepth);
+[[noreturn]] void throwNestingTooDeep(size_t maxDepth);
+FunCall* buildFunCall(const nlohmann::json& j, Program& prog);
+
+// Streaming alternative to buildProgram: builds the AST directly from SAX
+// events without materializing a json DOM (see sax_builder.cpp)
+std::unique_ptr<Program> buildProgramSax(std::istream& in, size_t maxDepth = kDefaultMaxDepth);
+std::unique_ptr<Program> buildProgramSax(const char* first, const char* last, size_t maxDepth = kDefaultMaxDepth);
+
+// First-error mode: builds and checks [first, last) together, stopping at
+// the first TypeError, which it throws just as check() would. The headers
+// are built first, then each function body right before it is checked, so
+// a file is only built up to its failing function (see sax_builder.cpp).
+// prog holds the program from the start, for rendering the error. JSON
+// that is malformed after the failing function goes undiagnosed.
+void checkProgramFirstError(const char* first, const char* last, std::unique_ptr<Program>& prog,
+                            size_t maxDepth = kDefaultMaxDepth);
+
+// Streaming mode: checkProgramFirstError, but each body is built into an
+// arena of its own and freed as soon as it has checked, so that beyond the
+// headers memory holds one function's nodes at a time. On a TypeError the
+// failing body is kept in prog for rendering it; the others are gone, and
+// prog's bodies are nullptr.
+void checkProgramStreaming(const char* first, const char* last, std::unique_ptr<Program>& prog,
+                           size_t maxDepth = kDefaultMaxDepth);
+
+// Builds [first, last) like buildProgramSax, with the function bodies
+// built on up to `jobs` threads once a structural scan has found them
+// (see sax_builder.cpp). Errors are reported exactly as buildProgramSax
+// reports them.
+std::unique_ptr<Program> buildProgramParallel(const char* first, const char* last, unsigned jobs,
+                                              size_t maxDepth = kDefaultMaxDepth);
+// The smallest input the driver builds in parallel; below it, the scan and
+// the threads cost about as much as they save
+constexpr size_t kParallelBuildBytes = size_t(1) << 20;
+
+// --- Input Files ---
+// The whole of an input file, or of stdin for the path "-", as one
+// contiguous range for the parsers above (see input_file.cpp)
+class InputFile {
+public:
+    InputFile() = default;
+    ~InputFile();
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    // False if path cannot be opened
+    bool open(const std::string& path);
+    // Maps or reads all of it; throws std::runtime_error if reading fails
+    void read();
+    const char* data() const;
+    size_t size() const { return length; }
+    const char* begin() const { return data(); }
+    const char* end() const { return data() + length; }
+
+private:
+    std::string path;
+    int fd = -1;
+    const char* mapped = nullptr;
+    size_t length = 0;
+    std::vector<char> buffer;
+};
+
+// --- Binary AST Format ---
+// A built Program saved in the compact .astb layout (see astb.cpp), so a
+// later run can skip JSON entirely; .astj stays the interchange format.
+// The loader maps the file and builds the nodes in one pass over it,
+// throwing runtime_error for any file it did not write, and for types or
+// nodes nested more than maxDepth levels deep.
+void writeProgramBinary(const Program& prog, std::ostream& out);
+std::unique_ptr<Program> loadProgramBinary(const std::string& path, size_t maxDepth = kDefaultMaxDepth);
+// Whether `path` names an .astb file, by its extension
+bool isProgramBinary(const std::string& path);
+
+
+// --- Tree Walking ---
+// Replaces kids with the direct child expressions, places, calls and
+// statements of `node`, in source order (a call's callee, then its args).
+// Walks that must survive deep input keep their own stack over this.
+void childrenOf(const Node* node, std::vector<const Node*>& kids);
+
+
+// --- Incremental Checking ---
+// The keys of functions that passed their check, kept between runs in a
+// small text file (see check_cache.cpp). A key hashes the function with
+// every global signature and struct its check can read, so a function is
+// only skipped if checking it again would pass. Safe to share between
+// checking threads.
+class CheckCache {
+public:
+    // Starts from the keys saved at `path`; a missing or foreign file starts
+    // empty, and an empty path keeps the cache in memory only
+    explicit CheckCache(std::string path);
+    bool contains(uint64_t key);
+    void insert(uint64_t key);
+    // Writes the keys back, those this run hit or added first; false if it could not
+    bool save() const;
+    size_t hits() const { return hitCount; }
+    size_t misses() const { return missCount; }
+
+private:
+    std::string path;
+    mutable std::mutex mutex;
+    // Every key, and whether this run hit or added it
+    std::unordered_map<uint64_t, bool> keys;
+    // The keys read from the file, most recently used first
+    std::vector<uint64_t> loaded;
+    size_t hitCount = 0, missCount = 0;
+};
+
+// The CheckCache key of f, given the global frame of Γ and the structs by name
+uint64_t checkKey(const FunctionDef& f, const Gamma& globals, const SymbolMap<const StructDef*>& structs);
+
+
+// --- Parallel Checking ---
+// Runs task(i) for every i in [0, count) on up to `jobs` threads and behaves
+// like the sequential loop: if tasks throw, the exception of the lowest
+// failing index is rethrown.
+void forEachInOrder(size_t count, unsigned jobs, const std::function<void(size_t)>& task);
+
+
+// --- Flat Checking ---
+// A function body lowered to a structure-of-arrays table of operations
+// (see flat_checker.cpp): its nodes in the order their rules run, mostly
+// post-order, with the premises a rule checks between its children (a
+// guard, a callee, each argument) as operations of their own. Checking
+// the body is then one linear pass over the table with a stack of types,
+// with no tree walk.
+enum class FlatOp : uint8_t {
+    // Places and expressions; each leaves its type on the stack
+    Id, Num, Nil, NewSingle, Deref, ArrayAccess, FieldAccess,
+    Val, Select, UnOp, BinOp, NewArray, Call,
+    // Premises checked part way through a rule
+    SelectGuard, CallCallee, CallFn, CallArg, CallEnd,
+    // Statements; If and While only appear as their guards
+    Assign, CallStmt, IfGuard, WhileGuard, Break, Continue, Return,
+};
+
+struct FlatBody {
+    std::vector<FlatOp> ops;
+    // Per op: the symbol id of an Id, the argument of a CallArg, whether a
+    // Break or Continue is in a loop, whether a Return has an expression
+    std::vector<uint32_t> operands;
+    // Per op: the node whose rule it runs, for the rule and its errors
+    std::vector<const Node*> nodes;
+    // Whether the body definitely returns follows from its statements
+    // alone, so lowering finds it
+    bool returns = false;
+};
+
+// Replaces flat with the lowering of body, without recursion; the
+// vectors keep their capacity, so a reused FlatBody stops allocating
+void lowerBody(const Stmt* body, FlatBody& flat);
+// Checks a lowered body as Stmt::check would check the body itself with
+// inLoop = false, and returns whether it definitely returns
+bool checkFlat(const FlatBody& flat, const Gamma& gamma, const Delta& delta, const Type* returnType);
 
 
 // --- Environment Construction ---
-Gamma construct_gamma(const std::vector<Extern>& externs, const std::vector<std::unique_ptr<FunctionDef>>& functions);
-Delta construct_delta(const std::vector<std::unique_ptr<StructDef>>& structs);
+Gamma construct_gamma(TypeContext& types, const std::vector<Extern>& externs, const std::vector<FunctionDef*>& functions);
+Delta construct_delta(TypeContext& types, const std::vector<StructDef*>& structs);
 
 
 #endif
\ No newline at end of file
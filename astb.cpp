@@ -0,0 +1,536 @@
+#include "ast.hpp"
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+// Binary AST Format (.astb)
+//
+// A built Program serialized as arrays of 32-bit words in host byte order,
+// so a file can be mapped and read in place. Layout, every section padded
+// to a whole word:
+//
+//   header    magic "ASTB", version, then the sizes of the sections below
+//   strings   stringCount + 1 offsets into the bytes that follow: every
+//             identifier, struct and field name once
+//   types     one record per distinct type, operands first
+//   nodes     one record per expression, place and statement, children first
+//   top       the structs, externs and functions, pointing into the above
+//
+// A record is a tag word (kind in the low byte, operator in the next) and
+// the operands its kind has. Strings, types and nodes are referred to by
+// their position in their table, and a node only refers to nodes before it,
+// so loading is one forward pass with neither recursion nor a JSON token in
+// sight, however deep the tree. Tags are the TypeKind / NodeKind /
+// UnaryOp / BinaryOp values; changing those enums needs a version bump.
+
+namespace {
+
+constexpr uint32_t kAstbMagic = 0x42545341; // "ASTB" read as a little-endian word
+constexpr uint32_t kAstbVersion = 1;
+constexpr uint32_t kNone = UINT32_MAX;      // absent optional child (If ff, Return exp)
+
+static_assert(uint8_t(TypeKind::Fn) == 5 && uint8_t(NodeKind::Return) == 20 && uint8_t(BinaryOp::Gte) == 11,
+              "the .astb tags follow these enums; bump kAstbVersion when they change");
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stringCount;
+    uint32_t stringBytes;
+    uint32_t typeCount;
+    uint32_t typeWords;
+    uint32_t nodeCount;
+    uint32_t nodeWords;
+    uint32_t topWords;
+};
+
+uint32_t tag(uint8_t kind, uint8_t op = 0) { return kind | uint32_t(op) << 8; }
+
+// --- Writing ---
+
+class Writer {
+public:
+    explicit Writer(const Program& prog) : prog(prog), stringIndex(prog.types.symbols.size(), kNone) {}
+
+    void write(std::ostream& out) {
+        top.push_back(uint32_t(prog.structs.size()));
+        for (const StructDef* s : prog.structs) {
+            top.push_back(str(s->name));
+            decls(s->fields);
+        }
+        top.push_back(uint32_t(prog.externs.size()));
+        for (const Extern& e : prog.externs) {
+            top.push_back(str(e.name));
+            top.push_back(type(e.type->returnType));
+            top.push_back(uint32_t(e.type->paramTypes.size()));
+            for (const Type* p : e.type->paramTypes) top.push_back(type(p));
+        }
+        top.push_back(uint32_t(prog.functions.size()));
+        for (const FunctionDef* f : prog.functions) {
+            top.push_back(str(f->name));
+            top.push_back(type(f->rettype));
+            decls(f->params);
+            decls(f->locals);
+            top.push_back(f->body ? tree(f->body) : kNone);
+        }
+
+        stringOffsets.push_back(uint32_t(stringBytes.size()));
+        Header h{kAstbMagic, kAstbVersion, uint32_t(stringOffsets.size() - 1), uint32_t(stringBytes.size()),
+                 typeCount, uint32_t(types.size()), nodeCount, uint32_t(nodes.size()), uint32_t(top.size())};
+        stringBytes.resize((stringBytes.size() + 3) & ~size_t(3), '\0');
+        out.write(reinterpret_cast<const char*>(&h), sizeof h);
+        words(out, stringOffsets);
+        out.write(stringBytes.data(), std::streamsize(stringBytes.size()));
+        words(out, types);
+        words(out, nodes);
+        words(out, top);
+    }
+
+private:
+    const Program& prog;
+    std::vector<uint32_t> stringIndex; // by Symbol id
+    std::vector<uint32_t> stringOffsets;
+    std::string stringBytes;
+    std::unordered_map<const Type*, uint32_t> typeIndex;
+    std::vector<uint32_t> types, nodes, top;
+    uint32_t typeCount = 0, nodeCount = 0;
+
+    static void words(std::ostream& out, const std::vector<uint32_t>& w) {
+        out.write(reinterpret_cast<const char*>(w.data()), std::streamsize(w.size() * sizeof(uint32_t)));
+    }
+
+    uint32_t str(Symbol s) {
+        uint32_t& index = stringIndex[s.id];
+        if (index == kNone) {
+            index = uint32_t(stringOffsets.size());
+            stringOffsets.push_back(uint32_t(stringBytes.size()));
+            stringBytes += s.str();
+        }
+        return index;
+    }
+
+    // Types nest only as deep as the builders and the .astb loader allow
+    // (--max-depth), so plain recursion is fine
+    uint32_t type(const Type* t) {
+        auto it = typeIndex.find(t);
+        if (it != typeIndex.end()) return it->second;
+        std::vector<uint32_t> record{tag(uint8_t(t->kind))};
+        if (const StructType* st = dyn_cast<StructType>(t)) {
+            record.push_back(str(st->name));
+        } else if (const PtrType* pt = dyn_cast<PtrType>(t)) {
+            record.push_back(type(pt->pointeeType));
+        } else if (const ArrayType* at = dyn_cast<ArrayType>(t)) {
+            record.push_back(type(at->elementType));
+        } else if (const FnType* ft = dyn_cast<FnType>(t)) {
+            record.push_back(type(ft->returnType));
+            record.push_back(uint32_t(ft->paramTypes.size()));
+            for (const Type* p : ft->paramTypes) record.push_back(type(p));
+        }
+        types.insert(types.end(), record.begin(), record.end());
+        return typeIndex[t] = typeCount++;
+    }
+
+    void decls(const NodeList<Decl>& list) {
+        top.push_back(uint32_t(list.size()));
+        for (const Decl& d : list) {
+            top.push_back(str(d.name));
+            top.push_back(type(d.type));
+        }
+    }
+
+    // Appends `root` and everything below it in post-order, without
+    // recursing, and returns the index of its record. The indices of
+    // finished children wait on `done` until their parent is written.
+    uint32_t tree(const Node* root) {
+        std::vector<std::pair<const Node*, bool>> pending{{root, false}};
+        std::vector<uint32_t> done;
+        std::vector<const Node*> kids;
+        while (!pending.empty()) {
+            auto [node, expanded] = pending.back();
+            pending.pop_back();
+            childrenOf(node, kids);
+            if (!expanded) {
+                pending.push_back({node, true});
+                for (size_t i = kids.size(); i-- > 0;) pending.push_back({kids[i], false});
+                continue;
+            }
+            const uint32_t* ref = done.data() + done.size() - kids.size();
+            record(node, ref, kids.size());
+            done.resize(done.size() - kids.size());
+            done.push_back(nodeCount++);
+        }
+        return done.back();
+    }
+
+    // Appends the record of `node`, whose `count` children have the indices ref[0..]
+    void record(const Node* node, const uint32_t* ref, size_t count) {
+        uint8_t kind = uint8_t(node->kind);
+        switch (node->kind) {
+            case NodeKind::Id: nodes.insert(nodes.end(), {tag(kind), str(cast<Id>(node)->name)}); return;
+            case NodeKind::FieldAccess:
+                nodes.insert(nodes.end(), {tag(kind), ref[0], str(cast<FieldAccess>(node)->field)});
+                return;
+            case NodeKind::Num: {
+                uint64_t value = uint64_t(cast<Num>(node)->value);
+                nodes.insert(nodes.end(), {tag(kind), uint32_t(value), uint32_t(value >> 32)});
+                return;
+            }
+            case NodeKind::UnOp: nodes.insert(nodes.end(), {tag(kind, uint8_t(cast<UnOp>(node)->op)), ref[0]}); return;
+            case NodeKind::BinOp:
+                nodes.insert(nodes.end(), {tag(kind, uint8_t(cast<BinOp>(node)->op)), ref[0], ref[1]});
+                return;
+            case NodeKind::NewSingle: nodes.insert(nodes.end(), {tag(kind), type(cast<NewSingle>(node)->type)}); return;
+            case NodeKind::NewArray: nodes.insert(nodes.end(), {tag(kind), type(cast<NewArray>(node)->type), ref[0]}); return;
+            case NodeKind::FunCall:
+                nodes.insert(nodes.end(), {tag(kind), ref[0], uint32_t(count - 1)});
+                nodes.insert(nodes.end(), ref + 1, ref + count);
+                return;
+            case NodeKind::Stmts:
+                nodes.insert(nodes.end(), {tag(kind), uint32_t(count)});
+                nodes.insert(nodes.end(), ref, ref + count);
+                return;
+            case NodeKind::If:
+                nodes.insert(nodes.end(), {tag(kind), ref[0], ref[1], cast<If>(node)->ff ? ref[2] : kNone});
+                return;
+            case NodeKind::Return:
+                nodes.insert(nodes.end(), {tag(kind), cast<Return>(node)->exp ? ref[0] : kNone});
+                return;
+            default:
+                // Fixed arity, children only
+                nodes.push_back(tag(kind));
+                nodes.insert(nodes.end(), ref, ref + count);
+                return;
+        }
+    }
+};
+
+// --- Reading ---
+
+[[noreturn]] void corrupt(const std::string& path, const std::string& what) {
+    throw std::runtime_error("Invalid .astb file " + path + ": " + what);
+}
+
+class Loader {
+public:
+    Loader(const std::string& path, const char* data, size_t size, size_t maxDepth)
+        : path(path), base(data), size(size), maxDepth(maxDepth) {}
+
+    std::unique_ptr<Program> load() {
+        if (size < sizeof(Header)) corrupt(path, "too short for a header");
+        Header h;
+        std::memcpy(&h, base, sizeof h);
+        if (h.magic != kAstbMagic) corrupt(path, "bad magic (not an .astb file, or written on a host of the other byte order)");
+        if (h.version != kAstbVersion) {
+            corrupt(path, "version " + std::to_string(h.version) + ", expected " + std::to_string(kAstbVersion));
+        }
+        prog = std::make_unique<Program>();
+
+        size_t offset = sizeof(Header);
+        const uint32_t* offsets = section(offset, size_t(h.stringCount) + 1);
+        const char* bytes = base + offset;
+        section(offset, (size_t(h.stringBytes) + 3) / 4);
+        loadStrings(offsets, bytes, h.stringCount, h.stringBytes);
+
+        Words typeWords{section(offset, h.typeWords), h.typeWords};
+        loadTypes(typeWords, h.typeCount);
+        Words nodeWords{section(offset, h.nodeWords), h.nodeWords};
+        loadNodes(nodeWords, h.nodeCount);
+        Words topWords{section(offset, h.topWords), h.topWords};
+        loadTop(topWords);
+        if (offset != size) corrupt(path, "trailing bytes after the last section");
+        return std::move(prog);
+    }
+
+private:
+    // A section being read front to back, each read bounds checked
+    struct Words {
+        const uint32_t* p;
+        size_t left;
+    };
+
+    const std::string& path;
+    const char* base;
+    size_t size;
+    // Types and nodes nest at most this deep, counting one level per record
+    size_t maxDepth;
+    std::unique_ptr<Program> prog;
+    std::vector<Symbol> strings;
+    std::vector<const Type*> types;
+    std::vector<Node*> nodes;
+    std::vector<uint8_t> used; // by node: already some node's child
+    uint32_t nodesBuilt = 0;
+    // How deep each type and node nests, and the deepest child of the
+    // record being read
+    std::vector<uint32_t> typeDepths, nodeDepths;
+    uint32_t childDepth = 0;
+
+    const uint32_t* section(size_t& offset, size_t words) {
+        if (words > (size - offset) / 4) corrupt(path, "truncated");
+        const uint32_t* p = reinterpret_cast<const uint32_t*>(base + offset);
+        offset += words * 4;
+        return p;
+    }
+
+    uint32_t next(Words& w) {
+        if (w.left == 0) corrupt(path, "truncated record");
+        --w.left;
+        return *w.p++;
+    }
+    Symbol nextString(Words& w) {
+        uint32_t i = next(w);
+        if (i >= strings.size()) corrupt(path, "string index out of range");
+        return strings[i];
+    }
+    const Type* nextType(Words& w) {
+        uint32_t i = next(w);
+        if (i >= types.size()) corrupt(path, "type index out of range");
+        childDepth = std::max(childDepth, typeDepths[i]);
+        return types[i];
+    }
+    // A reference to an earlier node of class T that no other node uses
+    template <typename T>
+    T* nextNode(Words& w) {
+        uint32_t i = next(w);
+        if (i >= nodesBuilt) corrupt(path, "node index out of range");
+        if (used[i]) corrupt(path, "node " + std::to_string(i) + " has two parents");
+        if (!isa<T>(nodes[i])) corrupt(path, "node " + std::to_string(i) + " has the wrong kind for its position");
+        used[i] = 1;
+        childDepth = std::max(childDepth, nodeDepths[i]);
+        return static_cast<T*>(nodes[i]);
+    }
+    template <typename T>
+    std::optional<T*> nextOptionalNode(Words& w) {
+        if (w.left > 0 && *w.p == kNone) {
+            next(w);
+            return std::nullopt;
+        }
+        return nextNode<T>(w);
+    }
+    template <typename T>
+    NodeList<T*> nextNodeList(Words& w, std::vector<T*>& scratch) {
+        uint32_t count = next(w);
+        if (count > w.left) corrupt(path, "truncated list");
+        scratch.clear();
+        for (uint32_t i = 0; i < count; ++i) scratch.push_back(nextNode<T>(w));
+        return prog->arena.list(scratch);
+    }
+    NodeList<Decl> nextDecls(Words& w) {
+        uint32_t count = next(w);
+        if (count > w.left / 2) corrupt(path, "truncated declaration list");
+        std::vector<Decl> decls;
+        decls.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            Symbol name = nextString(w);
+            decls.emplace_back(name, nextType(w));
+        }
+        return prog->arena.list(decls);
+    }
+
+    // The depth of the record just read, one more than its deepest child.
+    // An .astj file within maxDepth JSON levels never comes out deeper: each
+    // type and node is at least one level of JSON. Deeper ones are refused
+    // as the JSON front ends refuse them, before anything recurses on them.
+    uint32_t recordDepth() {
+        uint32_t depth = childDepth + 1;
+        if (depth > maxDepth) throwNestingTooDeep(maxDepth);
+        return depth;
+    }
+
+    void loadStrings(const uint32_t* offsets, const char* bytes, uint32_t count, uint32_t byteCount) {
+        if (offsets[count] != byteCount) corrupt(path, "string table size mismatch");
+        strings.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (offsets[i] > offsets[i + 1] || offsets[i + 1] > byteCount) corrupt(path, "string offsets out of order");
+            strings.push_back(prog->types.symbols.intern(std::string(bytes + offsets[i], offsets[i + 1] - offsets[i])));
+        }
+    }
+
+    void loadTypes(Words& w, uint32_t count) {
+        TypeContext& ctx = prog->types;
+        // Every record takes a word at least, so a corrupt count cannot
+        // reserve more than the section could hold
+        if (count > w.left) corrupt(path, "more types than the type section holds");
+        types.reserve(count);
+        typeDepths.reserve(count);
+        std::vector<const Type*> params;
+        for (uint32_t i = 0; i < count; ++i) {
+            childDepth = 0;
+            switch (TypeKind(next(w))) {
+                case TypeKind::Int: types.push_back(TypeContext::intType()); break;
+                case TypeKind::Nil: types.push_back(TypeContext::nilType()); break;
+                case TypeKind::Struct: types.push_back(ctx.structType(nextString(w))); break;
+                case TypeKind::Ptr: types.push_back(ctx.ptrTo(nextType(w))); break;
+                case TypeKind::Array: types.push_back(ctx.arrayOf(nextType(w))); break;
+                case TypeKind::Fn: {
+                    const Type* ret = nextType(w);
+                    uint32_t n = next(w);
+                    if (n > w.left) corrupt(path, "truncated function type");
+                    params.clear();
+                    for (uint32_t j = 0; j < n; ++j) params.push_back(nextType(w));
+                    types.push_back(ctx.fnType(params, ret));
+                    break;
+                }
+                default: corrupt(path, "unknown type tag");
+            }
+            typeDepths.push_back(recordDepth());
+        }
+        if (w.left != 0) corrupt(path, "type section size mismatch");
+    }
+
+    void loadNodes(Words& w, uint32_t count) {
+        AstArena& arena = prog->arena;
+        TypeContext& ctx = prog->types;
+        if (count > w.left) corrupt(path, "more nodes than the node section holds");
+        nodes.resize(count);
+        used.assign(count, 0);
+        nodeDepths.resize(count);
+        std::vector<Exp*> args;
+        std::vector<Stmt*> statements;
+        for (; nodesBuilt < count; ++nodesBuilt) {
+            uint32_t header = next(w);
+            childDepth = 0;
+            uint8_t op = uint8_t(header >> 8);
+            if (header >> 16 != 0) corrupt(path, "bad node tag");
+            Node* node = nullptr;
+            switch (NodeKind(header & 0xff)) {
+                case NodeKind::Id: node = arena.make<Id>(nextString(w)); break;
+                case NodeKind::Deref: node = arena.make<Deref>(nextNode<Exp>(w)); break;
+                case NodeKind::ArrayAccess: {
+                    Exp* array = nextNode<Exp>(w);
+                    node = arena.make<ArrayAccess>(array, nextNode<Exp>(w));
+                    break;
+                }
+                case NodeKind::FieldAccess: {
+                    Exp* ptr = nextNode<Exp>(w);
+                    node = arena.make<FieldAccess>(ptr, nextString(w));
+                    break;
+                }
+                case NodeKind::Val: node = arena.make<Val>(nextNode<Place>(w)); break;
+                case NodeKind::Num: {
+                    uint64_t lo = next(w);
+                    uint64_t hi = next(w);
+                    node = arena.make<Num>(static_cast<long long>(lo | hi << 32));
+                    break;
+                }
+                case NodeKind::Nil: node = arena.make<NilExp>(); break;
+                case NodeKind::Select: {
+                    Exp* guard = nextNode<Exp>(w);
+                    Exp* tt = nextNode<Exp>(w);
+                    node = arena.make<Select>(guard, tt, nextNode<Exp>(w));
+                    break;
+                }
+                case NodeKind::UnOp:
+                    if (op >= std::size(kUnaryOps)) corrupt(path, "unknown unary operator");
+                    node = arena.make<UnOp>(UnaryOp(op), nextNode<Exp>(w));
+                    break;
+                case NodeKind::BinOp: {
+                    if (op >= std::size(kBinaryOps)) corrupt(path, "unknown binary operator");
+                    Exp* left = nextNode<Exp>(w);
+                    node = arena.make<BinOp>(BinaryOp(op), left, nextNode<Exp>(w));
+                    break;
+                }
+                case NodeKind::NewSingle: {
+                    const Type* type = nextType(w);
+                    node = arena.make<NewSingle>(type, ctx.ptrTo(type));
+                    break;
+                }
+                case NodeKind::NewArray: {
+                    const Type* type = nextType(w);
+                    node = arena.make<NewArray>(type, nextNode<Exp>(w), ctx.arrayOf(type));
+                    break;
+                }
+                case NodeKind::Call: node = arena.make<CallExp>(nextNode<FunCall>(w)); break;
+                case NodeKind::FunCall: {
+                    Exp* callee = nextNode<Exp>(w);
+                    node = arena.make<FunCall>(callee, nextNodeList(w, args));
+                    break;
+                }
+                case NodeKind::Stmts: node = arena.make<Stmts>(nextNodeList(w, statements)); break;
+                case NodeKind::Assign: {
+                    Place* place = nextNode<Place>(w);
+                    node = arena.make<Assign>(place, nextNode<Exp>(w));
+                    break;
+                }
+                case NodeKind::CallStmt: node = arena.make<CallStmt>(nextNode<FunCall>(w)); break;
+                case NodeKind::If: {
+                    Exp* guard = nextNode<Exp>(w);
+                    Stmt* tt = nextNode<Stmt>(w);
+                    node = arena.make<If>(guard, tt, nextOptionalNode<Stmt>(w));
+                    break;
+                }
+                case NodeKind::While: {
+                    Exp* guard = nextNode<Exp>(w);
+                    node = arena.make<While>(guard, nextNode<Stmt>(w));
+                    break;
+                }
+                case NodeKind::Break: node = arena.make<Break>(); break;
+                case NodeKind::Continue: node = arena.make<Continue>(); break;
+                case NodeKind::Return: node = arena.make<Return>(nextOptionalNode<Exp>(w)); break;
+                default: corrupt(path, "unknown node tag");
+            }
+            nodes[nodesBuilt] = node;
+            nodeDepths[nodesBuilt] = recordDepth();
+        }
+        if (w.left != 0) corrupt(path, "node section size mismatch");
+    }
+
+    void loadTop(Words& w) {
+        // Each count is bounded by what is left, so a corrupt one cannot
+        // reserve more than the file could hold
+        uint32_t structCount = next(w);
+        prog->structs.reserve(std::min<size_t>(structCount, w.left));
+        for (uint32_t i = 0; i < structCount; ++i) {
+            StructDef* s = prog->arena.make<StructDef>();
+            s->name = nextString(w);
+            s->fields = nextDecls(w);
+            prog->structs.push_back(s);
+        }
+        uint32_t externCount = next(w);
+        prog->externs.reserve(std::min<size_t>(externCount, w.left));
+        std::vector<const Type*> paramTypes;
+        for (uint32_t i = 0; i < externCount; ++i) {
+            Extern& e = prog->externs.emplace_back();
+            e.name = nextString(w);
+            const Type* rettype = nextType(w);
+            uint32_t params = next(w);
+            if (params > w.left) corrupt(path, "truncated extern");
+            paramTypes.clear();
+            for (uint32_t j = 0; j < params; ++j) paramTypes.push_back(nextType(w));
+            e.type = prog->types.fnType(paramTypes, rettype);
+        }
+        uint32_t functionCount = next(w);
+        prog->functions.reserve(std::min<size_t>(functionCount, w.left));
+        for (uint32_t i = 0; i < functionCount; ++i) {
+            FunctionDef* f = prog->arena.make<FunctionDef>();
+            f->name = nextString(w);
+            f->rettype = nextType(w);
+            f->params = nextDecls(w);
+            f->locals = nextDecls(w);
+            f->signature = signatureOf(prog->types, f->params, f->rettype);
+            std::optional<Stmt*> body = nextOptionalNode<Stmt>(w);
+            f->body = body ? *body : nullptr;
+            prog->functions.push_back(f);
+        }
+        if (w.left != 0) corrupt(path, "top-level section size mismatch");
+    }
+};
+
+} // namespace
+
+void writeProgramBinary(const Program& prog, std::ostream& out) {
+    CFLAT_PROFILE_SCOPE("writeProgramBinary");
+    Writer(prog).write(out);
+}
+
+bool isProgramBinary(const std::string& path) {
+    return path.size() > 5 && path.compare(path.size() - 5, 5, ".astb") == 0;
+}
+
+std::unique_ptr<Program> loadProgramBinary(const std::string& path, size_t maxDepth) {
+    CFLAT_PROFILE_SCOPE("loadProgramBinary");
+    InputFile file;
+    if (!file.open(path)) throw std::runtime_error("Could not open file " + path);
+    file.read();
+    if (file.size() == 0) corrupt(path, "is empty");
+    return Loader(path, file.data(), file.size(), maxDepth).load();
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Correctness runner: checks every .astj under the corpus with the checker
+# binary in --batch mode, once per way of building and checking, and
+# compares each file's verdict with its .soln. Files listed in
+# bench/known_mismatches.tsv are held to their recorded verdict instead
+# (see bench/corpus.cpp).
+#
+# Usage: bench/check.sh [binary] [corpus-dir]
+
+BIN=${1:-./type-release}
+ROOT=${2:-assign-2-tests}
+KNOWN=bench/known_mismatches.tsv
+
+status=0
+for mode in "" "--sax" "--first-error" "--stream" "--flat" "--jobs 4" "--sax --jobs 4"; do
+    # $mode is split into words on purpose
+    # shellcheck disable=SC2086
+    "$BIN" --batch $mode "$ROOT" | awk -v root="$ROOT/" -v known="$KNOWN" -v mode="${mode:-dom}" '
+        BEGIN {
+            FS = "\t"
+            while ((getline line < known) > 0) {
+                split(line, kv, "\t")
+                recorded[kv[1]] = substr(line, length(kv[1]) + 2)
+            }
+            FS = " "
+        }
+        /^checked [0-9]+ files: / { summary = $0; next }
+        {
+            split_at = index($0, ": ")
+            path = substr($0, 1, split_at - 1)
+            verdict = substr($0, split_at + 2)
+            rel = substr(path, length(root) + 1)
+            if (rel in recorded) {
+                expected = recorded[rel]
+            } else {
+                soln = path
+                sub(/\.astj$/, ".soln", soln)
+                expected = ""
+                getline expected < soln
+                close(soln)
+                sub(/\r$/, "", expected)
+            }
+            ++files
+            if (verdict != expected && ++mismatches <= 10) {
+                printf "MISMATCH (%s) %s\n  got:      %s\n  expected: %s\n", mode, path, verdict, expected > "/dev/stderr"
+            }
+        }
+        END {
+            if (files == 0) { printf "FAIL (%s): no results\n", mode; exit 1 }
+            if (mismatches) { printf "FAIL (%s): %d of %d result(s) differ\n", mode, mismatches, files; exit 1 }
+            printf "OK (%s): %s\n", mode, summary
+        }' || status=1
+done
+exit $status
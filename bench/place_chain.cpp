@@ -0,0 +1,85 @@
+// Regression benchmark: AST construction over deeply nested place chains.
+//
+// Builds Deref, ArrayAccess and FieldAccess chains of increasing depth
+// with buildExp and reports the time per nesting level. Construction must
+// stay linear in depth; the run fails if doubling the depth costs more
+// than MAX_DOUBLING_RATIO times as much.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include "ast.hpp"
+
+using json = nlohmann::json;
+
+static const double MAX_DOUBLING_RATIO = 3.0;
+
+// d levels of {"Deref": ...} around a variable
+static json derefChain(int depth) {
+    json e = {{"Id", "x"}};
+    for (int i = 0; i < depth; ++i) e = json{{"Deref", std::move(e)}};
+    return e;
+}
+
+// d levels of x[0][0]...
+static json arrayChain(int depth) {
+    json e = {{"Id", "x"}};
+    for (int i = 0; i < depth; ++i) {
+        e = json{{"ArrayAccess", {{"array", std::move(e)}, {"idx", {{"Num", 0}}}}}};
+    }
+    return e;
+}
+
+// d levels of x.f.f...
+static json fieldChain(int depth) {
+    json e = {{"Id", "x"}};
+    for (int i = 0; i < depth; ++i) {
+        e = json{{"FieldAccess", {{"ptr", std::move(e)}, {"field", "f"}}}};
+    }
+    return e;
+}
+
+// Best-of-N wall time of buildExp on j, in seconds
+static double timeBuild(const json& j) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        Program prog;
+        auto start = std::chrono::steady_clock::now();
+        buildExp(j, prog);
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    int maxDepth = argc > 1 ? std::atoi(argv[1]) : 4000;
+    struct Chain { const char* name; std::function<json(int)> make; };
+    const Chain chains[] = {
+        {"Deref", derefChain},
+        {"ArrayAccess", arrayChain},
+        {"FieldAccess", fieldChain},
+    };
+
+    bool ok = true;
+    std::printf("%-12s %8s %12s %12s %8s\n", "chain", "depth", "total(ms)", "ns/level", "ratio");
+    for (const auto& chain : chains) {
+        double prev = 0;
+        for (int depth = maxDepth / 8; depth <= maxDepth; depth *= 2) {
+            json j = chain.make(depth);
+            double t = timeBuild(j);
+            double ratio = prev > 0 ? t / prev : 0;
+            std::printf("%-12s %8d %12.3f %12.1f %8.2f\n", chain.name, depth, t * 1e3, t * 1e9 / depth, ratio);
+            if (prev > 0 && ratio > MAX_DOUBLING_RATIO) ok = false;
+            prev = t;
+        }
+    }
+    if (!ok) {
+        std::printf("FAIL: construction time grows faster than linearly in nesting depth\n");
+        return 1;
+    }
+    std::printf("OK: construction is linear in nesting depth\n");
+    return 0;
+}
@@ -0,0 +1,315 @@
+// Scaling regression suite and differential fuzzer over synthetic programs.
+//
+// Generates well-typed Cflat programs in memory from four size knobs:
+// the number of functions, the depth of each assigned expression, the
+// number of structs and the number of int locals per function. Each knob
+// is swept by doubling while the others stay at their base values, and
+// the best-of-N times of buildProgram and Program::check are reported per
+// step. Both phases must stay linear in every knob; the run fails if the
+// median cost of doubling one is more than MAX_DOUBLING_RATIO, which is
+// what a quadratic Gamma copy or a re-copied place chain looks like. The
+// median rides out the single step where a program outgrows the cache.
+//
+// The smallest program of each sweep, plus --fuzz N random small ones, is
+// also checked
+// differentially: once valid and once with a single ill-typed leaf
+// planted at a random spot, the DOM builder, the SAX builder, the parallel
+// SAX builder and the flat engine must all report the same verdict, and
+// the same recorded types; the streaming check, the same verdict.
+//
+// Usage: scaling [--fuzz N] [--seed S] [--tsv FILE]
+//        scaling --emit FUNCTIONS DEPTH STRUCTS LOCALS [SEED]
+// --tsv also writes the curves as axis, size, bytes, build and check
+// seconds per row. --emit prints one generated program, for reproducing a
+// failure with ./type.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ast.hpp"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+static const double MAX_DOUBLING_RATIO = 3.0;
+
+struct Shape {
+    int functions = 8, depth = 16, structs = 8, locals = 8;
+};
+
+// Builds one program of a given shape. Struct S<i> has an int f0 and a
+// pointer `next` to S<i+1>; function f<k> takes an int, points its local p
+// at a fresh S<k % structs>, assigns each local v<i> an arithmetic
+// expression `depth` operators deep over a, p.f0, p.next.f0, earlier
+// locals and literals, calls f<k-1>, and returns its last local.
+class Generator {
+public:
+    Generator(const Shape& shape, unsigned seed) : shape(shape), rng(seed) {}
+
+    // With `poison`, one leaf of one expression is a &int instead
+    json program(bool poison) {
+        poisonFunction = poisonStmt = poisonLeaf = -1;
+        if (poison) {
+            poisonFunction = pick(shape.functions);
+            poisonStmt = pick(std::max(shape.locals, 1));
+            poisonLeaf = pick(shape.depth + 1);
+        }
+        json structs = json::array();
+        for (int i = 0; i < shape.structs; ++i) {
+            structs.push_back({{"name", structName(i)},
+                               {"fields", {{{"name", "f0"}, {"typ", "Int"}},
+                                           {{"name", "next"}, {"typ", ptrTo(structName((i + 1) % shape.structs))}}}}});
+        }
+        json functions = json::array();
+        for (int k = 0; k < shape.functions; ++k) functions.push_back(function(k));
+        functions.push_back({{"name", "main"}, {"prms", json::array()}, {"rettyp", "Int"}, {"locals", json::array()},
+                             {"stmts", {{{"Return", call("f" + std::to_string(shape.functions - 1), {{"Num", 0}})}}}}});
+        return {{"structs", std::move(structs)}, {"externs", json::array()}, {"functions", std::move(functions)}};
+    }
+
+private:
+    Shape shape;
+    std::mt19937 rng;
+    int poisonFunction, poisonStmt, poisonLeaf;
+
+    int pick(int n) { return std::uniform_int_distribution<int>(0, n - 1)(rng); }
+    static std::string structName(int i) { return "S" + std::to_string(i); }
+    static json ptrTo(const std::string& name) { return {{"Ptr", {{"Struct", name}}}}; }
+    static json id(const std::string& name) { return {{"Val", {{"Id", name}}}}; }
+    static json field(json ptr, const char* name) {
+        return {{"Val", {{"FieldAccess", {{"ptr", std::move(ptr)}, {"field", name}}}}}};
+    }
+    static json call(const std::string& callee, json arg) {
+        return {{"Call", {{"callee", id(callee)}, {"args", {std::move(arg)}}}}};
+    }
+
+    json leaf(int local, bool poisoned) {
+        if (poisoned) return {{"NewSingle", "Int"}};
+        switch (pick(shape.structs ? 5 : 3)) {
+            case 0: return id("a");
+            case 1: return local ? id("v" + std::to_string(pick(local))) : id("a");
+            case 2: return {{"Num", pick(1000)}};
+            case 3: return field(id("p"), "f0");
+            default: return field(field(id("p"), "next"), "f0");
+        }
+    }
+
+    // A left-leaning chain of `depth` operators, so nesting depth is `depth`
+    json expression(int local, bool poisoned) {
+        static const char* const ops[] = {"Add", "Sub", "Mul", "Div"};
+        json e = leaf(local, poisoned && poisonLeaf == 0);
+        for (int d = 1; d <= shape.depth; ++d) {
+            e = {{"BinOp", {{"op", ops[pick(4)]}, {"left", std::move(e)},
+                            {"right", leaf(local, poisoned && poisonLeaf == d)}}}};
+        }
+        return e;
+    }
+
+    json function(int k) {
+        json locals = json::array();
+        json stmts = json::array();
+        if (shape.structs) {
+            std::string s = structName(k % shape.structs);
+            locals.push_back({{"name", "p"}, {"typ", ptrTo(s)}});
+            stmts.push_back({{"Assign", {{{"Id", "p"}}, {{"NewSingle", {{"Struct", s}}}}}}});
+        }
+        for (int i = 0; i < shape.locals; ++i) {
+            std::string v = "v" + std::to_string(i);
+            locals.push_back({{"name", v}, {"typ", "Int"}});
+            stmts.push_back({{"Assign", {{{"Id", v}}, expression(i, k == poisonFunction && i == poisonStmt)}}});
+        }
+        std::string last = shape.locals ? "v" + std::to_string(shape.locals - 1) : "a";
+        if (k > 0) stmts.push_back({{"Assign", {{{"Id", last}}, call("f" + std::to_string(k - 1), id(last))}}});
+        // With no locals to hold it, the poisoned leaf is returned directly
+        if (shape.locals == 0 && k == poisonFunction) stmts.push_back({{"Return", {{"NewSingle", "Int"}}}});
+        stmts.push_back({{"Return", id(last)}});
+        return {{"name", "f" + std::to_string(k)}, {"prms", {{{"name", "a"}, {"typ", "Int"}}}}, {"rettyp", "Int"},
+                {"locals", std::move(locals)}, {"stmts", std::move(stmts)}};
+    }
+};
+
+// Everything one way of checking `text` reports: the verdict, and the
+// type listing when valid
+static std::string report(const std::string& text, bool useSax, bool flat, unsigned buildJobs = 1) {
+    std::ostringstream out;
+    // A TypeError renders lazily from the AST, so the program outlives it
+    std::unique_ptr<Program> program;
+    try {
+        if (useSax && buildJobs > 1) {
+            program = buildProgramParallel(text.data(), text.data() + text.size(), buildJobs);
+        } else if (useSax) {
+            std::istringstream in(text);
+            program = buildProgramSax(in);
+        } else {
+            program = buildProgram(json::parse(text));
+        }
+        program->check(1, nullptr, nullptr, nullptr, flat);
+        out << "valid\n";
+        program->printTypes(out);
+    } catch (const TypeError& e) {
+        out << "invalid: " << e.what() << "\n";
+    } catch (const std::exception& e) {
+        out << "error: " << e.what() << "\n";
+    }
+    return out.str();
+}
+
+// The verdict of the streaming check, which frees the bodies it checks
+// and so has no types to list
+static std::string streamed(const std::string& text) {
+    std::unique_ptr<Program> program;
+    try {
+        checkProgramStreaming(text.data(), text.data() + text.size(), program);
+        return "valid\n";
+    } catch (const TypeError& e) {
+        return std::string("invalid: ") + e.what() + "\n";
+    } catch (const std::exception& e) {
+        return std::string("error: ") + e.what() + "\n";
+    }
+}
+
+// The tree walk over the DOM is the reference; SAX and flat must match it,
+// and the program must be valid exactly when it was not poisoned
+static bool agree(const Shape& shape, unsigned seed, bool poison) {
+    std::string text = Generator(shape, seed).program(poison).dump();
+    std::string walked = report(text, false, false);
+    const char* failure = nullptr;
+    if ((walked.rfind("valid\n", 0) == 0) == poison) failure = "unexpected verdict";
+    else if (report(text, true, false) != walked) failure = "SAX builder differs";
+    else if (report(text, true, false, 3) != walked) failure = "parallel SAX builder differs";
+    else if (report(text, false, true) != walked) failure = "flat engine differs";
+    else if (streamed(text) != (poison ? walked : "valid\n")) failure = "streaming check differs";
+    if (!failure) return true;
+    std::fprintf(stderr, "%s for --emit %d %d %d %d %u%s\n  tree walk: %.200s\n", failure, shape.functions,
+                 shape.depth, shape.structs, shape.locals, seed, poison ? " (poisoned)" : "", walked.c_str());
+    return false;
+}
+
+// Best-of-N build and check times of `text`, in seconds
+static void timePhases(const std::string& text, double& build, double& check) {
+    json j = json::parse(text);
+    build = check = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = Clock::now();
+        auto program = buildProgram(j);
+        auto t1 = Clock::now();
+        program->check();
+        auto t2 = Clock::now();
+        build = std::min(build, std::chrono::duration<double>(t1 - t0).count());
+        check = std::min(check, std::chrono::duration<double>(t2 - t1).count());
+    }
+}
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n ? (v[(n - 1) / 2] + v[n / 2]) / 2 : 0;
+}
+
+int main(int argc, char** argv) {
+    int fuzz = 200;
+    unsigned seed = 1;
+    std::string tsvPath;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--fuzz" && i + 1 < argc) fuzz = std::atoi(argv[++i]);
+        else if (arg == "--seed" && i + 1 < argc) seed = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--tsv" && i + 1 < argc) tsvPath = argv[++i];
+        else if (arg == "--emit" && i + 4 < argc) {
+            Shape shape;
+            shape.functions = std::atoi(argv[i + 1]);
+            shape.depth = std::atoi(argv[i + 2]);
+            shape.structs = std::atoi(argv[i + 3]);
+            shape.locals = std::atoi(argv[i + 4]);
+            unsigned emitSeed = i + 5 < argc ? std::strtoul(argv[i + 5], nullptr, 10) : seed;
+            std::printf("%s\n", Generator(shape, emitSeed).program(false).dump().c_str());
+            return 0;
+        } else {
+            std::fprintf(stderr, "Usage: %s [--fuzz N] [--seed S] [--tsv FILE]\n"
+                                 "       %s --emit FUNCTIONS DEPTH STRUCTS LOCALS [SEED]\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    struct Axis { const char* name; int Shape::*knob; int first, last; };
+    const Axis axes[] = {
+        {"functions", &Shape::functions, 64, 1024},
+        {"depth", &Shape::depth, 128, 2048},
+        {"structs", &Shape::structs, 1024, 16384},
+        {"locals", &Shape::locals, 64, 1024},
+    };
+
+    std::ofstream tsv;
+    if (!tsvPath.empty()) {
+        tsv.open(tsvPath);
+        tsv << "axis\tsize\tbytes\tbuild_s\tcheck_s\n";
+    }
+    bool ok = true;
+    size_t disagreements = 0;
+    std::printf("%-10s %6s %9s %10s %10s %9s %9s %7s %7s\n", "axis", "size", "KB", "build(ms)", "check(ms)",
+                "build MB/s", "check MB/s", "build x", "check x");
+    for (const auto& axis : axes) {
+        double prevBuild = 0, prevCheck = 0;
+        std::vector<double> buildRatios, checkRatios;
+        for (int size = axis.first; size <= axis.last; size *= 2) {
+            Shape shape;
+            shape.*axis.knob = size;
+            std::string text = Generator(shape, seed).program(false).dump();
+            double build, check;
+            timePhases(text, build, check);
+            double buildRatio = prevBuild > 0 ? build / prevBuild : 0;
+            double checkRatio = prevCheck > 0 ? check / prevCheck : 0;
+            std::printf("%-10s %6d %9.0f %10.3f %10.3f %9.1f %9.1f %7.2f %7.2f\n", axis.name, size,
+                        text.size() / 1024.0, build * 1e3, check * 1e3, text.size() / build / 1e6,
+                        text.size() / check / 1e6, buildRatio, checkRatio);
+            if (tsv.is_open()) {
+                tsv << axis.name << '\t' << size << '\t' << text.size() << '\t' << build << '\t' << check << '\n';
+            }
+            if (prevBuild > 0) {
+                buildRatios.push_back(buildRatio);
+                checkRatios.push_back(checkRatio);
+            } else {
+                for (bool poison : {false, true}) disagreements += !agree(shape, seed, poison);
+            }
+            prevBuild = build;
+            prevCheck = check;
+        }
+        if (median(buildRatios) > MAX_DOUBLING_RATIO || median(checkRatios) > MAX_DOUBLING_RATIO) {
+            std::printf("%-10s grows faster than linearly\n", axis.name);
+            ok = false;
+        }
+    }
+
+    // Small random shapes reach the corners the sweeps do not: no structs,
+    // no locals, a single function, expressions a few levels deep
+    std::mt19937 rng(seed);
+    auto upTo = [&](int n) { return std::uniform_int_distribution<int>(0, n)(rng); };
+    for (int i = 0; i < fuzz; ++i) {
+        Shape shape;
+        shape.functions = 1 + upTo(7);
+        shape.depth = upTo(80);
+        shape.structs = upTo(4);
+        shape.locals = upTo(6);
+        unsigned programSeed = rng();
+        for (bool poison : {false, true}) disagreements += !agree(shape, programSeed, poison);
+    }
+
+    if (disagreements) {
+        std::printf("FAIL: %zu generated program(s) checked differently by DOM, SAX, parallel SAX or flat\n",
+                    disagreements);
+        return 1;
+    }
+    if (!ok) {
+        std::printf("FAIL: build or check time grows faster than linearly in program size\n");
+        return 1;
+    }
+    std::printf("OK: build and check are linear in every size knob; every builder and engine agrees on %d fuzzed "
+                "programs\n", 2 * fuzz);
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Microbenchmark: typeEq over randomly generated deep types.
+//
+// "rtti" replays the original comparison: every type is a fresh tree, so
+// structurally equal types are distinct objects and eq walks both sides with
+// dynamic_cast at each level. "kind" is the same walk on Type::equals, which
+// now switches on the kind tag. "typeEq" is the checker's path: interned
+// types compared by pointer. All three must agree on every pair.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "ast.hpp"
+
+// The pre-kind-tag eq(τ₁, τ₂), kept here as the baseline
+static bool rttiEquals(const Type* t1, const Type* t2) {
+    if (dynamic_cast<const IntType*>(t1)) return dynamic_cast<const IntType*>(t2) != nullptr;
+    if (const auto* s1 = dynamic_cast<const StructType*>(t1)) {
+        const auto* s2 = dynamic_cast<const StructType*>(t2);
+        return s2 && s1->name.str() == s2->name.str();
+    }
+    if (const auto* p1 = dynamic_cast<const PtrType*>(t1)) {
+        const auto* p2 = dynamic_cast<const PtrType*>(t2);
+        return p2 && rttiEquals(p1->pointeeType, p2->pointeeType);
+    }
+    if (const auto* a1 = dynamic_cast<const ArrayType*>(t1)) {
+        const auto* a2 = dynamic_cast<const ArrayType*>(t2);
+        return a2 && rttiEquals(a1->elementType, a2->elementType);
+    }
+    if (const auto* f1 = dynamic_cast<const FnType*>(t1)) {
+        const auto* f2 = dynamic_cast<const FnType*>(t2);
+        if (!f2 || f1->paramTypes.size() != f2->paramTypes.size()) return false;
+        for (size_t i = 0; i < f1->paramTypes.size(); ++i) {
+            if (!rttiEquals(f1->paramTypes[i], f2->paramTypes[i])) return false;
+        }
+        return rttiEquals(f1->returnType, f2->returnType);
+    }
+    return false;
+}
+
+static bool rttiTypeEq(const Type* t1, const Type* t2) {
+    if (dynamic_cast<const NilType*>(t1)) {
+        return dynamic_cast<const NilType*>(t2) || dynamic_cast<const PtrType*>(t2) ||
+               dynamic_cast<const ArrayType*>(t2);
+    }
+    if (dynamic_cast<const NilType*>(t2)) {
+        return dynamic_cast<const PtrType*>(t1) || dynamic_cast<const ArrayType*>(t1);
+    }
+    return rttiEquals(t1, t2);
+}
+
+static bool kindTypeEq(const Type* t1, const Type* t2) {
+    if (t1->kind == TypeKind::Nil || t2->kind == TypeKind::Nil) return typeEq(t1, t2);
+    return t1->equals(*t2);
+}
+
+// Random type of the given depth; the same seed yields the same structure.
+// nil only ever appears at the top level, as it does in the checker.
+static const Type* randomType(std::mt19937& rng, int depth, TypeContext& types) {
+    if (depth == 0) {
+        if (rng() % 2) return TypeContext::intType();
+        return types.structType(types.symbols.intern("s" + std::to_string(rng() % 4)));
+    }
+    switch (rng() % 4) {
+        case 0: return types.ptrTo(randomType(rng, depth - 1, types));
+        case 1: return types.arrayOf(randomType(rng, depth - 1, types));
+        case 2: {
+            std::vector<const Type*> params;
+            size_t n = rng() % 3;
+            for (size_t i = 0; i < n; ++i) params.push_back(randomType(rng, depth / 4, types));
+            return types.fnType(params, randomType(rng, depth - 1, types));
+        }
+        default: return types.ptrTo(types.arrayOf(randomType(rng, depth - 1, types)));
+    }
+}
+
+template <typename Eq>
+static double nsPerCompare(const std::vector<const Type*>& lhs, const std::vector<const Type*>& rhs,
+                           Eq eq, int reps, size_t& trues) {
+    auto start = std::chrono::steady_clock::now();
+    trues = 0;
+    for (int r = 0; r < reps; ++r) {
+        for (size_t i = 0; i < lhs.size(); ++i) trues += eq(lhs[i], rhs[i]);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double(reps) * lhs.size());
+}
+
+int main(int argc, char** argv) {
+    int maxDepth = argc > 1 ? std::atoi(argv[1]) : 64;
+    const size_t count = 2000;
+    const int reps = 20;
+
+    std::printf("%8s %12s %12s %12s %10s\n", "depth", "rtti(ns)", "kind(ns)", "typeEq(ns)", "equal");
+    for (int depth = 4; depth <= maxDepth; depth *= 2) {
+        // 'a' and 'b' are separate universes built from the same seeds, so
+        // a[i] and b[i] are structurally equal but never the same object (except
+        // where a[i] is nil, to cover the nil rules).
+        // 'c' pairs with 'a' from a shifted seed, mostly unequal.
+        // Struct names are interned up front so their ids agree across universes.
+        TypeContext ctxA, ctxB;
+        for (int s = 0; s < 4; ++s) {
+            ctxA.symbols.intern("s" + std::to_string(s));
+            ctxB.symbols.intern("s" + std::to_string(s));
+        }
+        std::vector<const Type*> a, b, aSame, c;
+        for (size_t i = 0; i < count; ++i) {
+            size_t other = i % 3 == 0 ? i : (i + 1) % count;
+            std::mt19937 ra(i), rb(i), rs(i), rc(other);
+            a.push_back(i % 16 == 5 ? TypeContext::nilType() : randomType(ra, depth, ctxA));
+            b.push_back(randomType(rb, depth, ctxB));
+            aSame.push_back(randomType(rs, depth, ctxA));
+            c.push_back(randomType(rc, depth, ctxA));
+        }
+        std::vector<const Type*> lhs, rhsFresh, rhsInterned;
+        for (size_t i = 0; i < count; ++i) {
+            lhs.push_back(a[i]); rhsFresh.push_back(b[i]); rhsInterned.push_back(aSame[i]);
+            lhs.push_back(a[i]); rhsFresh.push_back(c[i]); rhsInterned.push_back(c[i]);
+        }
+
+        size_t rttiTrue, kindTrue, eqTrue;
+        double tRtti = nsPerCompare(lhs, rhsFresh, rttiTypeEq, reps, rttiTrue);
+        double tKind = nsPerCompare(lhs, rhsFresh, kindTypeEq, reps, kindTrue);
+        double tEq = nsPerCompare(lhs, rhsInterned, typeEq, reps, eqTrue);
+        for (size_t i = 0; i < lhs.size(); ++i) {
+            bool expected = rttiTypeEq(lhs[i], rhsFresh[i]);
+            if (kindTypeEq(lhs[i], rhsFresh[i]) != expected || typeEq(lhs[i], rhsInterned[i]) != expected) {
+                std::printf("FAIL: comparisons disagree at depth %d, pair %zu\n", depth, i);
+                return 1;
+            }
+        }
+        std::printf("%8d %12.1f %12.1f %12.1f %10zu\n", depth, tRtti, tKind, tEq, eqTrue / reps);
+    }
+    std::printf("OK: all comparisons agree\n");
+    return 0;
+}
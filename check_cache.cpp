@@ -0,0 +1,216 @@
+#include "ast.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+// Incremental Checking
+//
+// Checking a function reads nothing but its own definition, the global
+// bindings in Γ of the names it uses that are not its params or locals,
+// and the structs in Δ reachable from the types it can see: its
+// declarations, those globals, `new` expressions, and transitively the
+// fields of every struct reached. checkKey hashes exactly that, so a
+// function whose key passed before passes again, and changing any extern,
+// function signature or struct it depends on changes its key.
+//
+// The cache file is a header line followed by one key per line in hex,
+// most recently used first, keeping at most kMaxCacheEntries.
+
+namespace {
+
+constexpr const char* kCacheHeader = "cflat-check-cache 1";
+constexpr size_t kMaxCacheEntries = size_t(1) << 16;
+constexpr uint64_t kAbsent = ~uint64_t(0); // unbound name, undefined struct, missing body
+
+// Mixes 64-bit words into a running hash, one multiply and shift each.
+// Strings are reduced to a word with FNV-1a first; the builder below does
+// that once per symbol, not once per use.
+class KeyHasher {
+public:
+    void word(uint64_t v) {
+        h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+    }
+    static uint64_t textHash(const std::string& s) {
+        uint64_t t = 0xcbf29ce484222325ull;
+        for (unsigned char c : s) t = (t ^ c) * 0x100000001b3ull;
+        return t ^ s.size();
+    }
+    uint64_t value() const { return h; }
+
+private:
+    uint64_t h = 0x243f6a8885a308d3ull;
+};
+
+class KeyBuilder {
+public:
+    KeyBuilder(const Gamma& globals, const SymbolMap<const StructDef*>& structs) : globals(globals), structs(structs) {}
+
+    uint64_t key(const FunctionDef& f) {
+        text(f.name);
+        type(f.rettype);
+        decls(f.params, true);
+        decls(f.locals, true);
+        if (f.body) {
+            body(f.body);
+        } else {
+            hash.word(kAbsent);
+        }
+        // The globals first, so the structs their signatures use are reached too
+        hash.word(usedGlobals.size());
+        for (Symbol name : usedGlobals) {
+            text(name);
+            type(globals.lookup(name));
+        }
+        for (size_t i = 0; i < reached.size(); ++i) {
+            text(reached[i]);
+            const StructDef* const* def = structs.find(reached[i]);
+            if (def) {
+                decls((*def)->fields, false);
+            } else {
+                hash.word(kAbsent);
+            }
+        }
+        return hash.value();
+    }
+
+private:
+    const Gamma& globals;
+    const SymbolMap<const StructDef*>& structs;
+    KeyHasher hash;
+    SymbolMap<bool> locals, seenGlobals, seenStructs;
+    std::vector<Symbol> usedGlobals, reached;
+    // textHash of each symbol seen so far, by id (0: not hashed yet)
+    std::vector<uint64_t> symbolHashes;
+
+    void text(Symbol s) {
+        if (s.id >= symbolHashes.size()) symbolHashes.resize(s.id + 1, 0);
+        uint64_t& t = symbolHashes[s.id];
+        if (t == 0) t = KeyHasher::textHash(s.str()) | 1;
+        hash.word(t);
+    }
+
+    // Types nest only as deep as the builders and the .astb loader allow
+    // (--max-depth), so plain recursion is fine
+    void type(const Type* t) {
+        if (!t) {
+            hash.word(kAbsent);
+            return;
+        }
+        hash.word(uint64_t(t->kind));
+        if (const StructType* st = dyn_cast<StructType>(t)) {
+            text(st->name);
+            if (seenStructs.insert(st->name, true)) reached.push_back(st->name);
+        } else if (const PtrType* pt = dyn_cast<PtrType>(t)) {
+            type(pt->pointeeType);
+        } else if (const ArrayType* at = dyn_cast<ArrayType>(t)) {
+            type(at->elementType);
+        } else if (const FnType* ft = dyn_cast<FnType>(t)) {
+            hash.word(ft->paramTypes.size());
+            for (const Type* p : ft->paramTypes) type(p);
+            type(ft->returnType);
+        }
+    }
+
+    void decls(const NodeList<Decl>& list, bool bind) {
+        hash.word(list.size());
+        for (const Decl& d : list) {
+            text(d.name);
+            type(d.type);
+            if (bind) locals[d.name] = true;
+        }
+    }
+
+    // Pre-order over the body, without recursing. Every node contributes
+    // its kind, its own fields and its number of children, which keeps
+    // the encoding unambiguous.
+    void body(const Stmt* root) {
+        std::vector<const Node*> pending{root};
+        std::vector<const Node*> kids;
+        while (!pending.empty()) {
+            const Node* node = pending.back();
+            pending.pop_back();
+            hash.word(uint64_t(node->kind));
+            switch (node->kind) {
+                case NodeKind::Id: {
+                    Symbol name = cast<Id>(node)->name;
+                    text(name);
+                    if (!locals.contains(name) && seenGlobals.insert(name, true)) usedGlobals.push_back(name);
+                    break;
+                }
+                case NodeKind::FieldAccess: text(cast<FieldAccess>(node)->field); break;
+                case NodeKind::Num: hash.word(uint64_t(cast<Num>(node)->value)); break;
+                case NodeKind::UnOp: hash.word(uint64_t(cast<UnOp>(node)->op)); break;
+                case NodeKind::BinOp: hash.word(uint64_t(cast<BinOp>(node)->op)); break;
+                case NodeKind::NewSingle: type(cast<NewSingle>(node)->type); break;
+                case NodeKind::NewArray: type(cast<NewArray>(node)->type); break;
+                default: break;
+            }
+            childrenOf(node, kids);
+            hash.word(kids.size());
+            for (size_t i = kids.size(); i-- > 0;) pending.push_back(kids[i]);
+        }
+    }
+};
+
+} // namespace
+
+uint64_t checkKey(const FunctionDef& f, const Gamma& globals, const SymbolMap<const StructDef*>& structs) {
+    return KeyBuilder(globals, structs).key(f);
+}
+
+CheckCache::CheckCache(std::string path) : path(std::move(path)) {
+    std::ifstream in(this->path);
+    std::string line;
+    if (!std::getline(in, line) || line != kCacheHeader) return;
+    while (std::getline(in, line) && loaded.size() < kMaxCacheEntries) {
+        if (line.size() != 16 || line.find_first_not_of("0123456789abcdef") != std::string::npos) continue;
+        uint64_t key = std::stoull(line, nullptr, 16);
+        if (keys.emplace(key, false).second) loaded.push_back(key);
+    }
+}
+
+bool CheckCache::contains(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = keys.find(key);
+    if (it == keys.end()) {
+        ++missCount;
+        return false;
+    }
+    ++hitCount;
+    it->second = true;
+    return true;
+}
+
+void CheckCache::insert(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    keys[key] = true;
+}
+
+bool CheckCache::save() const {
+    if (path.empty()) return true;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream text;
+    text << kCacheHeader << "\n";
+    size_t written = 0;
+    auto put = [&](uint64_t key) {
+        char digits[17];
+        std::snprintf(digits, sizeof digits, "%016llx", static_cast<unsigned long long>(key));
+        text << digits << "\n";
+        ++written;
+    };
+    for (const auto& [key, used] : keys) {
+        if (used && written < kMaxCacheEntries) put(key);
+    }
+    for (uint64_t key : loaded) {
+        if (!keys.at(key) && written < kMaxCacheEntries) put(key);
+    }
+    // Replaced in one rename, so a concurrent run never reads half a file
+    std::string temp = path + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        out << text.str();
+        if (!out.flush()) return false;
+    }
+    return std::rename(temp.c_str(), path.c_str()) == 0;
+}
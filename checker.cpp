@@ -0,0 +1,459 @@
+#include "ast.hpp"
+
+// Iterative Checker
+//
+// Types expressions and checks statements with an explicit worklist
+// instead of unbounded recursion on the C++ stack, so however deep the AST
+// is, the depth costs heap rather than stack. The typing rules themselves are
+// the applyRule / checkGuard / ... members in ast.cpp; this file only decides
+// when each one runs. Every node is visited in post-order and in exactly the
+// order the recursive rules were written, so the first TypeError thrown is
+// the same one the recursive checker would have hit. While collecting
+// errors (see Diagnostics) a rule that fails yields the error type instead
+// of throwing, and the walk carries on as if it had passed.
+//
+// A Task is one visit of a node. `stage` says how many of its children have
+// been checked; the results of checked children are on the `types` (for
+// expressions and places) or `returns` (for statements) stacks, and a node's
+// own result replaces them when its last stage runs. A trip through the
+// worklist costs more than a call, and most expressions are small, so those
+// are typed by bounded recursion instead (typeInline) and simple statements
+// checked in place (checkInline); only compound statements and large
+// expressions are scheduled.
+
+namespace {
+
+// Most nodes typeInline visits before it gives up and schedules the expression
+constexpr unsigned kInlineBudget = 64;
+
+struct Task {
+    const Node* node;
+    uint32_t stage;
+    bool inLoop;                        // statements only
+    const FnType* funcType = nullptr;   // FunCall only, set once the callee is typed
+};
+
+// Reused across checks on the same thread, so a function body costs no allocations
+struct Worklist {
+    std::vector<Task> tasks;
+    std::vector<const Type*> types;
+    std::vector<uint8_t> returns;
+};
+thread_local Worklist threadWorklist;
+
+class CheckEngine {
+public:
+    CheckEngine(const Gamma& gamma, const Delta& delta, const Type* returnType)
+        : gamma(gamma), delta(delta), returnType(returnType), tasks(threadWorklist.tasks),
+          types(threadWorklist.types), returns(threadWorklist.returns) {
+        tasks.clear();
+        types.clear();
+        returns.clear();
+    }
+
+    const Type* typeOf(const Node* root) {
+        tasks.push_back({root, 0, false});
+        run();
+        return types.back();
+    }
+
+    bool returnsOf(const Stmt* root, bool inLoop) {
+        tasks.push_back({root, 0, inLoop});
+        run();
+        return returns.back();
+    }
+
+private:
+    const Gamma& gamma;
+    const Delta& delta;
+    const Type* returnType;
+    std::vector<Task>& tasks;
+    std::vector<const Type*>& types;
+    std::vector<uint8_t>& returns;
+
+    const Type* popType() {
+        const Type* t = types.back();
+        types.pop_back();
+        return t;
+    }
+    bool popReturns() {
+        bool r = returns.back();
+        returns.pop_back();
+        return r;
+    }
+
+    // Records `type` as the checked type of an expression or place; a
+    // FunCall's type is recorded on the CallExp around it instead. A check
+    // that failed under Diagnostics leaves it unrecorded, as typeOf promises.
+    static const Type* record(const Node* node, const Type* type) {
+        if (const TypedNode* typed = dyn_cast<TypedNode>(node)) {
+            typed->checkedType = type == TypeContext::errorType() ? nullptr : type;
+        }
+        return type;
+    }
+
+    // typeInline for the root of an expression or place; one typed by an
+    // earlier check isn't typed again, since its whole subtree passed
+    const Type* typeRoot(const Node* node, unsigned& budget) {
+        if (const TypedNode* typed = dyn_cast<TypedNode>(node)) {
+            if (typed->checkedType) return typed->checkedType;
+        }
+        return typeInline(node, budget);
+    }
+
+    // Types a small expression or place by plain recursion, spending one
+    // unit of `budget` per node, so the native stack stays bounded. Returns
+    // nullptr once the budget runs out, and the caller schedules the
+    // expression instead; the rules are pure, so the abandoned prefix is just
+    // redone. Rules run in the same order either way, so an error thrown
+    // here is the one the worklist would throw.
+    const Type* typeInline(const Node* node, unsigned& budget) {
+        if (budget == 0) return nullptr;
+        --budget;
+        CFLAT_PROFILE_NODE(node->kind);
+        const Type* type = applyInline(node, budget);
+        return type ? record(node, type) : nullptr;
+    }
+
+    // The rule for `node`, with its children typed by typeInline
+    const Type* applyInline(const Node* node, unsigned& budget) {
+        switch (node->kind) {
+            case NodeKind::Id: return cast<Id>(node)->applyRule(gamma);
+            case NodeKind::Deref: {
+                const Deref* deref = cast<Deref>(node);
+                const Type* expType = typeInline(deref->exp, budget);
+                return expType ? deref->applyRule(expType) : nullptr;
+            }
+            case NodeKind::ArrayAccess: {
+                const ArrayAccess* access = cast<ArrayAccess>(node);
+                const Type* arrType = typeInline(access->array, budget);
+                if (!arrType) return nullptr;
+                const Type* idxType = typeInline(access->index, budget);
+                return idxType ? access->applyRule(arrType, idxType) : nullptr;
+            }
+            case NodeKind::FieldAccess: {
+                const FieldAccess* access = cast<FieldAccess>(node);
+                const Type* baseType = typeInline(access->ptr, budget);
+                return baseType ? access->applyRule(baseType, delta) : nullptr;
+            }
+            case NodeKind::Val: return typeInline(cast<Val>(node)->place, budget);
+            case NodeKind::Num: return cast<Num>(node)->applyRule();
+            case NodeKind::Nil: return cast<NilExp>(node)->applyRule();
+            case NodeKind::Select: {
+                const Select* select = cast<Select>(node);
+                const Type* guardType = typeInline(select->guard, budget);
+                if (!guardType) return nullptr;
+                select->checkGuard(guardType);
+                const Type* ttType = typeInline(select->tt, budget);
+                if (!ttType) return nullptr;
+                const Type* ffType = typeInline(select->ff, budget);
+                return ffType ? select->applyRule(ttType, ffType) : nullptr;
+            }
+            case NodeKind::UnOp: {
+                const UnOp* unop = cast<UnOp>(node);
+                const Type* operandType = typeInline(unop->exp, budget);
+                return operandType ? unop->applyRule(operandType) : nullptr;
+            }
+            case NodeKind::BinOp: {
+                const BinOp* binop = cast<BinOp>(node);
+                const Type* leftType = typeInline(binop->left, budget);
+                if (!leftType) return nullptr;
+                const Type* rightType = typeInline(binop->right, budget);
+                return rightType ? binop->applyRule(leftType, rightType) : nullptr;
+            }
+            case NodeKind::NewSingle: return cast<NewSingle>(node)->applyRule();
+            case NodeKind::NewArray: {
+                const NewArray* alloc = cast<NewArray>(node);
+                const Type* amtType = typeInline(alloc->size, budget);
+                return amtType ? alloc->applyRule(amtType) : nullptr;
+            }
+            case NodeKind::Call: return typeInline(cast<CallExp>(node)->fun_call, budget);
+            case NodeKind::FunCall: {
+                const FunCall* call = cast<FunCall>(node);
+                call->checkCallee();
+                const Type* calleeType = typeInline(call->callee, budget);
+                if (!calleeType) return nullptr;
+                const FnType* funcType = call->calleeFnType(calleeType);
+                for (size_t i = 0; i < call->args.size(); ++i) {
+                    const Type* argType = typeInline(call->args[i], budget);
+                    if (!argType) return nullptr;
+                    call->checkArg(i, argType, funcType);
+                }
+                return funcType ? funcType->returnType : TypeContext::errorType();
+            }
+            default:
+                throw std::logic_error("checker reached a non-expression node");
+        }
+    }
+
+    // Types the expression or place `child` as the next step of `task`.
+    // Returns false if that was done on the spot, and the caller carries on
+    // at `stage`; otherwise `child` is scheduled ahead of `task` resumed at
+    // `stage`, and true is returned.
+    bool descend(Task& task, uint32_t stage, const Node* child) {
+        unsigned budget = kInlineBudget;
+        if (const Type* type = typeRoot(child, budget)) {
+            types.push_back(type);
+            task.stage = stage;
+            return false;
+        }
+        schedule(task, stage, child, false);
+        return true;
+    }
+
+    // Checks an assignment, call, return, break or continue whose
+    // expressions are small enough to type inline. Returns whether it
+    // definitely returns, or -1 if it has to be scheduled instead.
+    int checkInline(const Stmt* stmt, bool inLoop) {
+        CFLAT_PROFILE_NODE(stmt->kind);
+        unsigned budget = kInlineBudget;
+        switch (stmt->kind) {
+            case NodeKind::Assign: {
+                const Assign* assign = cast<Assign>(stmt);
+                const Type* lhsType = typeRoot(assign->place, budget);
+                if (!lhsType) return -1;
+                const Type* rhsType = typeRoot(assign->exp, budget);
+                if (!rhsType) return -1;
+                assign->applyRule(lhsType, rhsType);
+                return 0;
+            }
+            case NodeKind::CallStmt:
+                return typeRoot(cast<CallStmt>(stmt)->fun_call, budget) ? 0 : -1;
+            case NodeKind::Return: {
+                const Return* ret = cast<Return>(stmt);
+                const Type* expType = nullptr;
+                if (ret->exp && !(expType = typeRoot(*ret->exp, budget))) return -1;
+                ret->applyRule(expType, returnType);
+                return 1;
+            }
+            case NodeKind::Break:
+                cast<Break>(stmt)->applyRule(inLoop);
+                return 0;
+            case NodeKind::Continue:
+                cast<Continue>(stmt)->applyRule(inLoop);
+                return 0;
+            default:
+                return -1;
+        }
+    }
+
+    // Schedules `child` ahead of `task` resumed at `stage`
+    void schedule(const Task& task, uint32_t stage, const Node* child, bool childInLoop) {
+        tasks.push_back({task.node, stage, task.inLoop, task.funcType});
+        tasks.push_back({child, 0, childInLoop});
+    }
+
+    void run() {
+        while (!tasks.empty()) {
+            Task task = tasks.back();
+            tasks.pop_back();
+            step(task);
+        }
+    }
+
+    // Runs `task` from its stage until it either finishes, leaving its result
+    // on `types` or `returns`, or has to wait for a child. Only expressions
+    // too large to type inline get here.
+    void step(Task& task) {
+        const Node* node = task.node;
+        CFLAT_PROFILE_NODE(node->kind);
+        switch (node->kind) {
+            // --- Places ---
+            case NodeKind::Deref: {
+                const Deref* deref = cast<Deref>(node);
+                if (task.stage == 0 && descend(task, 1, deref->exp)) return;
+                types.push_back(record(node, deref->applyRule(popType())));
+                return;
+            }
+            case NodeKind::ArrayAccess: {
+                const ArrayAccess* access = cast<ArrayAccess>(node);
+                if (task.stage == 0 && descend(task, 1, access->array)) return;
+                if (task.stage == 1 && descend(task, 2, access->index)) return;
+                const Type* idxType = popType();
+                const Type* arrType = popType();
+                types.push_back(record(node, access->applyRule(arrType, idxType)));
+                return;
+            }
+            case NodeKind::FieldAccess: {
+                const FieldAccess* access = cast<FieldAccess>(node);
+                if (task.stage == 0 && descend(task, 1, access->ptr)) return;
+                types.push_back(record(node, access->applyRule(popType(), delta)));
+                return;
+            }
+
+            // --- Expressions ---
+            case NodeKind::Id:
+            case NodeKind::Num:
+            case NodeKind::Nil:
+            case NodeKind::NewSingle:
+                // Only reached when a leaf is the root
+                descend(task, 0, node);
+                return;
+            case NodeKind::Val:
+                // A Val has the type of its place
+                if (task.stage == 0 && descend(task, 1, cast<Val>(node)->place)) return;
+                types.push_back(record(node, popType()));
+                return;
+            case NodeKind::Select: {
+                const Select* select = cast<Select>(node);
+                if (task.stage == 0 && descend(task, 1, select->guard)) return;
+                if (task.stage == 1) {
+                    select->checkGuard(popType());
+                    if (descend(task, 2, select->tt)) return;
+                }
+                if (task.stage == 2 && descend(task, 3, select->ff)) return;
+                const Type* ffType = popType();
+                const Type* ttType = popType();
+                types.push_back(record(node, select->applyRule(ttType, ffType)));
+                return;
+            }
+            case NodeKind::UnOp: {
+                const UnOp* unop = cast<UnOp>(node);
+                if (task.stage == 0 && descend(task, 1, unop->exp)) return;
+                types.push_back(record(node, unop->applyRule(popType())));
+                return;
+            }
+            case NodeKind::BinOp: {
+                const BinOp* binop = cast<BinOp>(node);
+                if (task.stage == 0 && descend(task, 1, binop->left)) return;
+                if (task.stage == 1 && descend(task, 2, binop->right)) return;
+                const Type* rightType = popType();
+                const Type* leftType = popType();
+                types.push_back(record(node, binop->applyRule(leftType, rightType)));
+                return;
+            }
+            case NodeKind::NewArray: {
+                const NewArray* alloc = cast<NewArray>(node);
+                if (task.stage == 0 && descend(task, 1, alloc->size)) return;
+                types.push_back(record(node, alloc->applyRule(popType())));
+                return;
+            }
+            case NodeKind::Call:
+                // A call expression has the type of its FunCall
+                if (task.stage == 0 && descend(task, 1, cast<CallExp>(node)->fun_call)) return;
+                types.push_back(record(node, popType()));
+                return;
+            case NodeKind::FunCall: {
+                // Stage 1 has the callee's type and stage 2 + i that of
+                // argument i; the result is the callee's return type, or
+                // the error type if collecting errors and the callee failed
+                const FunCall* call = cast<FunCall>(node);
+                if (task.stage == 0) {
+                    call->checkCallee();
+                    if (descend(task, 1, call->callee)) return;
+                }
+                if (task.stage == 1) {
+                    task.funcType = call->calleeFnType(popType());
+                } else {
+                    call->checkArg(task.stage - 2, popType(), task.funcType);
+                }
+                for (size_t i = task.stage - 1; i < call->args.size(); ++i) {
+                    if (descend(task, i + 2, call->args[i])) return;
+                    call->checkArg(i, popType(), task.funcType);
+                }
+                types.push_back(task.funcType ? task.funcType->returnType : TypeContext::errorType());
+                return;
+            }
+
+            // --- Statements ---
+            case NodeKind::Stmts: {
+                // Γ,Δ,τr,loop ⊢ stmt : ok(ret1)   Γ,Δ,τr,loop ⊢ stmts : ok(ret2)   ret = ret1 ∨ ret2
+                //                      Γ,Δ,τr,loop ⊢ stmt; stmts : ok(ret)
+                // Stage i + 1 resumes after statement i. Statements after one
+                // that definitely returns are still checked.
+                const Stmts* stmts = cast<Stmts>(node);
+                if (task.stage == 0) {
+                    returns.push_back(false);
+                } else {
+                    bool stmtReturns = popReturns();
+                    returns.back() |= stmtReturns;
+                }
+                for (size_t i = task.stage; i < stmts->statements.size(); ++i) {
+                    int simple = checkInline(stmts->statements[i], task.inLoop);
+                    if (simple < 0) return schedule(task, i + 1, stmts->statements[i], task.inLoop);
+                    returns.back() |= simple;
+                }
+                return;
+            }
+            case NodeKind::Assign: {
+                const Assign* assign = cast<Assign>(node);
+                if (task.stage == 0 && descend(task, 1, assign->place)) return;
+                if (task.stage == 1 && descend(task, 2, assign->exp)) return;
+                const Type* rhsType = popType();
+                const Type* lhsType = popType();
+                assign->applyRule(lhsType, rhsType);
+                returns.push_back(false);
+                return;
+            }
+            case NodeKind::CallStmt: {
+                // Γ,∆ ⊢funcall : τ
+                // Γ,∆,τr ,loop ⊢Call(funcall) : ok(false)
+                if (task.stage == 0 && descend(task, 1, cast<CallStmt>(node)->fun_call)) return;
+                popType();
+                returns.push_back(false);
+                return;
+            }
+            case NodeKind::If: {
+                const If* ifStmt = cast<If>(node);
+                if (task.stage == 0 && descend(task, 1, ifStmt->guard)) return;
+                if (task.stage == 1) {
+                    ifStmt->checkGuard(popType());
+                    return schedule(task, 2, ifStmt->tt, task.inLoop);
+                }
+                if (task.stage == 2) {
+                    if (ifStmt->ff) return schedule(task, 3, *ifStmt->ff, task.inLoop);
+                    popReturns();
+                    returns.push_back(false);
+                    return;
+                }
+                bool ffReturns = popReturns();
+                bool ttReturns = popReturns();
+                returns.push_back(ttReturns && ffReturns);
+                return;
+            }
+            case NodeKind::While: {
+                const While* loop = cast<While>(node);
+                if (task.stage == 0 && descend(task, 1, loop->guard)) return;
+                if (task.stage == 1) {
+                    loop->checkGuard(popType());
+                    return schedule(task, 2, loop->body, true);
+                }
+                popReturns();
+                returns.push_back(false);
+                return;
+            }
+            case NodeKind::Break:
+                cast<Break>(node)->applyRule(task.inLoop);
+                returns.push_back(false);
+                return;
+            case NodeKind::Continue:
+                cast<Continue>(node)->applyRule(task.inLoop);
+                returns.push_back(false);
+                return;
+            case NodeKind::Return: {
+                const Return* ret = cast<Return>(node);
+                if (ret->exp && task.stage == 0 && descend(task, 1, *ret->exp)) return;
+                ret->applyRule(ret->exp ? popType() : nullptr, returnType);
+                returns.push_back(true);
+                return;
+            }
+
+            default:
+                throw std::logic_error("checker reached a non-expression, non-statement node");
+        }
+    }
+};
+
+} // namespace
+
+const Type* Exp::check(const Gamma& gamma, const Delta& delta) const {
+    return CheckEngine(gamma, delta, nullptr).typeOf(this);
+}
+
+const Type* Place::check(const Gamma& gamma, const Delta& delta) const {
+    return CheckEngine(gamma, delta, nullptr).typeOf(this);
+}
+
+bool Stmt::check(const Gamma& gamma, const Delta& delta, const Type* returnType, bool inLoop) const {
+    return CheckEngine(gamma, delta, returnType).returnsOf(this, inLoop);
+}
@@ -0,0 +1,416 @@
+#include <algorithm>
+#include "ast.hpp"
+
+// Flat Checker
+//
+// An alternative to the tree walk in checker.cpp, selected with --flat.
+// lowerBody turns a function body into a FlatBody, its ops laid out in the
+// order the walk would apply their rules, and checkFlat then checks the
+// body in one pass over them. The typing
+// rules are still the applyRule / checkGuard / ... members in ast.cpp, and
+// they run in the same order as in the walk. The first TypeError thrown,
+// every type recorded on a node, and the errors collected with Diagnostics
+// are therefore all the same as the walk's.
+//
+// Each function is lowered right before it is checked, on the thread that
+// checks it, so nothing is lowered past the first error. Like the walk,
+// lowering keeps its own stack, so deep bodies do not recurse.
+
+namespace {
+
+// One step of lowering: expand a node, emit an op, or fold the
+// definitely-returns flags of a compound statement's parts
+struct Item {
+    enum Action : uint8_t { Expand, Emit, StmtsEnd, IfEnd, WhileEnd };
+    Action action;
+    FlatOp op;          // Emit only
+    bool inLoop;        // Expand of a statement only
+    uint32_t operand;   // Emit, and StmtsEnd's statement count
+    const Node* node;
+};
+
+// Reused across lowerings on the same thread
+thread_local std::vector<Item> threadItems;
+thread_local std::vector<uint8_t> threadReturns;
+
+// Most nodes lowerInline visits before it gives up and expands the expression
+constexpr unsigned kInlineBudget = 64;
+
+// Lowering emits the ops of a body back to front and reverses them at the
+// end. Back to front, a node's own op comes before its children's, so it
+// is emitted as the node is expanded, and only the ops that sit between
+// two children (a guard, a callee, an argument) wait on the stack as items.
+// As in checker.cpp, small expressions are lowered by bounded recursion
+// instead (lowerInline), and only compound statements and large
+// expressions go through the stack.
+class Lowering {
+public:
+    explicit Lowering(FlatBody& out) : out(out) {}
+
+    // Lowers body into out, returning whether it definitely returns
+    bool lower(const Stmt* body) {
+        items.clear();
+        returns.clear();
+        expand(body, false);
+        while (!items.empty()) {
+            Item item = items.back();
+            items.pop_back();
+            step(item);
+        }
+        std::reverse(out.ops.begin(), out.ops.end());
+        std::reverse(out.operands.begin(), out.operands.end());
+        std::reverse(out.nodes.begin(), out.nodes.end());
+        return returns.back();
+    }
+
+private:
+    FlatBody& out;
+    std::vector<Item>& items = threadItems;
+    // Whether each statement lowered so far definitely returns, until the
+    // compound statement around it folds them. The folds are an "or" and
+    // an "and", so the statements being met back to front does not matter.
+    std::vector<uint8_t>& returns = threadReturns;
+
+    void emit(FlatOp op, const Node* node, uint32_t operand = 0) {
+        out.ops.push_back(op);
+        out.operands.push_back(operand);
+        out.nodes.push_back(node);
+    }
+    void emitLater(FlatOp op, const Node* node, uint32_t operand = 0) {
+        items.push_back({Item::Emit, op, false, operand, node});
+    }
+    void expand(const Node* node, bool inLoop = false) {
+        items.push_back({Item::Expand, FlatOp::Id, inLoop, 0, node});
+    }
+    void fold(Item::Action action, const Node* node, uint32_t count = 0) {
+        items.push_back({action, FlatOp::Id, false, count, node});
+    }
+    bool popReturns() {
+        bool r = returns.back();
+        returns.pop_back();
+        return r;
+    }
+
+    void step(const Item& item) {
+        switch (item.action) {
+            case Item::Expand: {
+                if (!isa<Stmt>(item.node)) {
+                    unsigned budget = kInlineBudget;
+                    size_t mark = out.ops.size();
+                    if (lowerInline(item.node, budget)) return;
+                    out.ops.resize(mark);
+                    out.operands.resize(mark);
+                    out.nodes.resize(mark);
+                }
+                return lowerNode(item.node, item.inLoop);
+            }
+            case Item::Emit:
+                return emit(item.op, item.node, item.operand);
+            case Item::StmtsEnd: {
+                bool any = false;
+                for (uint32_t i = 0; i < item.operand; ++i) any |= popReturns();
+                returns.push_back(any);
+                return;
+            }
+            case Item::IfEnd: {
+                bool ffReturns = cast<If>(item.node)->ff ? popReturns() : false;
+                bool ttReturns = popReturns();
+                returns.push_back(ttReturns && ffReturns);
+                return;
+            }
+            case Item::WhileEnd:
+                popReturns();
+                returns.push_back(false);
+                return;
+        }
+    }
+
+    // Lowers a small expression, place or call by plain recursion, spending
+    // one unit of `budget` per node, so the native stack stays bounded.
+    // Returns false once the budget runs out, and the caller drops what was
+    // emitted and expands the node instead. Children are visited last to
+    // first, since the ops are emitted back to front.
+    bool lowerInline(const Node* node, unsigned& budget) {
+        if (budget == 0) return false;
+        --budget;
+        switch (node->kind) {
+            case NodeKind::Id:
+                emit(FlatOp::Id, node, cast<Id>(node)->name.id);
+                return true;
+            case NodeKind::Deref:
+                emit(FlatOp::Deref, node);
+                return lowerInline(cast<Deref>(node)->exp, budget);
+            case NodeKind::ArrayAccess:
+                emit(FlatOp::ArrayAccess, node);
+                return lowerInline(cast<ArrayAccess>(node)->index, budget) &&
+                       lowerInline(cast<ArrayAccess>(node)->array, budget);
+            case NodeKind::FieldAccess:
+                emit(FlatOp::FieldAccess, node);
+                return lowerInline(cast<FieldAccess>(node)->ptr, budget);
+            case NodeKind::Num: emit(FlatOp::Num, node); return true;
+            case NodeKind::Nil: emit(FlatOp::Nil, node); return true;
+            case NodeKind::NewSingle: emit(FlatOp::NewSingle, node); return true;
+            case NodeKind::Val:
+                emit(FlatOp::Val, node);
+                return lowerInline(cast<Val>(node)->place, budget);
+            case NodeKind::Select: {
+                const Select* select = cast<Select>(node);
+                emit(FlatOp::Select, node);
+                if (!lowerInline(select->ff, budget) || !lowerInline(select->tt, budget)) return false;
+                emit(FlatOp::SelectGuard, node);
+                return lowerInline(select->guard, budget);
+            }
+            case NodeKind::UnOp:
+                emit(FlatOp::UnOp, node);
+                return lowerInline(cast<UnOp>(node)->exp, budget);
+            case NodeKind::BinOp:
+                emit(FlatOp::BinOp, node);
+                return lowerInline(cast<BinOp>(node)->right, budget) && lowerInline(cast<BinOp>(node)->left, budget);
+            case NodeKind::NewArray:
+                emit(FlatOp::NewArray, node);
+                return lowerInline(cast<NewArray>(node)->size, budget);
+            case NodeKind::Call:
+                emit(FlatOp::Call, node);
+                return lowerInline(cast<CallExp>(node)->fun_call, budget);
+            case NodeKind::FunCall: {
+                const FunCall* call = cast<FunCall>(node);
+                emit(FlatOp::CallEnd, node);
+                for (size_t i = call->args.size(); i-- > 0;) {
+                    emit(FlatOp::CallArg, node, uint32_t(i));
+                    if (!lowerInline(call->args[i], budget)) return false;
+                }
+                emit(FlatOp::CallFn, node);
+                if (!lowerInline(call->callee, budget)) return false;
+                emit(FlatOp::CallCallee, node);
+                return true;
+            }
+            default:
+                throw std::logic_error("lowering reached a non-expression node");
+        }
+    }
+
+    // Emits node's own op and pushes its children, the last one on top
+    void lowerNode(const Node* node, bool inLoop) {
+        switch (node->kind) {
+            // --- Places ---
+            case NodeKind::Id:
+                return emit(FlatOp::Id, node, cast<Id>(node)->name.id);
+            case NodeKind::Deref:
+                emit(FlatOp::Deref, node);
+                return expand(cast<Deref>(node)->exp);
+            case NodeKind::ArrayAccess:
+                emit(FlatOp::ArrayAccess, node);
+                expand(cast<ArrayAccess>(node)->array);
+                return expand(cast<ArrayAccess>(node)->index);
+            case NodeKind::FieldAccess:
+                emit(FlatOp::FieldAccess, node);
+                return expand(cast<FieldAccess>(node)->ptr);
+
+            // --- Expressions ---
+            case NodeKind::Num: return emit(FlatOp::Num, node);
+            case NodeKind::Nil: return emit(FlatOp::Nil, node);
+            case NodeKind::NewSingle: return emit(FlatOp::NewSingle, node);
+            case NodeKind::Val:
+                emit(FlatOp::Val, node);
+                return expand(cast<Val>(node)->place);
+            case NodeKind::Select: {
+                const Select* select = cast<Select>(node);
+                emit(FlatOp::Select, node);
+                expand(select->guard);
+                emitLater(FlatOp::SelectGuard, node);
+                expand(select->tt);
+                return expand(select->ff);
+            }
+            case NodeKind::UnOp:
+                emit(FlatOp::UnOp, node);
+                return expand(cast<UnOp>(node)->exp);
+            case NodeKind::BinOp:
+                emit(FlatOp::BinOp, node);
+                expand(cast<BinOp>(node)->left);
+                return expand(cast<BinOp>(node)->right);
+            case NodeKind::NewArray:
+                emit(FlatOp::NewArray, node);
+                return expand(cast<NewArray>(node)->size);
+            case NodeKind::Call:
+                emit(FlatOp::Call, node);
+                return expand(cast<CallExp>(node)->fun_call);
+            case NodeKind::FunCall: {
+                // Callee is not main, the callee's type, its function type
+                // and arity, then each argument; then the return type
+                const FunCall* call = cast<FunCall>(node);
+                emit(FlatOp::CallEnd, node);
+                emitLater(FlatOp::CallCallee, node);
+                expand(call->callee);
+                emitLater(FlatOp::CallFn, node);
+                for (size_t i = 0; i < call->args.size(); ++i) {
+                    expand(call->args[i]);
+                    emitLater(FlatOp::CallArg, node, uint32_t(i));
+                }
+                return;
+            }
+
+            // --- Statements ---
+            case NodeKind::Stmts: {
+                const Stmts* stmts = cast<Stmts>(node);
+                fold(Item::StmtsEnd, node, stmts->statements.size());
+                for (const Stmt* stmt : stmts->statements) expand(stmt, inLoop);
+                return;
+            }
+            case NodeKind::Assign:
+                returns.push_back(false);
+                emit(FlatOp::Assign, node);
+                expand(cast<Assign>(node)->place);
+                return expand(cast<Assign>(node)->exp);
+            case NodeKind::CallStmt:
+                returns.push_back(false);
+                emit(FlatOp::CallStmt, node);
+                return expand(cast<CallStmt>(node)->fun_call);
+            case NodeKind::If: {
+                const If* ifStmt = cast<If>(node);
+                fold(Item::IfEnd, node);
+                expand(ifStmt->guard);
+                emitLater(FlatOp::IfGuard, node);
+                expand(ifStmt->tt, inLoop);
+                if (ifStmt->ff) expand(*ifStmt->ff, inLoop);
+                return;
+            }
+            case NodeKind::While: {
+                const While* loop = cast<While>(node);
+                fold(Item::WhileEnd, node);
+                expand(loop->guard);
+                emitLater(FlatOp::WhileGuard, node);
+                return expand(loop->body, true);
+            }
+            case NodeKind::Break:
+                returns.push_back(false);
+                return emit(FlatOp::Break, node, inLoop);
+            case NodeKind::Continue:
+                returns.push_back(false);
+                return emit(FlatOp::Continue, node, inLoop);
+            case NodeKind::Return: {
+                const Return* ret = cast<Return>(node);
+                returns.push_back(true);
+                emit(FlatOp::Return, node, ret->exp.has_value());
+                if (ret->exp) expand(*ret->exp);
+                return;
+            }
+
+            default:
+                throw std::logic_error("lowering reached a non-expression, non-statement node");
+        }
+    }
+};
+
+// Reused across checks on the same thread, so a function body costs no allocations
+struct FlatStacks {
+    std::vector<const Type*> types;
+    // The function type of each call whose arguments are being checked
+    std::vector<const FnType*> calls;
+};
+thread_local FlatStacks threadStacks;
+
+// Records `type` as the checked type of the expression or place `node`,
+// unless its check failed under Diagnostics
+inline const Type* record(const Node* node, const Type* type) {
+    static_cast<const TypedNode*>(node)->checkedType = type == TypeContext::errorType() ? nullptr : type;
+    return type;
+}
+
+} // namespace
+
+void lowerBody(const Stmt* body, FlatBody& flat) {
+    CFLAT_PROFILE_SCOPE("lowerBody");
+    flat.ops.clear();
+    flat.operands.clear();
+    flat.nodes.clear();
+    flat.returns = Lowering(flat).lower(body);
+}
+
+bool checkFlat(const FlatBody& flat, const Gamma& gamma, const Delta& delta, const Type* returnType) {
+    CFLAT_PROFILE_SCOPE("checkFlat");
+    std::vector<const Type*>& types = threadStacks.types;
+    std::vector<const FnType*>& calls = threadStacks.calls;
+    types.clear();
+    calls.clear();
+    auto pop = [&]() {
+        const Type* t = types.back();
+        types.pop_back();
+        return t;
+    };
+
+    for (size_t i = 0; i < flat.ops.size(); ++i) {
+        const Node* node = flat.nodes[i];
+        CFLAT_PROFILE_NODE(node->kind);
+        switch (flat.ops[i]) {
+            // --- Places and expressions ---
+            case FlatOp::Id: {
+                // Only a failed lookup needs the node, for its error
+                const Type* type = gamma.lookup(Symbol{flat.operands[i], nullptr});
+                types.push_back(record(node, type ? type : cast<Id>(node)->applyRule(gamma)));
+                break;
+            }
+            case FlatOp::Num: types.push_back(record(node, cast<Num>(node)->applyRule())); break;
+            case FlatOp::Nil: types.push_back(record(node, cast<NilExp>(node)->applyRule())); break;
+            case FlatOp::NewSingle: types.push_back(record(node, cast<NewSingle>(node)->applyRule())); break;
+            case FlatOp::Deref: types.push_back(record(node, cast<Deref>(node)->applyRule(pop()))); break;
+            case FlatOp::ArrayAccess: {
+                const Type* idxType = pop();
+                const Type* arrType = pop();
+                types.push_back(record(node, cast<ArrayAccess>(node)->applyRule(arrType, idxType)));
+                break;
+            }
+            case FlatOp::FieldAccess:
+                types.push_back(record(node, cast<FieldAccess>(node)->applyRule(pop(), delta)));
+                break;
+            case FlatOp::Val:
+            case FlatOp::Call:
+                // The type of the place or call inside
+                record(node, types.back());
+                break;
+            case FlatOp::Select: {
+                const Type* ffType = pop();
+                const Type* ttType = pop();
+                types.push_back(record(node, cast<Select>(node)->applyRule(ttType, ffType)));
+                break;
+            }
+            case FlatOp::UnOp: types.push_back(record(node, cast<UnOp>(node)->applyRule(pop()))); break;
+            case FlatOp::BinOp: {
+                const Type* rightType = pop();
+                const Type* leftType = pop();
+                types.push_back(record(node, cast<BinOp>(node)->applyRule(leftType, rightType)));
+                break;
+            }
+            case FlatOp::NewArray: types.push_back(record(node, cast<NewArray>(node)->applyRule(pop()))); break;
+
+            // --- Premises part way through a rule ---
+            case FlatOp::SelectGuard: cast<Select>(node)->checkGuard(pop()); break;
+            case FlatOp::CallCallee: cast<FunCall>(node)->checkCallee(); break;
+            case FlatOp::CallFn: calls.push_back(cast<FunCall>(node)->calleeFnType(pop())); break;
+            case FlatOp::CallArg: cast<FunCall>(node)->checkArg(flat.operands[i], pop(), calls.back()); break;
+            case FlatOp::CallEnd: {
+                // The return type, or the error type if collecting errors and the callee failed
+                const FnType* funcType = calls.back();
+                calls.pop_back();
+                types.push_back(funcType ? funcType->returnType : TypeContext::errorType());
+                break;
+            }
+
+            // --- Statements ---
+            case FlatOp::Assign: {
+                const Type* rhsType = pop();
+                const Type* lhsType = pop();
+                cast<Assign>(node)->applyRule(lhsType, rhsType);
+                break;
+            }
+            case FlatOp::CallStmt: pop(); break;
+            case FlatOp::IfGuard: cast<If>(node)->checkGuard(pop()); break;
+            case FlatOp::WhileGuard: cast<While>(node)->checkGuard(pop()); break;
+            case FlatOp::Break: cast<Break>(node)->applyRule(flat.operands[i]); break;
+            case FlatOp::Continue: cast<Continue>(node)->applyRule(flat.operands[i]); break;
+            case FlatOp::Return:
+                cast<Return>(node)->applyRule(flat.operands[i] ? pop() : nullptr, returnType);
+                break;
+        }
+    }
+    return flat.returns;
+}
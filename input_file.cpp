@@ -0,0 +1,62 @@
+#include "ast.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Input Files
+//
+// Both readers parse from one contiguous range rather than through an
+// istream, whose per-character virtual calls dominate reading large .astj
+// files. A regular file is mapped read-only; anything else (stdin, a pipe,
+// a file that cannot be mapped) is read with read() into one heap buffer,
+// which is aligned for the .astb loader's word reads like a mapping is.
+
+InputFile::~InputFile() {
+    if (mapped) ::munmap(const_cast<char*>(mapped), length);
+    if (fd > STDIN_FILENO) ::close(fd);
+}
+
+bool InputFile::open(const std::string& path) {
+    this->path = path;
+    fd = path == "-" ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY);
+    return fd >= 0;
+}
+
+void InputFile::read() {
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            ::madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+            mapped = static_cast<const char*>(p);
+            length = size_t(st.st_size);
+            return;
+        }
+    }
+    // Unknown size: grow the buffer geometrically, starting from the size
+    // fstat reported when there is one
+    size_t used = 0;
+    buffer.resize(std::max<size_t>(st.st_size > 0 ? size_t(st.st_size) + 1 : 0, 64 * 1024));
+    for (;;) {
+        if (used == buffer.size()) buffer.resize(2 * buffer.size());
+        ssize_t got = ::read(fd, buffer.data() + used, buffer.size() - used);
+        if (got > 0) {
+            used += size_t(got);
+        } else if (got == 0) {
+            break;
+        } else if (errno != EINTR) {
+            throw std::runtime_error("Could not read " + (path == "-" ? std::string("stdin") : "file " + path) + ": " +
+                                     std::strerror(errno));
+        }
+    }
+    buffer.resize(used);
+    length = used;
+}
+
+const char* InputFile::data() const {
+    return mapped ? mapped : buffer.data();
+}
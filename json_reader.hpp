@@ -0,0 +1,251 @@
+#ifndef JSON_READER_HPP
+#define JSON_READER_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "json.hpp"
+
+// --- Fast JSON Reader ---
+//
+// Reads .astj text and drives a SAX handler with the same calls, in the
+// same order, as nlohmann::json::sax_parse, without going through its
+// general-purpose lexer. Strings are scanned for their closing quote 32
+// (AVX2) or 16 (SSE2) bytes at a time, and the same compare finds escapes,
+// control characters and non-ASCII bytes; everything else is the minified
+// subset of JSON the .astj writers emit, read byte by byte.
+//
+// It does not diagnose anything. On text it does not handle quickly (a
+// syntax error, a \u escape, a non-ASCII string) it stops and returns
+// GaveUp, and the caller runs nlohmann's parser over the same text with a
+// fresh handler, which reports exactly what it always has. Errors the
+// handler throws propagate as they would from sax_parse: both readers
+// make the same calls up to that point.
+
+namespace fastjson {
+
+enum class Result {
+    Done,       // the whole text was read
+    Stopped,    // a handler call returned false
+    GaveUp      // not handled here; use nlohmann::json::sax_parse
+};
+
+template <typename Sax>
+class Reader {
+public:
+    Reader(const char* first, const char* last, Sax& sax) : p(first), end(last), sax(sax) {}
+
+    // Reads one value. When strict, only whitespace may follow it.
+    Result parse(bool strict) {
+        // Open containers, innermost last; true for an array
+        std::vector<bool> open;
+        if (!ws()) return Result::GaveUp;
+        for (;;) {
+            // A value starts at p
+            char c = *p;
+            if (c == '{' || c == '[') {
+                ++p;
+                bool isArray = c == '[';
+                if (!(isArray ? sax.start_array(size_t(-1)) : sax.start_object(size_t(-1)))) return Result::Stopped;
+                if (!ws()) return Result::GaveUp;
+                if (*p != (isArray ? ']' : '}')) {
+                    open.push_back(isArray);
+                    if (!isArray) {
+                        Result r = key();
+                        if (r != Result::Done) return r;
+                    }
+                    continue;
+                }
+                ++p;
+                if (!(isArray ? sax.end_array() : sax.end_object())) return Result::Stopped;
+            } else {
+                Result r = scalar(c);
+                if (r != Result::Done) return r;
+            }
+
+            // The value is complete: close what it completes, up to the next one
+            for (;;) {
+                if (open.empty()) return !strict || !ws() ? Result::Done : Result::GaveUp;
+                if (!ws()) return Result::GaveUp;
+                char d = *p++;
+                if (d == ',') {
+                    if (!ws()) return Result::GaveUp;
+                    if (!open.back()) {
+                        Result r = key();
+                        if (r != Result::Done) return r;
+                    }
+                    break;
+                }
+                if (d != (open.back() ? ']' : '}')) return Result::GaveUp;
+                if (!(open.back() ? sax.end_array() : sax.end_object())) return Result::Stopped;
+                open.pop_back();
+            }
+        }
+    }
+
+private:
+    const char* p;
+    const char* end;
+    Sax& sax;
+    // Reused for every string, key and number text
+    std::string buffer;
+
+    // Skips whitespace; false at the end of the text
+    bool ws() {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) ++p;
+        return p < end;
+    }
+
+    // An object key at p and the colon after it, leaving p on the value
+    Result key() {
+        if (*p != '"' || !string()) return Result::GaveUp;
+        if (!sax.key(buffer)) return Result::Stopped;
+        if (!ws() || *p != ':') return Result::GaveUp;
+        ++p;
+        return ws() ? Result::Done : Result::GaveUp;
+    }
+
+    Result scalar(char c) {
+        if (c == '"') {
+            if (!string()) return Result::GaveUp;
+            return sax.string(buffer) ? Result::Done : Result::Stopped;
+        }
+        if (c == '-' || (c >= '0' && c <= '9')) return number();
+        if (literal("null")) return sax.null() ? Result::Done : Result::Stopped;
+        if (literal("true")) return sax.boolean(true) ? Result::Done : Result::Stopped;
+        if (literal("false")) return sax.boolean(false) ? Result::Done : Result::Stopped;
+        return Result::GaveUp;
+    }
+
+    bool literal(const char* word) {
+        const char* q = p;
+        for (; *word; ++word, ++q) {
+            if (q == end || *q != *word) return false;
+        }
+        p = q;
+        return true;
+    }
+
+    // Offset from q of the first '"', '\\', control or non-ASCII byte in
+    // the whole blocks before end, or the length of those blocks if none
+    size_t plainPrefix(const char* q) const {
+        const char* start = q;
+#if defined(__AVX2__)
+        const __m256i quote32 = _mm256_set1_epi8('"'), backslash32 = _mm256_set1_epi8('\\');
+        const __m256i space32 = _mm256_set1_epi8(0x20);
+        for (; end - q >= 32; q += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(q));
+            // Signed, so bytes of 0x80 and up count as below a space too
+            __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote32), _mm256_cmpeq_epi8(v, backslash32)),
+                                          _mm256_cmpgt_epi8(space32, v));
+            if (uint32_t mask = uint32_t(_mm256_movemask_epi8(hit))) return size_t(q - start) + __builtin_ctz(mask);
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), space = _mm_set1_epi8(0x20);
+        for (; end - q >= 16; q += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(q));
+            __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                       _mm_cmplt_epi8(v, space));
+            if (uint32_t mask = uint32_t(_mm_movemask_epi8(hit))) return size_t(q - start) + __builtin_ctz(mask);
+        }
+#endif
+        return size_t(q - start);
+    }
+
+    // The string at p into buffer, unescaped, leaving p past its closing quote
+    bool string() {
+        const char* q = p + 1;
+        buffer.clear();
+        for (;;) {
+            q += plainPrefix(q);
+            // The tail shorter than a block, byte by byte
+            while (q < end && *q != '"' && *q != '\\' && static_cast<unsigned char>(*q) >= 0x20 &&
+                   static_cast<unsigned char>(*q) < 0x80) {
+                ++q;
+            }
+            if (q == end) return false;
+            if (*q == '"') {
+                buffer.append(p + 1, q);
+                p = q + 1;
+                return true;
+            }
+            if (*q != '\\' || end - q < 2) return false;
+            // Keep what came before the escape, then the escaped character
+            buffer.append(p + 1, q);
+            char e;
+            switch (q[1]) {
+                case '"': e = '"'; break;
+                case '\\': e = '\\'; break;
+                case '/': e = '/'; break;
+                case 'b': e = '\b'; break;
+                case 'f': e = '\f'; break;
+                case 'n': e = '\n'; break;
+                case 'r': e = '\r'; break;
+                case 't': e = '\t'; break;
+                default: return false;
+            }
+            buffer += e;
+            // p stays one before the next unescaped run, as if on a quote
+            p = q + 1;
+            q += 2;
+        }
+    }
+
+    // A number at p: integers as nlohmann delivers them, int64 if it fits,
+    // then uint64; anything with a fraction or exponent, or larger, is a
+    // double read from its text with strtod
+    Result number() {
+        const char* start = p;
+        bool negative = *p == '-';
+        if (negative) ++p;
+        if (p == end || *p < '0' || *p > '9') return Result::GaveUp;
+        // No leading zeros
+        if (*p == '0' && p + 1 < end && p[1] >= '0' && p[1] <= '9') return Result::GaveUp;
+        uint64_t value = 0;
+        bool overflow = false;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            unsigned digit = unsigned(*p - '0');
+            if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10) overflow = true;
+            value = value * 10 + digit;
+        }
+        bool integral = p == end || (*p != '.' && *p != 'e' && *p != 'E');
+        if (integral && !overflow) {
+            if (!negative) {
+                if (value <= uint64_t(std::numeric_limits<int64_t>::max())) {
+                    return sax.number_integer(int64_t(value)) ? Result::Done : Result::Stopped;
+                }
+                return sax.number_unsigned(value) ? Result::Done : Result::Stopped;
+            }
+            if (value <= uint64_t(std::numeric_limits<int64_t>::max()) + 1) {
+                return sax.number_integer(int64_t(0 - value)) ? Result::Done : Result::Stopped;
+            }
+        }
+        if (p < end && *p == '.') {
+            ++p;
+            if (p == end || *p < '0' || *p > '9') return Result::GaveUp;
+            while (p < end && *p >= '0' && *p <= '9') ++p;
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            if (p < end && (*p == '+' || *p == '-')) ++p;
+            if (p == end || *p < '0' || *p > '9') return Result::GaveUp;
+            while (p < end && *p >= '0' && *p <= '9') ++p;
+        }
+        buffer.assign(start, p);
+        double d = std::strtod(buffer.c_str(), nullptr);
+        // nlohmann reports overflow to infinity as an error
+        if (!std::isfinite(d)) return Result::GaveUp;
+        return sax.number_float(d, buffer) ? Result::Done : Result::Stopped;
+    }
+};
+
+} // namespace fastjson
+
+#endif
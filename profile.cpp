@@ -0,0 +1,308 @@
+#include "profile.hpp"
+
+// Profiling Hooks
+//
+// Only compiled with -DCFLAT_PROFILE; see profile.hpp. Every thread owns
+// its tree and its stack of open frames, so a scope costs two clock reads,
+// a short search of the current context's children and, with CFLAT_PERF,
+// one read() of the thread's counter group; nothing is shared until the
+// report merges the threads, which must be done by then.
+
+#ifdef CFLAT_PROFILE
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// Counted by the operator new below, for the thread that allocates
+thread_local uint64_t allocations = 0;
+thread_local uint64_t allocatedBytes = 0;
+
+// A snapshot of a thread's counters, or what a frame cost between two
+struct Cost {
+    uint64_t ns = 0, allocations = 0, bytes = 0, cycles = 0, misses = 0;
+
+    Cost& operator+=(const Cost& o) {
+        ns += o.ns;
+        allocations += o.allocations;
+        bytes += o.bytes;
+        cycles += o.cycles;
+        misses += o.misses;
+        return *this;
+    }
+    Cost operator-(const Cost& o) const {
+        return {ns - o.ns, allocations - o.allocations, bytes - o.bytes, cycles - o.cycles, misses - o.misses};
+    }
+};
+
+// One node of a thread's calling-context tree; context 0 is the thread
+struct Context {
+    const char* name;
+    bool nodeKind;
+    uint32_t parent;
+    // How many times it is on the stack right now
+    uint32_t open = 0;
+    uint64_t calls = 0;
+    // Net of the frames entered from it, and including them
+    Cost self, total;
+    std::vector<uint32_t> children;
+    Context(const char* name, bool nodeKind, uint32_t parent) : name(name), nodeKind(nodeKind), parent(parent) {}
+};
+
+struct OpenFrame {
+    uint32_t context;
+    // Not already open further down the stack: only these add to total
+    bool outermost;
+    Cost start;
+    // What the frames entered from this one cost, inclusively
+    Cost callees;
+};
+
+struct ThreadProfile {
+    std::vector<Context> contexts{Context(nullptr, false, 0)};
+    std::vector<OpenFrame> stack;
+    // The cycle counter, which leads a group with the cache-miss counter;
+    // -1 without CFLAT_PERF or when the kernel refuses
+    int perf = -1;
+
+    Cost snapshot() const {
+        Cost c;
+        c.ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch()).count());
+        c.allocations = allocations;
+        c.bytes = allocatedBytes;
+        if (perf >= 0) {
+            // PERF_FORMAT_GROUP: the number of counters, then their values
+            uint64_t values[3];
+            if (::read(perf, values, sizeof values) == ssize_t(sizeof values)) {
+                c.cycles = values[1];
+                c.misses = values[2];
+            }
+        }
+        return c;
+    }
+
+    // The context `name` runs in when entered from context `at`: a child of
+    // at, or at or one of its ancestors if that is the same frame
+    uint32_t enter(uint32_t at, const char* name, bool nodeKind) {
+        for (uint32_t child : contexts[at].children) {
+            if (contexts[child].name == name) return child;
+        }
+        for (uint32_t up = at; up != 0; up = contexts[up].parent) {
+            if (contexts[up].name == name) return up;
+        }
+        uint32_t child = uint32_t(contexts.size());
+        contexts.emplace_back(name, nodeKind, at);
+        contexts[at].children.push_back(child);
+        return child;
+    }
+};
+
+struct Registry {
+    std::mutex mutex;
+    // Kept after their threads exit, for the report
+    std::vector<std::unique_ptr<ThreadProfile>> threads;
+    // Whether any thread's counters opened, and what to say about them
+    bool perfCounting = false;
+    std::string perfStatus = "off (set CFLAT_PERF=1 to count cycles and cache misses)";
+};
+
+// Never destroyed, so threads still running at exit can use it
+Registry& registry() {
+    static Registry* r = new Registry;
+    return *r;
+}
+
+int perfEventOpen(uint64_t config, int group) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return int(::syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+
+// Opens the calling thread's counters, recording why not if it cannot
+int openPerfCounters(Registry& r) {
+    int cycles = perfEventOpen(PERF_COUNT_HW_CPU_CYCLES, -1);
+    int misses = cycles >= 0 ? perfEventOpen(PERF_COUNT_HW_CACHE_MISSES, cycles) : -1;
+    if (misses >= 0) {
+        r.perfCounting = true;
+        r.perfStatus = "cycles and cache misses";
+        return cycles;
+    }
+    if (!r.perfCounting) r.perfStatus = std::string("unavailable (perf_event_open: ") + std::strerror(errno) + ")";
+    if (cycles >= 0) ::close(cycles);
+    return -1;
+}
+
+thread_local ThreadProfile* current = nullptr;
+
+ThreadProfile& thisThread() {
+    if (!current) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.threads.push_back(std::make_unique<ThreadProfile>());
+        current = r.threads.back().get();
+        if (std::getenv("CFLAT_PERF")) current->perf = openPerfCounters(r);
+    }
+    return *current;
+}
+
+// A table cell: value, or "-" where it is not shown
+std::string column(bool shown, double value) {
+    if (!shown) return "-";
+    char cell[32];
+    std::snprintf(cell, sizeof cell, "%.3f", value);
+    return cell;
+}
+
+// A frame's costs summed over every thread and context it ran in
+struct FrameTotals {
+    bool nodeKind = false;
+    uint64_t calls = 0;
+    Cost self, total;
+};
+
+} // namespace
+
+namespace profile {
+
+Scope::Scope(const char* name, bool nodeKind) {
+    ThreadProfile& t = thisThread();
+    uint32_t context = t.enter(t.stack.empty() ? 0 : t.stack.back().context, name, nodeKind);
+    t.stack.push_back({context, t.contexts[context].open++ == 0, {}, {}});
+    // Last, so the bookkeeping above is not charged to the frame
+    t.stack.back().start = t.snapshot();
+}
+
+Scope::~Scope() {
+    ThreadProfile& t = thisThread();
+    Cost now = t.snapshot();
+    OpenFrame frame = t.stack.back();
+    t.stack.pop_back();
+    Cost inclusive = now - frame.start;
+    Context& c = t.contexts[frame.context];
+    ++c.calls;
+    --c.open;
+    c.self += inclusive - frame.callees;
+    if (frame.outermost) c.total += inclusive;
+    if (!t.stack.empty()) t.stack.back().callees += inclusive;
+}
+
+void writeBreakdown(std::ostream& os) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    std::map<std::string, FrameTotals> frames;
+    Cost all;
+    for (const auto& thread : r.threads) {
+        for (size_t i = 1; i < thread->contexts.size(); ++i) {
+            const Context& c = thread->contexts[i];
+            FrameTotals& f = frames[c.name];
+            f.nodeKind = c.nodeKind;
+            f.calls += c.calls;
+            f.self += c.self;
+            f.total += c.total;
+            all += c.self;
+        }
+    }
+    std::vector<std::pair<std::string, FrameTotals>> sorted(frames.begin(), frames.end());
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const auto& a, const auto& b) { return a.second.self.ns > b.second.self.ns; });
+
+    char line[256];
+    const bool counted = r.perfCounting;
+    std::snprintf(line, sizeof line, "profiled %.3f ms on %zu thread(s); perf counters: %s\n", all.ns / 1e6,
+                  r.threads.size(), r.perfStatus.c_str());
+    os << line;
+    for (bool nodeKinds : {true, false}) {
+        std::snprintf(line, sizeof line, "\n%-22s %10s %10s %10s %6s %10s %10s %10s %10s\n",
+                      nodeKinds ? "node kind (check)" : "frame", "calls", "self ms", "total ms", "share",
+                      "allocs", "alloc KB", "Mcycles", "Kmisses");
+        os << line;
+        for (const auto& [name, f] : sorted) {
+            if (f.nodeKind != nodeKinds) continue;
+            std::string cycles = column(counted, f.self.cycles / 1e6);
+            std::string misses = column(counted, f.self.misses / 1e3);
+            std::snprintf(line, sizeof line, "%-22s %10llu %10.3f %10.3f %5.1f%% %10llu %10.1f %10s %10s\n", name.c_str(),
+                          static_cast<unsigned long long>(f.calls), f.self.ns / 1e6, f.total.ns / 1e6,
+                          all.ns ? 100.0 * f.self.ns / all.ns : 0.0, static_cast<unsigned long long>(f.self.allocations),
+                          f.self.bytes / 1024.0, cycles.c_str(), misses.c_str());
+            os << line;
+        }
+    }
+}
+
+void writeFolded(std::ostream& os) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    std::map<std::string, uint64_t> stacks;
+    for (const auto& thread : r.threads) {
+        const std::vector<Context>& contexts = thread->contexts;
+        // Parents come before their children, so each path extends its parent's
+        std::vector<std::string> paths(contexts.size());
+        for (size_t i = 1; i < contexts.size(); ++i) {
+            const Context& c = contexts[i];
+            paths[i] = c.parent ? paths[c.parent] + ";" + c.name : c.name;
+            stacks[paths[i]] += c.self.ns;
+        }
+    }
+    for (const auto& [path, ns] : stacks) {
+        if (ns >= 1000) os << path << " " << ns / 1000 << "\n";
+    }
+}
+
+} // namespace profile
+
+// Counts every allocation for the profile; the rest of the program keeps
+// the default behaviour, including bad_alloc
+void* operator new(std::size_t size) {
+    ++allocations;
+    allocatedBytes += size;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) { return ::operator new(size); }
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    ++allocations;
+    allocatedBytes += size;
+    // aligned_alloc wants a multiple of the alignment
+    std::size_t a = std::size_t(align);
+    std::size_t rounded = (size + a - 1) / a * a;
+    if (void* p = std::aligned_alloc(a, rounded ? rounded : a)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) { return ::operator new(size, align); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+#endif
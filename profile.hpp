@@ -0,0 +1,53 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <iosfwd>
+
+// --- Profiling Hooks ---
+//
+// Scope timers for builds with -DCFLAT_PROFILE (see make profile). A
+// CFLAT_PROFILE_SCOPE names the frame the rest of its block runs in: a
+// build function, a check phase or, with CFLAT_PROFILE_NODE, the rule for
+// one kind of node. Each thread keeps a calling-context tree of the frames
+// it entered, and every context records its calls, its time, the
+// allocations made through the global operator new (which these builds
+// replace with a counting one) and, when CFLAT_PERF is set in the
+// environment and the kernel allows it, the CPU cycles and cache misses
+// perf_event_open counts for the thread. Costs are kept net of the frames
+// entered from a frame, so they add up to the whole run; a frame entered
+// again below itself (buildExp within buildExp) is folded into the outer
+// one, so the tree stays as deep as the number of distinct frames.
+//
+// Elsewhere the macros expand to nothing and none of this is compiled.
+
+#ifdef CFLAT_PROFILE
+
+namespace profile {
+
+class Scope {
+public:
+    // name must outlive the profile (a literal or a static table's entry);
+    // nodeKind puts the frame in the per-node-kind breakdown
+    explicit Scope(const char* name, bool nodeKind = false);
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+};
+
+// Every frame's totals over all threads and contexts, node kinds first,
+// most expensive first, as two tables
+void writeBreakdown(std::ostream& os);
+// One "frame;frame;frame microseconds" line per calling context, net of
+// its callees: the folded stacks flamegraph.pl reads
+void writeFolded(std::ostream& os);
+
+} // namespace profile
+
+#define CFLAT_PROFILE_SCOPE(name) profile::Scope cflatProfileScope(name)
+#define CFLAT_PROFILE_NODE(kind) profile::Scope cflatProfileScope(nodeKindName(kind), true)
+#else
+#define CFLAT_PROFILE_SCOPE(name) ((void)0)
+#define CFLAT_PROFILE_NODE(kind) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,1021 @@
+#include "ast.hpp"
+#include "json_reader.hpp"
+#include <array>
+#include <string_view>
+
+// Streaming (SAX) AST Builder
+//
+// Builds the Program directly from nlohmann's SAX events instead of going
+// through a json DOM first. Each open JSON object/array gets a Frame on an
+// explicit stack. The frame's Role says what that JSON value means in the
+// .astj schema (an Exp, a Type, a list of Decls, ...). Children are stored
+// into the parent's slots as they complete, and a node is constructed when
+// its frame closes. Nothing of the DOM is ever materialized.
+//
+// buildProgram(const nlohmann::json&) in ast.cpp remains the reference path;
+// this builder accepts the same inputs and produces the same tree.
+
+namespace {
+
+using json = nlohmann::json;
+
+// Every key the .astj schema uses, both node tags ("BinOp") and field names ("left")
+enum class Key {
+    Unknown,
+    // Program / top level
+    Structs, Externs, Functions, Name, Fields, Typ, Prms, Rettyp, Locals, Stmts,
+    // Types
+    Struct, Ptr, Array, Fn, Kind,
+    // Places and expressions
+    Id, Deref, ArrayAccess, FieldAccess, Val, Num, Nil, Select, UnOp, BinOp, NewSingle, NewArray, Call,
+    ArrayField, Idx, PtrField, Field, Guard, Tt, Ff, Op, Left, Right, Callee, Args,
+    // Statements
+    Assign, If, While, Return, StmtsTag
+};
+
+struct KeyName {
+    std::string_view name;
+    Key key;
+};
+
+constexpr KeyName kKeyNames[] = {
+    {"structs", Key::Structs}, {"externs", Key::Externs}, {"functions", Key::Functions}, {"name", Key::Name},
+    {"fields", Key::Fields}, {"typ", Key::Typ}, {"prms", Key::Prms}, {"rettyp", Key::Rettyp},
+    {"locals", Key::Locals}, {"stmts", Key::Stmts}, {"Struct", Key::Struct}, {"Ptr", Key::Ptr},
+    {"Array", Key::Array}, {"Fn", Key::Fn}, {"kind", Key::Kind}, {"Id", Key::Id}, {"Deref", Key::Deref},
+    {"ArrayAccess", Key::ArrayAccess}, {"FieldAccess", Key::FieldAccess}, {"Val", Key::Val}, {"Num", Key::Num},
+    {"Nil", Key::Nil}, {"Select", Key::Select}, {"UnOp", Key::UnOp}, {"BinOp", Key::BinOp},
+    {"NewSingle", Key::NewSingle}, {"NewArray", Key::NewArray}, {"Call", Key::Call}, {"array", Key::ArrayField},
+    {"idx", Key::Idx}, {"ptr", Key::PtrField}, {"field", Key::Field}, {"guard", Key::Guard}, {"tt", Key::Tt},
+    {"ff", Key::Ff}, {"op", Key::Op}, {"left", Key::Left}, {"right", Key::Right}, {"callee", Key::Callee},
+    {"args", Key::Args}, {"Assign", Key::Assign}, {"If", Key::If}, {"While", Key::While}, {"Return", Key::Return},
+    {"Stmts", Key::StmtsTag},
+};
+
+// A perfect hash of the names above, all of which are at least two bytes
+constexpr size_t keySlot(std::string_view k) {
+    return (2 * k.size() + 15 * uint8_t(k[0]) + 15 * uint8_t(k[k.size() - 1]) + uint8_t(k[1])) & 127;
+}
+
+// Slot -> 1 + index into kKeyNames, or 0. Built when compiled, which fails
+// if two names ever share a slot.
+constexpr std::array<uint8_t, 128> buildKeyTable() {
+    std::array<uint8_t, 128> table{};
+    for (size_t i = 0; i < std::size(kKeyNames); ++i) {
+        uint8_t& slot = table[keySlot(kKeyNames[i].name)];
+        if (slot) throw std::logic_error("two .astj keys hash to the same slot");
+        slot = uint8_t(i + 1);
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, 128> kKeyTable = buildKeyTable();
+
+Key classifyKey(std::string_view k) {
+    if (k.size() < 2) return Key::Unknown;
+    uint8_t entry = kKeyTable[keySlot(k)];
+    return entry && kKeyNames[entry - 1].name == k ? kKeyNames[entry - 1].key : Key::Unknown;
+}
+
+// What a JSON value means at its position in the schema
+enum class Role {
+    Program, StructList, Struct, ExternList, Extern, FunctionList, Function, DeclList, Decl,
+    Type, FnSig, TypeList,
+    Exp, Place, ArrayAccessBody, FieldAccessBody, SelectBody, UnOpBody, BinOpBody, NewArrayBody,
+    FunCall, ExpList,
+    Stmt, StmtList, AssignBody, IfBody, WhileBody,
+    // Scalar-only positions
+    String, Number,
+    // Anything not in the schema (e.g. the top-level "phantom" key)
+    Ignore
+};
+
+struct Frame {
+    Role role;
+    bool isArray;
+    Key tag = Key::Unknown;   // first key of single-key objects (Exp, Place, Type, Stmt)
+    Key key = Key::Unknown;   // most recent key of an object frame
+    size_t index = 0;         // number of completed elements of an array frame
+    unsigned listsSeen = 0;   // Program only: which of structs/externs/functions were present
+
+    // Slots filled by completed children
+    std::string str;
+    long long num = 0;
+    bool hasNum = false;
+    const Type* type = nullptr;
+    std::vector<const Type*> types;
+    Exp* exps[3] = {};
+    std::vector<Exp*> expList;
+    Place* place = nullptr;
+    Stmt* stmts[2] = {};
+    bool hasElse = false;
+    std::vector<Stmt*> stmtList;
+    FunCall* call = nullptr;
+    std::vector<Decl> decls[2];
+
+    Frame(Role r, bool arr) : role(r), isArray(arr) {}
+};
+
+bool isSingleKeyRole(Role r) {
+    return r == Role::Exp || r == Role::Place || r == Role::Type || r == Role::Stmt;
+}
+
+const Type* simpleType(const std::string& kind) {
+    if (kind == "Int") return TypeContext::intType();
+    if (kind == "Nil") return TypeContext::nilType();
+    throw std::runtime_error("Unknown simple type string: " + kind);
+}
+
+template <typename T>
+T* take(T*& slot, const char* what) {
+    if (!slot) throw std::runtime_error(std::string("Invalid JSON for ") + what + " content");
+    T* node = slot;
+    slot = nullptr;
+    return node;
+}
+
+class SaxBuilder {
+public:
+    using number_integer_t = json::number_integer_t;
+    using number_unsigned_t = json::number_unsigned_t;
+    using number_float_t = json::number_float_t;
+    using string_t = json::string_t;
+    using binary_t = json::binary_t;
+
+    explicit SaxBuilder(size_t maxDepth)
+        : owned(std::make_unique<Program>()), prog(owned.get()), arena(&prog->arena), maxDepth(maxDepth) {}
+    // Builds one function's "stmts" array into an existing program instead
+    SaxBuilder(Program& into, size_t maxDepth)
+        : prog(&into), arena(&prog->arena), maxDepth(maxDepth), rootRole(Role::StmtList) {}
+    // The same, from one of several threads: nodes go into `nodes`, and
+    // the program's types and names are only touched under typesMutex
+    SaxBuilder(Program& into, size_t maxDepth, AstArena& nodes, std::mutex& typesMutex)
+        : prog(&into), arena(&nodes), typesMutex(&typesMutex), maxDepth(maxDepth), rootRole(Role::StmtList) {}
+    // Or from the one thread, with its nodes kept apart from the program's
+    SaxBuilder(Program& into, size_t maxDepth, AstArena& nodes)
+        : prog(&into), arena(&nodes), maxDepth(maxDepth), rootRole(Role::StmtList) {}
+
+    std::unique_ptr<Program> owned;
+    Program* prog;
+    bool sawRoot = false;
+    // The Stmts node built in the statement-list mode
+    Stmt* body = nullptr;
+
+    // Builds [first, last) in the statement-list mode, ready for the next body after
+    Stmt* buildBody(const char* first, const char* last) {
+        CFLAT_PROFILE_SCOPE("SaxBuilder::buildBody");
+        reset();
+        if (fastjson::Reader<SaxBuilder>(first, last, *this).parse(true) != fastjson::Result::Done) {
+            // Nodes built before the fast reader gave up are left unused in the arena
+            reset();
+            json::sax_parse(first, last, this);
+        }
+        return body;
+    }
+
+    bool null() {
+        if (stack.empty()) throw std::runtime_error("Invalid JSON for Program root object");
+        Frame& p = stack.back();
+        Role r = childRole(p);
+        // null means "absent" for Return values and else branches
+        bool allowed = r == Role::Ignore ||
+                       (p.role == Role::Stmt && p.tag == Key::Return) ||
+                       (p.role == Role::IfBody && p.key == Key::Ff);
+        if (!allowed) throw std::runtime_error("Unexpected null in AST JSON");
+        advance();
+        return true;
+    }
+
+    bool boolean(bool) { return scalarIgnoredOnly("boolean"); }
+    bool binary(binary_t&) { return scalarIgnoredOnly("binary value"); }
+
+    bool number_integer(number_integer_t v) { return number(static_cast<long long>(v)); }
+    bool number_unsigned(number_unsigned_t v) { return number(static_cast<long long>(v)); }
+    bool number_float(number_float_t v, const string_t&) { return number(static_cast<long long>(v)); }
+
+    bool string(string_t& s) {
+        if (stack.empty()) throw std::runtime_error("Invalid JSON for Program root object");
+        Frame& p = stack.back();
+        switch (childRole(p)) {
+            case Role::String: p.str = std::move(s); break;
+            case Role::Type: deliverType(p, simpleType(s)); break;
+            case Role::Exp:
+                if (s != "Nil") throw std::runtime_error("Invalid JSON for Exp: Must be non-empty object or known literal");
+                deliverExp(p, make<NilExp>());
+                break;
+            case Role::Stmt:
+                if (s == "Break") deliverStmt(p, make<Break>());
+                else if (s == "Continue") deliverStmt(p, make<Continue>());
+                else throw std::runtime_error("Unknown simple string statement: " + s);
+                break;
+            case Role::Ignore: break;
+            default: throw std::runtime_error("Unexpected string \"" + s + "\" in AST JSON");
+        }
+        advance();
+        return true;
+    }
+
+    bool start_object(std::size_t) { return open(false); }
+    bool start_array(std::size_t) { return open(true); }
+
+    bool key(string_t& k) {
+        Frame& f = stack.back();
+        f.key = classifyKey(k);
+        if (isSingleKeyRole(f.role) && f.tag == Key::Unknown) {
+            f.tag = f.key;
+            if (f.tag == Key::Unknown && f.role != Role::Type) {
+                throw std::runtime_error("Unknown/Unhandled node kind: " + k);
+            }
+        }
+        return true;
+    }
+
+    bool end_object() { close(); return true; }
+    bool end_array() { close(); return true; }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) {
+        // Rethrow as the same exception type the DOM parser would throw
+        if (const auto* pe = dynamic_cast<const json::parse_error*>(&ex)) throw *pe;
+        throw std::runtime_error(ex.what());
+    }
+
+private:
+    void reset() {
+        sawRoot = false;
+        body = nullptr;
+        stack.clear();
+    }
+
+    AstArena* arena;
+    std::mutex* typesMutex = nullptr;
+    // Names this builder has interned, so a thread locks once per name
+    std::unordered_map<std::string, Symbol> symbols;
+    std::vector<Frame> stack;
+    size_t maxDepth;
+    Role rootRole = Role::Program;
+
+    bool scalarIgnoredOnly(const char* what) {
+        if (stack.empty() || childRole(stack.back()) != Role::Ignore) {
+            throw std::runtime_error(std::string("Unexpected ") + what + " in AST JSON");
+        }
+        advance();
+        return true;
+    }
+
+    bool number(long long v) {
+        if (stack.empty()) throw std::runtime_error("Invalid JSON for Program root object");
+        Frame& p = stack.back();
+        Role r = childRole(p);
+        if (r == Role::Number) {
+            p.num = v;
+            p.hasNum = true;
+        } else if (r != Role::Ignore) {
+            throw std::runtime_error("Unexpected number in AST JSON");
+        }
+        advance();
+        return true;
+    }
+
+    // An element of the enclosing array is complete
+    void advance() {
+        if (!stack.empty() && stack.back().isArray) {
+            ++stack.back().index;
+        }
+    }
+
+    bool open(bool isArray) {
+        Role r;
+        if (stack.empty()) {
+            if (rootRole == Role::StmtList) {
+                if (sawRoot || !isArray) throw std::runtime_error("Invalid JSON: function 'stmts' must be an array");
+            } else if (sawRoot || isArray) {
+                throw std::runtime_error("Invalid JSON for Program root object");
+            }
+            sawRoot = true;
+            r = rootRole;
+        } else {
+            r = childRole(stack.back());
+        }
+        if (r == Role::String || r == Role::Number) {
+            throw std::runtime_error("Invalid JSON: expected a scalar value");
+        }
+        if (stack.size() == maxDepth) throwNestingTooDeep(maxDepth);
+        stack.emplace_back(r, isArray);
+        return true;
+    }
+
+    // The Role of the next value inside frame p, from p's Role and current key/index
+    static Role childRole(const Frame& p) {
+        switch (p.role) {
+            case Role::Program:
+                switch (p.key) {
+                    case Key::Structs: return Role::StructList;
+                    case Key::Externs: return Role::ExternList;
+                    case Key::Functions: return Role::FunctionList;
+                    default: return Role::Ignore;
+                }
+            case Role::StructList: return Role::Struct;
+            case Role::ExternList: return Role::Extern;
+            case Role::FunctionList: return Role::Function;
+            case Role::Struct:
+                if (p.key == Key::Name) return Role::String;
+                if (p.key == Key::Fields) return Role::DeclList;
+                return Role::Ignore;
+            case Role::Extern:
+                if (p.key == Key::Name) return Role::String;
+                if (p.key == Key::Typ) return Role::Type;
+                return Role::Ignore;
+            case Role::Function:
+                switch (p.key) {
+                    case Key::Name: return Role::String;
+                    case Key::Prms: case Key::Locals: return Role::DeclList;
+                    case Key::Rettyp: return Role::Type;
+                    case Key::Stmts: return Role::StmtList;
+                    default: return Role::Ignore;
+                }
+            case Role::DeclList: return Role::Decl;
+            case Role::Decl:
+                if (p.key == Key::Name) return Role::String;
+                if (p.key == Key::Typ) return Role::Type;
+                return Role::Ignore;
+            case Role::Type:
+                if (p.isArray) throw std::runtime_error("Invalid JSON for Type");
+                switch (p.key) {
+                    case Key::Struct: case Key::Kind: return Role::String;
+                    case Key::Ptr: case Key::Array: return Role::Type;
+                    case Key::Fn: return Role::FnSig;
+                    default: return Role::Ignore;
+                }
+            case Role::FnSig:
+                if (p.index == 0) return Role::TypeList;
+                if (p.index == 1) return Role::Type;
+                throw std::runtime_error("Invalid JSON for Fn type signature");
+            case Role::TypeList: return Role::Type;
+            case Role::Exp:
+            case Role::Place:
+                if (p.isArray) throw std::runtime_error("Invalid JSON for Exp: Must be non-empty object or known literal");
+                if (p.key != p.tag) return Role::Ignore;
+                switch (p.tag) {
+                    case Key::Id: return Role::String;
+                    case Key::Deref: return Role::Exp;
+                    case Key::ArrayAccess: return Role::ArrayAccessBody;
+                    case Key::FieldAccess: return Role::FieldAccessBody;
+                    default: break;
+                }
+                if (p.role == Role::Place) throw std::runtime_error("JSON node is not a valid Place kind");
+                switch (p.tag) {
+                    case Key::Num: return Role::Number;
+                    case Key::Nil: return Role::Ignore;
+                    case Key::Select: return Role::SelectBody;
+                    case Key::UnOp: return Role::UnOpBody;
+                    case Key::BinOp: return Role::BinOpBody;
+                    case Key::NewSingle: return Role::Type;
+                    case Key::NewArray: return Role::NewArrayBody;
+                    case Key::Call: return Role::FunCall;
+                    case Key::Val: return Role::Place;
+                    case Key::Kind: return Role::String;
+                    default: throw std::runtime_error("Unknown/Unhandled expression kind");
+                }
+            case Role::ArrayAccessBody:
+                return (p.key == Key::ArrayField || p.key == Key::Idx) ? Role::Exp : Role::Ignore;
+            case Role::FieldAccessBody:
+                if (p.key == Key::PtrField) return Role::Exp;
+                if (p.key == Key::Field) return Role::String;
+                return Role::Ignore;
+            case Role::SelectBody:
+                return (p.key == Key::Guard || p.key == Key::Tt || p.key == Key::Ff) ? Role::Exp : Role::Ignore;
+            case Role::UnOpBody:
+                if (p.index == 0) return Role::String;
+                if (p.index == 1) return Role::Exp;
+                throw std::runtime_error("Invalid JSON for UnOp content: Expected 2-element array [op, exp]");
+            case Role::BinOpBody:
+                if (p.key == Key::Op) return Role::String;
+                if (p.key == Key::Left || p.key == Key::Right) return Role::Exp;
+                return Role::Ignore;
+            case Role::NewArrayBody:
+                if (p.index == 0) return Role::Type;
+                if (p.index == 1) return Role::Exp;
+                throw std::runtime_error("Invalid JSON for NewArray content: Expected 2-element array [Type, Exp]");
+            case Role::FunCall:
+                if (p.key == Key::Callee) return Role::Exp;
+                if (p.key == Key::Args) return Role::ExpList;
+                return Role::Ignore;
+            case Role::ExpList: return Role::Exp;
+            case Role::Stmt:
+                if (p.isArray) return Role::Stmt; // an array of statements is a Stmts node
+                if (p.key != p.tag) return Role::Ignore;
+                switch (p.tag) {
+                    case Key::Assign: return Role::AssignBody;
+                    case Key::Call: return Role::FunCall;
+                    case Key::If: return Role::IfBody;
+                    case Key::While: return Role::WhileBody;
+                    case Key::Return: return Role::Exp;
+                    case Key::StmtsTag: return Role::StmtList;
+                    default: throw std::runtime_error("Unknown statement kind object");
+                }
+            case Role::StmtList: return Role::Stmt;
+            case Role::AssignBody:
+                if (p.index == 0) return Role::Place;
+                if (p.index == 1) return Role::Exp;
+                throw std::runtime_error("Invalid JSON for Assign content: Expected [Place, Exp]");
+            case Role::IfBody:
+                if (p.key == Key::Guard) return Role::Exp;
+                if (p.key == Key::Tt || p.key == Key::Ff) return Role::Stmt;
+                return Role::Ignore;
+            case Role::WhileBody:
+                if (p.index == 0) return Role::Exp;
+                if (p.index == 1) return Role::Stmt;
+                throw std::runtime_error("Invalid JSON for While content: Expected [GuardExp, BodyStmtArray]");
+            case Role::String:
+            case Role::Number:
+            case Role::Ignore:
+                return Role::Ignore;
+        }
+        return Role::Ignore;
+    }
+
+    std::unique_lock<std::mutex> lockTypes() {
+        return typesMutex ? std::unique_lock<std::mutex>(*typesMutex) : std::unique_lock<std::mutex>();
+    }
+    Symbol intern(const std::string& name) {
+        if (!typesMutex) return prog->types.symbols.intern(name);
+        auto it = symbols.find(name);
+        if (it != symbols.end()) return it->second;
+        auto lock = lockTypes();
+        return symbols[name] = prog->types.symbols.intern(name);
+    }
+    const Type* structType(Symbol name) {
+        auto lock = lockTypes();
+        return prog->types.structType(name);
+    }
+    const Type* ptrTo(const Type* pointee) {
+        auto lock = lockTypes();
+        return prog->types.ptrTo(pointee);
+    }
+    const Type* arrayOf(const Type* element) {
+        auto lock = lockTypes();
+        return prog->types.arrayOf(element);
+    }
+    const Type* fnType(const std::vector<const Type*>& params, const Type* ret) {
+        auto lock = lockTypes();
+        return prog->types.fnType(params, ret);
+    }
+    template <typename T, typename... Args>
+    T* make(Args&&... args) { return arena->make<T>(std::forward<Args>(args)...); }
+
+    // --- Delivering completed children into their parent frame ---
+
+    static void deliverType(Frame& p, const Type* t) {
+        if (p.role == Role::TypeList) p.types.push_back(t);
+        else p.type = t;
+    }
+
+    static void deliverExp(Frame& p, Exp* e) {
+        switch (p.role) {
+            case Role::ExpList: p.expList.push_back(e); return;
+            case Role::ArrayAccessBody: p.exps[p.key == Key::Idx ? 1 : 0] = e; return;
+            case Role::SelectBody: p.exps[p.key == Key::Guard ? 0 : p.key == Key::Tt ? 1 : 2] = e; return;
+            case Role::BinOpBody: p.exps[p.key == Key::Right ? 1 : 0] = e; return;
+            default: p.exps[0] = e; return;
+        }
+    }
+
+    static void deliverStmt(Frame& p, Stmt* s) {
+        if (p.role == Role::StmtList || (p.role == Role::Stmt && p.isArray)) {
+            p.stmtList.push_back(s);
+        } else if (p.role == Role::IfBody && p.key == Key::Ff) {
+            p.stmts[1] = s;
+            p.hasElse = true;
+        } else {
+            p.stmts[0] = s;
+        }
+    }
+
+    void close() {
+        Frame f = std::move(stack.back());
+        stack.pop_back();
+        if (stack.empty()) {
+            if (f.role == Role::StmtList) {
+                body = make<Stmts>(arena->list(f.stmtList));
+                return;
+            }
+            if (f.role != Role::Program || f.listsSeen != 7) throw std::runtime_error("Invalid JSON for Program root object");
+            return;
+        }
+        Frame& p = stack.back();
+
+        switch (f.role) {
+            case Role::StructList: p.listsSeen |= 1; break;
+            case Role::ExternList: p.listsSeen |= 2; break;
+            case Role::FunctionList: p.listsSeen |= 4; break;
+            case Role::Program:
+            case Role::Ignore:
+                break;
+
+            case Role::Struct: {
+                auto s = make<StructDef>();
+                s->name = intern(f.str);
+                s->fields = arena->list(f.decls[0]);
+                prog->structs.push_back(s);
+                break;
+            }
+            case Role::Extern: {
+                if (!f.type) throw std::runtime_error("Invalid JSON for Extern definition: missing 'name' or 'typ'");
+                auto fn_type = dyn_cast<FnType>(f.type);
+                if (!fn_type) {
+                    throw std::runtime_error("Invalid JSON for Extern definition: 'typ' field is not a function type (Fn)");
+                }
+                Extern& e = prog->externs.emplace_back();
+                e.name = intern(f.str);
+                e.type = fn_type;
+                break;
+            }
+            case Role::Function: {
+                if (!f.type || !f.stmts[0]) throw std::runtime_error("Invalid JSON for Function definition");
+                auto func = make<FunctionDef>();
+                func->name = intern(f.str);
+                func->rettype = f.type;
+                func->params = arena->list(f.decls[0]);
+                func->locals = arena->list(f.decls[1]);
+                func->signature = signatureOf(prog->types, func->params, func->rettype);
+                func->body = f.stmts[0];
+                prog->functions.push_back(func);
+                break;
+            }
+            case Role::DeclList:
+                if (p.role == Role::Function && p.key == Key::Locals) p.decls[1] = std::move(f.decls[0]);
+                else p.decls[0] = std::move(f.decls[0]);
+                break;
+            case Role::Decl:
+                if (!f.type) throw std::runtime_error("Invalid JSON for Decl");
+                p.decls[0].emplace_back(intern(f.str), f.type);
+                break;
+
+            case Role::Type:
+                deliverType(p, finishType(f));
+                break;
+            case Role::FnSig:
+                if (f.index != 2) throw std::runtime_error("Invalid JSON for Fn type signature");
+                deliverType(p, fnType(f.types, f.type));
+                break;
+            case Role::TypeList:
+                p.types = std::move(f.types);
+                break;
+
+            case Role::Exp:
+                deliverExp(p, finishExp(f));
+                break;
+            case Role::Place:
+                p.place = finishPlace(f);
+                break;
+            case Role::ArrayAccessBody:
+                if (!f.exps[0] || !f.exps[1]) throw std::runtime_error("Invalid JSON for ArrayAccess content");
+                p.place = make<ArrayAccess>(f.exps[0], f.exps[1]);
+                break;
+            case Role::FieldAccessBody:
+                if (!f.exps[0]) throw std::runtime_error("Invalid JSON for FieldAccess content");
+                p.place = make<FieldAccess>(f.exps[0], intern(f.str));
+                break;
+            case Role::SelectBody:
+                if (!f.exps[0] || !f.exps[1] || !f.exps[2]) throw std::runtime_error("Invalid JSON for Select content");
+                p.exps[0] = make<Select>(f.exps[0], f.exps[1], f.exps[2]);
+                break;
+            case Role::UnOpBody:
+                if (f.index != 2) throw std::runtime_error("Invalid JSON for UnOp content: Expected 2-element array [op, exp]");
+                p.exps[0] = make<UnOp>(unaryOpNamed(f.str), f.exps[0]);
+                break;
+            case Role::BinOpBody:
+                if (!f.exps[0] || !f.exps[1]) throw std::runtime_error("Invalid JSON for BinOp content");
+                p.exps[0] = make<BinOp>(binaryOpNamed(f.str), f.exps[0], f.exps[1]);
+                break;
+            case Role::NewArrayBody:
+                if (f.index != 2) throw std::runtime_error("Invalid JSON for NewArray content: Expected 2-element array [Type, Exp]");
+                p.exps[0] = make<NewArray>(f.type, f.exps[0], arrayOf(f.type));
+                break;
+            case Role::FunCall:
+                if (!f.exps[0]) throw std::runtime_error("Invalid JSON for FunCall");
+                p.call = make<FunCall>(f.exps[0], arena->list(f.expList));
+                break;
+            case Role::ExpList:
+                p.expList = std::move(f.expList);
+                break;
+
+            case Role::Stmt:
+                if (f.isArray) {
+                    // An empty array for "ff" means there is no else branch
+                    if (p.role == Role::IfBody && p.key == Key::Ff && f.stmtList.empty()) break;
+                    deliverStmt(p, make<Stmts>(arena->list(f.stmtList)));
+                } else {
+                    deliverStmt(p, finishStmt(f));
+                }
+                break;
+            case Role::StmtList: {
+                if (!f.isArray) throw std::runtime_error("Invalid JSON: function 'stmts' must be an array");
+                deliverStmt(p, make<Stmts>(arena->list(f.stmtList)));
+                break;
+            }
+            case Role::AssignBody:
+                if (f.index != 2) throw std::runtime_error("Invalid JSON for Assign content: Expected [Place, Exp]");
+                p.stmts[0] = make<Assign>(f.place, f.exps[0]);
+                break;
+            case Role::IfBody: {
+                if (!f.exps[0] || !f.stmts[0]) throw std::runtime_error("Invalid JSON for If content: Missing guard or tt");
+                std::optional<Stmt*> ff = std::nullopt;
+                if (f.hasElse) ff = f.stmts[1];
+                p.stmts[0] = make<If>(f.exps[0], f.stmts[0], ff);
+                break;
+            }
+            case Role::WhileBody:
+                if (f.index != 2) throw std::runtime_error("Invalid JSON for While content: Expected [GuardExp, BodyStmtArray]");
+                p.stmts[0] = make<While>(f.exps[0], f.stmts[0]);
+                break;
+
+            case Role::String:
+            case Role::Number:
+                throw std::runtime_error("Invalid JSON: expected a scalar value");
+        }
+        advance();
+    }
+
+    const Type* finishType(Frame& f) {
+        switch (f.tag) {
+            case Key::Struct: return structType(intern(f.str));
+            case Key::Ptr:
+                if (!f.type) break;
+                return ptrTo(f.type);
+            case Key::Array:
+                if (!f.type) break;
+                return arrayOf(f.type);
+            case Key::Fn:
+                if (!f.type) break;
+                return f.type;
+            case Key::Kind: return simpleType(f.str);
+            default: break;
+        }
+        throw std::runtime_error("Invalid JSON for Type");
+    }
+
+    Place* finishPlace(Frame& f) {
+        switch (f.tag) {
+            case Key::Id: return make<Id>(intern(f.str));
+            case Key::Deref: return make<Deref>(take(f.exps[0], "Deref"));
+            case Key::ArrayAccess:
+            case Key::FieldAccess:
+                return take(f.place, "Place");
+            default:
+                throw std::runtime_error("Invalid JSON for Place: Must be non-empty object");
+        }
+    }
+
+    Exp* finishExp(Frame& f) {
+        switch (f.tag) {
+            // Places wrapped in Val
+            case Key::Id:
+            case Key::Deref:
+            case Key::ArrayAccess:
+            case Key::FieldAccess:
+                return make<Val>(finishPlace(f));
+            case Key::Val: return make<Val>(take(f.place, "Val"));
+            case Key::Num:
+                if (!f.hasNum) throw std::runtime_error("Invalid JSON for Num content");
+                return make<Num>(f.num);
+            case Key::Nil: return make<NilExp>();
+            case Key::Kind:
+                if (f.str == "Nil") return make<NilExp>();
+                break;
+            case Key::NewSingle:
+                if (!f.type) break;
+                return make<NewSingle>(f.type, ptrTo(f.type));
+            case Key::Call: return make<CallExp>(take(f.call, "Call"));
+            case Key::Select:
+            case Key::UnOp:
+            case Key::BinOp:
+            case Key::NewArray:
+                return take(f.exps[0], "expression");
+            default: break;
+        }
+        throw std::runtime_error("Invalid JSON for Exp: Must be non-empty object or known literal");
+    }
+
+    Stmt* finishStmt(Frame& f) {
+        switch (f.tag) {
+            case Key::Call: return make<CallStmt>(take(f.call, "Call"));
+            case Key::Return: {
+                std::optional<Exp*> exp = std::nullopt;
+                if (f.exps[0]) exp = f.exps[0];
+                return make<Return>(exp);
+            }
+            case Key::Assign:
+            case Key::If:
+            case Key::While:
+            case Key::StmtsTag:
+                return take(f.stmts[0], "statement");
+            default:
+                throw std::runtime_error("Invalid JSON for Stmt: Expected non-empty object, array, or specific string (Break/Continue)");
+        }
+    }
+};
+
+} // namespace
+
+// Builds the Program straight from the token stream of 'in'
+std::unique_ptr<Program> buildProgramSax(std::istream& in, size_t maxDepth) {
+    CFLAT_PROFILE_SCOPE("buildProgramSax");
+    SaxBuilder builder(maxDepth);
+    nlohmann::json::sax_parse(in, &builder);
+    if (!builder.sawRoot) throw std::runtime_error("Invalid JSON for Program root object");
+    return std::move(builder.owned);
+}
+
+// The same over characters already in memory, read by the fast reader
+// (json_reader.hpp) unless it gives up on the text
+std::unique_ptr<Program> buildProgramSax(const char* first, const char* last, size_t maxDepth) {
+    CFLAT_PROFILE_SCOPE("buildProgramSax");
+    {
+        SaxBuilder builder(maxDepth);
+        if (fastjson::Reader<SaxBuilder>(first, last, builder).parse(true) == fastjson::Result::Done) {
+            if (!builder.sawRoot) throw std::runtime_error("Invalid JSON for Program root object");
+            return std::move(builder.owned);
+        }
+    }
+    SaxBuilder builder(maxDepth);
+    nlohmann::json::sax_parse(first, last, &builder);
+    if (!builder.sawRoot) throw std::runtime_error("Invalid JSON for Program root object");
+    return std::move(builder.owned);
+}
+
+// --- First-Error Mode ---
+//
+// checkProgramFirstError reads the program in two passes. A structural
+// scan of the text (strings and brackets only, nothing is tokenized)
+// finds the "stmts" value of every function, and the first pass builds
+// the text with those cut out: the structs, externs and function headers.
+// The top-level premises and the structs are checked on that; then each
+// body is built from its range and checked in turn, so nothing after the
+// failing function is built. Whatever the scan does not expect, and any
+// error while building, falls back to buildProgramSax over the whole text,
+// which reports exactly the error the normal path would.
+//
+// checkProgramStreaming is the same walk, but each body lives in an arena
+// of its own that is freed once it has checked, so the memory it needs is
+// the headers plus the largest function rather than the whole program.
+// The input text itself is mapped, not copied (see InputFile).
+
+namespace {
+
+using Range = std::pair<const char*, const char*>;
+
+// Walks JSON text by its structure only. Every method returns false on
+// text it does not expect, leaving the diagnosis to the real parser.
+class BodyScanner {
+public:
+    BodyScanner(const char* first, const char* last) : p(first), end(last) {}
+
+    // The "stmts" range of each element of the root's "functions" arrays
+    bool scan(std::vector<Range>& bodies) {
+        return object([&](std::string_view key) {
+            if (key != "functions") return skip();
+            return array([&]() {
+                Range body{nullptr, nullptr};
+                bool ok = object([&](std::string_view field) {
+                    if (field != "stmts") return skip();
+                    body.first = p;
+                    bool skipped = skip();
+                    body.second = p;
+                    return skipped;
+                });
+                if (!ok || !body.first) return false;
+                bodies.push_back(body);
+                return true;
+            });
+        });
+    }
+
+private:
+    const char* p;
+    const char* end;
+
+    // Skips whitespace; false at the end of the text
+    bool ws() {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) ++p;
+        return p < end;
+    }
+
+    // A string at p, without unescaping it
+    bool string(std::string_view& out) {
+        if (*p != '"') return false;
+        for (const char* q = p + 1; q < end; ++q) {
+            if (*q == '\\') {
+                ++q;
+            } else if (*q == '"') {
+                out = std::string_view(p + 1, size_t(q - p - 1));
+                p = q + 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // One value of any kind, an object or array with everything inside it
+    bool skip() {
+        std::string_view ignored;
+        if (*p == '"') return string(ignored);
+        if (*p != '{' && *p != '[') {
+            while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\n' && *p != '\r' &&
+                   *p != '\t') {
+                ++p;
+            }
+            return true;
+        }
+        size_t depth = 0;
+        while (p < end) {
+            char c = *p;
+            if (c == '"') {
+                if (!string(ignored)) return false;
+                continue;
+            }
+            ++p;
+            if (c == '{' || c == '[') {
+                ++depth;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename OnValue>
+    bool object(OnValue onValue) {
+        if (!ws() || *p != '{') return false;
+        ++p;
+        if (!ws()) return false;
+        if (*p == '}') {
+            ++p;
+            return true;
+        }
+        for (;;) {
+            std::string_view key;
+            if (!string(key) || !ws() || *p != ':') return false;
+            ++p;
+            if (!ws() || !onValue(key) || !ws()) return false;
+            if (*p == '}') {
+                ++p;
+                return true;
+            }
+            if (*p != ',') return false;
+            ++p;
+            if (!ws()) return false;
+        }
+    }
+
+    template <typename OnElement>
+    bool array(OnElement onElement) {
+        if (*p != '[') return false;
+        ++p;
+        if (!ws()) return false;
+        if (*p == ']') {
+            ++p;
+            return true;
+        }
+        for (;;) {
+            if (!onElement() || !ws()) return false;
+            if (*p == ']') {
+                ++p;
+                return true;
+            }
+            if (*p != ',') return false;
+            ++p;
+            if (!ws()) return false;
+        }
+    }
+};
+
+// The levels above a body: the root object, "functions" and the function
+constexpr size_t kBodyNesting = 3;
+
+// [first, last) with every body replaced by an empty list
+std::string withoutBodies(const char* first, const char* last, const std::vector<Range>& bodies) {
+    std::string headers;
+    const char* from = first;
+    for (const Range& body : bodies) {
+        headers.append(from, body.first).append("[]");
+        from = body.second;
+    }
+    headers.append(from, last);
+    return headers;
+}
+
+} // namespace
+
+// Builds and checks each body in turn; with release, into bodyNodes, which
+// is emptied once the body has checked
+static void checkInTurn(const char* first, const char* last, std::unique_ptr<Program>& prog, size_t maxDepth,
+                        bool release) {
+    CFLAT_PROFILE_SCOPE("checkInTurn");
+    auto fallBack = [&]() {
+        prog = buildProgramSax(first, last, maxDepth);
+        prog->check();
+    };
+    std::vector<Range> bodies;
+    if (maxDepth <= kBodyNesting || !BodyScanner(first, last).scan(bodies)) return fallBack();
+
+    // Pass 1: everything but the bodies, each replaced by an empty list
+    std::string headers = withoutBodies(first, last, bodies);
+    try {
+        prog = buildProgramSax(headers.data(), headers.data() + headers.size(), maxDepth);
+    } catch (...) {
+        return fallBack();
+    }
+    if (prog->functions.size() != bodies.size()) return fallBack();
+    // Pass 1's text is not needed once it is built
+    std::string().swap(headers);
+
+    // The phases of Program::check, with each body built just before its check
+    prog->checkTopLevel();
+    Gamma gamma = construct_gamma(prog->types, prog->externs, prog->functions);
+    Delta delta = construct_delta(prog->types, prog->structs);
+    for (const StructDef* s : prog->structs) s->check(gamma, delta);
+    AstArena bodyNodes;
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        SaxBuilder builder = release ? SaxBuilder(*prog, maxDepth - kBodyNesting, bodyNodes)
+                                     : SaxBuilder(*prog, maxDepth - kBodyNesting);
+        Stmt* body;
+        try {
+            body = builder.buildBody(bodies[i].first, bodies[i].second);
+        } catch (...) {
+            return fallBack();
+        }
+        if (!body) return fallBack();
+        FunctionDef* function = prog->functions[i];
+        function->body = body;
+        if (!release) {
+            function->check(gamma, delta);
+            continue;
+        }
+        try {
+            function->check(gamma, delta);
+        } catch (...) {
+            // The error renders from this body after we return
+            prog->arena.adopt(bodyNodes);
+            throw;
+        }
+        function->body = nullptr;
+        bodyNodes.release();
+    }
+}
+
+void checkProgramFirstError(const char* first, const char* last, std::unique_ptr<Program>& prog, size_t maxDepth) {
+    checkInTurn(first, last, prog, maxDepth, false);
+}
+
+void checkProgramStreaming(const char* first, const char* last, std::unique_ptr<Program>& prog, size_t maxDepth) {
+    checkInTurn(first, last, prog, maxDepth, true);
+}
+
+// --- Parallel Building ---
+//
+// buildProgramParallel splits the text the way first-error mode does: the
+// headers are built first, on one thread, and the bodies found by the
+// scan are then built on `jobs` threads. Bodies are handed out in
+// contiguous runs, a few per thread so that uneven sizes even out, and
+// each run builds into an arena of its own, which the program adopts once
+// every run is done. The bodies land in Program::functions by index, so
+// the result is the tree buildProgramSax builds; only the order in which
+// names and types are first interned can differ. Anything unexpected,
+// including any error in any body, falls back to buildProgramSax over the
+// whole text, so errors are reported exactly as the sequential path does.
+
+std::unique_ptr<Program> buildProgramParallel(const char* first, const char* last, unsigned jobs, size_t maxDepth) {
+    CFLAT_PROFILE_SCOPE("buildProgramParallel");
+    auto fallBack = [&]() { return buildProgramSax(first, last, maxDepth); };
+    std::vector<Range> bodies;
+    if (jobs <= 1 || maxDepth <= kBodyNesting || !BodyScanner(first, last).scan(bodies) || bodies.size() < 2) {
+        return fallBack();
+    }
+    std::string headers = withoutBodies(first, last, bodies);
+    std::unique_ptr<Program> prog;
+    try {
+        prog = buildProgramSax(headers.data(), headers.data() + headers.size(), maxDepth);
+    } catch (...) {
+        return fallBack();
+    }
+    if (prog->functions.size() != bodies.size()) return fallBack();
+
+    const size_t runs = std::min<size_t>(bodies.size(), size_t(jobs) * 4);
+    std::vector<AstArena> arenas(runs);
+    std::mutex typesMutex;
+    try {
+        forEachInOrder(runs, jobs, [&](size_t run) {
+            SaxBuilder builder(*prog, maxDepth - kBodyNesting, arenas[run], typesMutex);
+            for (size_t i = bodies.size() * run / runs; i < bodies.size() * (run + 1) / runs; ++i) {
+                Stmt* body = builder.buildBody(bodies[i].first, bodies[i].second);
+                if (!body) throw std::runtime_error("body not built");
+                prog->functions[i]->body = body;
+            }
+        });
+    } catch (...) {
+        return fallBack();
+    }
+    for (AstArena& arena : arenas) prog->arena.adopt(arena);
+    return prog;
+}
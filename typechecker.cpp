@@ -1,54 +1,784 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "ast.hpp"
 #include "json.hpp"
 
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <input.astj>" << std::endl;
-        return 1;
+// Outcome of checking one input file
+struct CheckResult {
+    enum Status { Valid, Invalid, Error } status;
+    // The TypeError text when Invalid, the full diagnostic when Error
+    std::string message;
+    // The Program::printTypes listing when Valid and it was asked for
+    std::string types = {};
+    // The TypeErrors after the first when Invalid, with --max-errors
+    std::vector<std::string> moreErrors = {};
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// What --stats reports about checking one input
+struct RunStats {
+    // Reading the input, parsing its JSON DOM, then building the AST from
+    // that. With --sax, parsing is part of building; .astb input is read
+    // and built by its loader, all in buildSeconds.
+    double readSeconds = 0, parseSeconds = 0, buildSeconds = 0;
+    CheckStats check;
+    size_t nodes[kNodeKindCount] = {};
+    size_t typesAllocated = 0;
+    // Only counted in builds with CFLAT_STATS
+    uint64_t typeEqCalls = 0;
+    // The checked functions and their times, slowest first
+    std::vector<std::pair<std::string, double>> functions;
+};
+
+// How checkFile reads, checks and reports one input (see the options in main)
+struct CheckOptions {
+    // --sax builds the AST straight from the token stream instead of a json DOM
+    bool useSax = false;
+    // --jobs N checks function bodies on N threads (0: one per core);
+    // in batch mode it is the number of files checked at once. With --sax,
+    // the bodies of an input of kParallelBuildBytes or more are also built
+    // on N threads (see buildProgramParallel).
+    unsigned jobs = 1;
+    // --max-depth N rejects inputs nested deeper than N JSON levels
+    size_t maxDepth = kDefaultMaxDepth;
+    // --dump-types lists the type of every statement's expressions after "valid"
+    bool dumpTypes = false;
+    // --emit-binary FILE also saves the built program as .astb
+    std::string emitPath;
+    // --cache FILE skips the functions unchanged since a run that passed them
+    CheckCache* cache = nullptr;
+    // --first-error builds each function only once the ones before it
+    // checked, stopping at the first error (see checkProgramFirstError).
+    // It checks sequentially, does not consult the cache and, building
+    // from .astj text, refuses .astb input.
+    bool firstError = false;
+    // --stream checks like --first-error, but frees each function body once
+    // it has checked, for inputs too big to hold whole (see
+    // checkProgramStreaming). It cannot list types, emit a binary or check
+    // .astb input.
+    bool stream = false;
+    // --flat checks function bodies over a flat lowering of the program
+    // instead of walking the tree (see flat_checker.cpp); same results
+    bool flat = false;
+    // --max-errors N reports up to N type errors instead of the first only
+    // (0: off), carrying on past each one (see Diagnostics)
+    size_t maxErrors = 0;
+    // --stats and --stats-json report how the run spent its time here
+    RunStats* stats = nullptr;
+};
+
+// Fills options.stats from the program when checkInput returns, however it
+// returns; declared after the program, so it runs while that still exists
+class StatsCollector {
+public:
+    StatsCollector(RunStats* stats, const std::unique_ptr<Program>& program) : stats(stats), program(program) {
+#ifdef CFLAT_STATS
+        typeEqStart = hotCounters.typeEqCalls.load();
+#endif
+    }
+    ~StatsCollector() {
+        if (!stats || !program) return;
+#ifdef CFLAT_STATS
+        stats->typeEqCalls = hotCounters.typeEqCalls.load() - typeEqStart;
+#endif
+        stats->typesAllocated = program->types.allocated();
+        countNodes();
+        const std::vector<double>& seconds = stats->check.functionSeconds;
+        for (size_t i = 0; i < seconds.size(); ++i) {
+            if (seconds[i] >= 0) stats->functions.emplace_back(program->functions[i]->name.str(), seconds[i]);
+        }
+        std::stable_sort(stats->functions.begin(), stats->functions.end(),
+                         [](const auto& a, const auto& b) { return a.second > b.second; });
     }
+    StatsCollector(const StatsCollector&) = delete;
+    StatsCollector& operator=(const StatsCollector&) = delete;
 
-    std::ifstream inputFile(argv[1]);
-    if (!inputFile.is_open()) {
-        std::cerr << "Error: Could not open file " << argv[1] << std::endl;
-        return 1;
+private:
+    void countNodes() {
+        size_t* nodes = stats->nodes;
+        ++nodes[size_t(NodeKind::Program)];
+        nodes[size_t(NodeKind::StructDef)] += program->structs.size();
+        nodes[size_t(NodeKind::Extern)] += program->externs.size();
+        nodes[size_t(NodeKind::FunctionDef)] += program->functions.size();
+        for (const StructDef* s : program->structs) nodes[size_t(NodeKind::Decl)] += s->fields.size();
+        std::vector<const Node*> pending, kids;
+        for (const FunctionDef* f : program->functions) {
+            nodes[size_t(NodeKind::Decl)] += f->params.size() + f->locals.size();
+            if (f->body) pending.push_back(f->body);
+            while (!pending.empty()) {
+                const Node* node = pending.back();
+                pending.pop_back();
+                ++nodes[size_t(node->kind)];
+                childrenOf(node, kids);
+                pending.insert(pending.end(), kids.begin(), kids.end());
+            }
+        }
+    }
+
+    RunStats* stats;
+    const std::unique_ptr<Program>& program;
+    uint64_t typeEqStart = 0;
+};
+
+// Prints stats to os as a short report, or with json as one JSON object
+static void printStats(const RunStats& stats, bool json, size_t top, std::ostream& os) {
+    const CheckStats& c = stats.check;
+    const std::pair<const char*, double> phases[] = {
+        {"read", stats.readSeconds}, {"parse", stats.parseSeconds}, {"build", stats.buildSeconds}, {"top_level", c.topLevelSeconds},
+        {"environments", c.environmentSeconds}, {"definitions", c.definitionsSeconds},
+    };
+    size_t slowest = std::min(top, stats.functions.size());
+#ifdef CFLAT_STATS
+    const bool counted = true;
+#else
+    const bool counted = false;
+#endif
+    if (json) {
+        nlohmann::ordered_json j;
+        for (const auto& [name, seconds] : phases) j["phases_ms"][name] = seconds * 1e3;
+        j["nodes"] = nlohmann::ordered_json::object();
+        for (size_t k = 0; k < kNodeKindCount; ++k) {
+            if (stats.nodes[k]) j["nodes"][nodeKindName(NodeKind(k))] = stats.nodes[k];
+        }
+        j["types_allocated"] = stats.typesAllocated;
+        j["type_eq_calls"] = counted ? nlohmann::ordered_json(stats.typeEqCalls) : nlohmann::ordered_json();
+        j["slowest_functions"] = nlohmann::ordered_json::array();
+        for (size_t i = 0; i < slowest; ++i) {
+            j["slowest_functions"].push_back({{"name", stats.functions[i].first}, {"ms", stats.functions[i].second * 1e3}});
+        }
+        os << j.dump() << std::endl;
+        return;
+    }
+    char buffer[64];
+    auto ms = [&](double seconds) {
+        std::snprintf(buffer, sizeof buffer, "%.3f ms", seconds * 1e3);
+        return std::string(buffer);
+    };
+    os << "phases:";
+    const char* separator = " ";
+    for (const auto& [name, seconds] : phases) {
+        os << separator << name << " " << ms(seconds);
+        separator = ", ";
+    }
+    os << "\nnodes:";
+    for (size_t k = 0; k < kNodeKindCount; ++k) {
+        if (stats.nodes[k]) os << " " << nodeKindName(NodeKind(k)) << " " << stats.nodes[k];
     }
+    os << "\ntypes allocated: " << stats.typesAllocated << "\ntypeEq calls: ";
+    if (counted) os << stats.typeEqCalls; else os << "not counted (build with -DCFLAT_STATS)";
+    os << "\nslowest functions:";
+    for (size_t i = 0; i < slowest; ++i) os << "\n  " << ms(stats.functions[i].second) << "  " << stats.functions[i].first;
+    os << std::endl;
+}
 
+// Parses, builds and type checks the .astj text in [first, last), or
+// loads and checks the .astb file binaryPath when that is not empty
+static CheckResult checkInput(const char* first, const char* last, const std::string& binaryPath,
+                              const CheckOptions& options) {
+    const bool binary = !binaryPath.empty();
+    // Checking as it builds means building from .astj text
+    if (binary && (options.firstError || options.stream)) {
+        return {CheckResult::Error, std::string("Error: ") + (options.stream ? "--stream" : "--first-error") +
+                                        " builds from .astj text, so it cannot check " + binaryPath};
+    }
     nlohmann::json jsonAst;
-    try {
-        // Parse the JSON file using the json.hpp library
-        inputFile >> jsonAst;
-    } catch (const nlohmann::json::parse_error& e) {
-        std::cerr << "JSON parsing error: " << e.what() << std::endl;
-        return 1;
-    } catch (const std::exception& e) {
-         std::cerr << "Error reading file: " << e.what() << std::endl;
-        return 1;
+    // Parsing stops early on input nested deeper than maxDepth, which is
+    // reported below like the SAX path reports it
+    bool withinDepth = true;
+    auto start = Clock::now();
+    const bool firstError = options.firstError || options.stream;
+    if (!options.useSax && !firstError && !binary) {
+        try {
+            // Parse the JSON file using the json.hpp library
+            withinDepth = parseJsonWithinDepth(first, last, jsonAst, options.maxDepth);
+        } catch (const nlohmann::json::parse_error& e) {
+            return {CheckResult::Error, std::string("JSON parsing error: ") + e.what()};
+        } catch (const std::exception& e) {
+            return {CheckResult::Error, std::string("Error reading file: ") + e.what()};
+        }
+        if (options.stats) options.stats->parseSeconds = secondsSince(start);
+        start = Clock::now();
     }
 
+    // Declared outside the try: a TypeError renders its message from the
+    // program's nodes when what() is first called in the handler below
+    std::unique_ptr<Program> programAst;
+    StatsCollector collectStats(options.stats, programAst);
     try {
-        // Convert the nlohmann::json object to our internal AST structure
-        std::unique_ptr<Program> programAst = buildProgram(jsonAst);
+        // Convert the nlohmann::json object (or the token stream) to our internal AST structure
+        if (!withinDepth) throwNestingTooDeep(options.maxDepth);
+        if (firstError) {
+            // Building and checking are one phase here
+            if (options.stream) {
+                checkProgramStreaming(first, last, programAst, options.maxDepth);
+            } else {
+                checkProgramFirstError(first, last, programAst, options.maxDepth);
+            }
+            if (options.stats) options.stats->buildSeconds = secondsSince(start);
+        } else {
+            if (binary) {
+                programAst = loadProgramBinary(binaryPath, options.maxDepth);
+            } else if (options.useSax) {
+                unsigned jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+                programAst = jobs > 1 && size_t(last - first) >= kParallelBuildBytes
+                           ? buildProgramParallel(first, last, jobs, options.maxDepth)
+                           : buildProgramSax(first, last, options.maxDepth);
+            } else {
+                programAst = buildProgram(jsonAst);
+            }
+            if (options.stats) options.stats->buildSeconds = secondsSince(start);
+            if (!options.emitPath.empty()) {
+                std::ofstream out(options.emitPath, std::ios::binary);
+                writeProgramBinary(*programAst, out);
+                if (!out) return {CheckResult::Error, "Error: Could not write file " + options.emitPath};
+            }
 
-        // Perform the type checking by calling the check method on the root Program node
-        programAst->check();
+            // Perform the type checking by calling the check method on the root Program node.
+            // Listing the types needs every function checked, so it bypasses the cache.
+            std::optional<Diagnostics> diagnostics;
+            if (options.maxErrors) diagnostics.emplace(options.maxErrors);
+            programAst->check(options.jobs, options.dumpTypes ? nullptr : options.cache,
+                              options.stats ? &options.stats->check : nullptr, diagnostics ? &*diagnostics : nullptr,
+                              options.flat);
+            if (diagnostics && !diagnostics->errors.empty()) {
+                CheckResult result{CheckResult::Invalid, diagnostics->errors[0].what()};
+                for (size_t i = 1; i < diagnostics->errors.size(); ++i) {
+                    result.moreErrors.push_back(diagnostics->errors[i].what());
+                }
+                return result;
+            }
+        }
 
         // If no exception was thrown, the program is valid
-        std::cout << "valid" << std::endl;
+        CheckResult result{CheckResult::Valid, ""};
+        if (options.dumpTypes) {
+            std::ostringstream types;
+            programAst->printTypes(types);
+            result.types = types.str();
+        }
+        return result;
 
+    } catch (const nlohmann::json::parse_error& e) {
+        // Only reachable with --sax, where parsing and building are one pass
+        return {CheckResult::Error, std::string("JSON parsing error: ") + e.what()};
     } catch (const TypeError& e) {
         // Catch specific type errors from our checker
-        std::cout << "invalid: " << e.what() << std::endl;
-        return 0; // Return 0 for invalid programs as per spec likely
+        return {CheckResult::Invalid, e.what()};
     } catch (const std::exception& e) {
         // Catch other potential errors (e.g., during AST building)
-        // You might want to refine this error message
-        std::cerr << "An unexpected error occurred: " << e.what() << std::endl;
+        return {CheckResult::Error, std::string("An unexpected error occurred: ") + e.what()};
+    }
+}
+
+// Checks a single .astj or .astb file, or the .astj text on stdin for "-"
+static CheckResult checkFile(const std::string& inputPath, const CheckOptions& options) {
+    InputFile inputFile;
+    if (!inputFile.open(inputPath)) {
+        return {CheckResult::Error, "Error: Could not open file " + inputPath};
+    }
+    // .astb input is mapped by its loader instead
+    if (isProgramBinary(inputPath)) return checkInput(nullptr, nullptr, inputPath, options);
+    auto start = Clock::now();
+    try {
+        inputFile.read();
+    } catch (const std::exception& e) {
+        return {CheckResult::Error, std::string("Error reading file: ") + e.what()};
+    }
+    if (options.stats) options.stats->readSeconds = secondsSince(start);
+    return checkInput(inputFile.begin(), inputFile.end(), "", options);
+}
+
+// Expands batch arguments into the list of files to check: directories
+// contribute every .astj and .astb file below them in sorted order, "-" (or no
+// arguments at all) reads a manifest of paths from stdin, one per line.
+static std::vector<std::string> collectBatchInputs(const std::vector<std::string>& args) {
+    std::vector<std::string> files;
+    auto readManifest = [&files]() {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) files.push_back(line);
+        }
+    };
+    if (args.empty()) readManifest();
+    for (const auto& arg : args) {
+        std::error_code ec;
+        if (arg == "-") {
+            readManifest();
+        } else if (std::filesystem::is_directory(arg, ec)) {
+            std::vector<std::string> found;
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(arg, ec)) {
+                if (entry.is_regular_file() && (entry.path().extension() == ".astj" || entry.path().extension() == ".astb")) {
+                    found.push_back(entry.path().string());
+                }
+            }
+            std::sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        } else {
+            files.push_back(arg);
+        }
+    }
+    return files;
+}
+
+// Checks every input on a pool of `jobs` workers, then prints one line per
+// file in input order followed by a summary. Exit status is 1 if any file
+// could not be read or parsed.
+static int runBatch(const std::vector<std::string>& args, const CheckOptions& options) {
+    std::vector<std::string> files = collectBatchInputs(args);
+    std::vector<CheckResult> results(files.size());
+    unsigned jobs = options.jobs;
+    if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+    // Files are the unit of parallelism here, so each program is checked sequentially
+    CheckOptions perFile = options;
+    perFile.jobs = 1;
+    forEachInOrder(files.size(), jobs, [&](size_t i) {
+        results[i] = checkFile(files[i], perFile);
+    });
+
+    size_t counts[3] = {0, 0, 0};
+    for (size_t i = 0; i < files.size(); ++i) {
+        const CheckResult& r = results[i];
+        ++counts[r.status];
+        switch (r.status) {
+            case CheckResult::Valid: std::cout << files[i] << ": valid\n"; break;
+            case CheckResult::Invalid:
+                std::cout << files[i] << ": invalid: " << r.message << "\n";
+                for (const auto& message : r.moreErrors) std::cout << files[i] << ": invalid: " << message << "\n";
+                break;
+            case CheckResult::Error: std::cout << files[i] << ": error: " << r.message << "\n"; break;
+        }
+    }
+    std::cout << "checked " << files.size() << " files: " << counts[CheckResult::Valid] << " valid, "
+              << counts[CheckResult::Invalid] << " invalid, " << counts[CheckResult::Error] << " errors"
+              << std::endl;
+    return counts[CheckResult::Error] > 0 ? 1 : 0;
+}
+
+// --- Server Mode ---
+// --serve answers a stream of requests on stdin, or on every connection to
+// the Unix socket given with --socket, keeping one process (and its check
+// cache) warm between them. A request is a line holding a file path, or a
+// line "json N" followed by N bytes of .astj text. Each gets one reply
+// line, in request order: "valid", "invalid: MESSAGE" or "error: MESSAGE",
+// then a tab and the time checking it took, e.g. "valid\t412us".
+
+// A fixed set of threads running submitted jobs in submission order
+class CheckPool {
+public:
+    explicit CheckPool(unsigned threads) {
+        for (unsigned i = 0; i < threads; ++i) workers.emplace_back([this]() { run(); });
+    }
+    ~CheckPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+    }
+    CheckPool(const CheckPool&) = delete;
+    CheckPool& operator=(const CheckPool&) = delete;
+
+    std::future<std::string> submit(std::function<std::string()> job) {
+        std::packaged_task<std::string()> task(std::move(job));
+        std::future<std::string> result = task.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(task));
+        }
+        wake.notify_one();
+        return result;
+    }
+
+private:
+    void run() {
+        for (;;) {
+            std::packaged_task<std::string()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                task = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::packaged_task<std::string()>> jobs;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+// Buffered reads of lines and byte counts from a file descriptor
+class FdReader {
+public:
+    explicit FdReader(int fd) : fd(fd) {}
+
+    // The next line without its "\n" or "\r\n"; false at the end of input
+    bool line(std::string& out) {
+        for (;;) {
+            size_t end = buffer.find('\n', pos);
+            if (end != std::string::npos) {
+                out.assign(buffer, pos, end - pos);
+                pos = end + 1;
+                if (!out.empty() && out.back() == '\r') out.pop_back();
+                return true;
+            }
+            if (!fill()) {
+                // A last line without a newline still counts
+                out.assign(buffer, pos, std::string::npos);
+                pos = buffer.size();
+                return !out.empty();
+            }
+        }
+    }
+
+    // Exactly n more bytes; false if the input ends first
+    bool bytes(size_t n, std::string& out) {
+        while (buffer.size() - pos < n) {
+            if (!fill()) return false;
+        }
+        out.assign(buffer, pos, n);
+        pos += n;
+        return true;
+    }
+
+private:
+    bool fill() {
+        buffer.erase(0, pos);
+        pos = 0;
+        char chunk[65536];
+        for (;;) {
+            ssize_t got = ::read(fd, chunk, sizeof chunk);
+            if (got > 0) {
+                buffer.append(chunk, size_t(got));
+                return true;
+            }
+            if (got < 0 && errno == EINTR) continue;
+            return false;
+        }
+    }
+
+    int fd;
+    std::string buffer;
+    size_t pos = 0;
+};
+
+static bool writeAll(int fd, const std::string& text) {
+    for (size_t done = 0; done < text.size();) {
+        ssize_t wrote = ::write(fd, text.data() + done, text.size() - done);
+        if (wrote < 0 && errno == EINTR) continue;
+        if (wrote <= 0) return false;
+        done += size_t(wrote);
+    }
+    return true;
+}
+
+// Runs check() and renders its result and duration as one reply line
+template <typename Check>
+static std::string timedReply(Check check) {
+    auto start = Clock::now();
+    CheckResult r = check();
+    auto took = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+    std::string reply = r.status == CheckResult::Valid ? "valid"
+                      : r.status == CheckResult::Invalid ? "invalid: " + r.message : "error: " + r.message;
+    // Keep one line per reply whatever the message holds
+    std::replace(reply.begin(), reply.end(), '\n', ' ');
+    return reply + "\t" + std::to_string(took.count()) + "us\n";
+}
+
+// "json N" with N a byte count, as opposed to a path
+static bool isInlineRequest(const std::string& line, size_t& length) {
+    const std::string prefix = "json ";
+    if (line.compare(0, prefix.size(), prefix) != 0) return false;
+    std::string count = line.substr(prefix.size());
+    if (count.empty() || count.size() > 12 || count.find_first_not_of("0123456789") != std::string::npos) return false;
+    length = std::stoull(count);
+    return true;
+}
+
+// Answers the requests read from `in` on `out` until the input ends. Requests
+// are checked on the pool as they arrive, while a writer thread sends the
+// replies back in request order.
+static void serveSession(int in, int out, CheckPool& pool, const CheckOptions& options) {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::future<std::string>> replies;
+    bool finished = false;
+    std::thread writer([&]() {
+        bool open = true;
+        for (;;) {
+            std::future<std::string> reply;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&]() { return finished || !replies.empty(); });
+                if (replies.empty()) return;
+                reply = std::move(replies.front());
+                replies.pop_front();
+            }
+            // Still wait for every job after the client goes away, since they use this frame
+            std::string text = reply.get();
+            if (open) open = writeAll(out, text);
+        }
+    });
+
+    FdReader reader(in);
+    std::string line;
+    while (reader.line(line)) {
+        if (line.empty()) continue;
+        std::future<std::string> reply;
+        size_t length = 0;
+        if (isInlineRequest(line, length)) {
+            std::string text;
+            if (!reader.bytes(length, text)) break;
+            reply = pool.submit([text = std::move(text), &options]() {
+                return timedReply([&]() { return checkInput(text.data(), text.data() + text.size(), "", options); });
+            });
+        } else {
+            reply = pool.submit([path = line, &options]() {
+                return timedReply([&]() { return checkFile(path, options); });
+            });
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            replies.push_back(std::move(reply));
+        }
+        ready.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+    ready.notify_one();
+    writer.join();
+}
+
+// Serves every connection to a Unix socket at `path` on its own thread,
+// sharing the pool, until accepting fails. Saves the cache as each
+// connection closes.
+static int serveSocket(const std::string& path, CheckPool& pool, const CheckOptions& options) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof addr.sun_path) {
+        std::cerr << "Error: socket path too long: " << path << std::endl;
         return 1;
     }
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    // A socket left behind by an earlier server is replaced, but nothing else is
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) ::unlink(path.c_str());
 
-    return 0;
-}
\ No newline at end of file
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<const sockaddr*>(&addr), sizeof addr) != 0 ||
+        ::listen(listener, 64) != 0) {
+        std::cerr << "Error: Could not listen on " << path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    for (;;) {
+        int client = ::accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            std::cerr << "Error: Could not accept on " << path << ": " << std::strerror(errno) << std::endl;
+            ::close(listener);
+            return 1;
+        }
+        std::thread([client, &pool, &options]() {
+            serveSession(client, client, pool, options);
+            ::close(client);
+            if (options.cache) options.cache->save();
+        }).detach();
+    }
+}
+
+int main(int argc, char** argv) {
+    CheckOptions options;
+    // --batch checks every file, directory or stdin manifest given
+    bool batch = false;
+    // --serve answers requests until its input ends (see serveSession),
+    // on stdin or, with --socket PATH, on a Unix socket
+    bool serve = false;
+    std::string socketPath;
+    std::string cachePath;
+    // --stats / --stats-json report on stderr after the verdict, listing the
+    // --stats-top N slowest functions
+    bool stats = false, statsJson = false;
+    size_t statsTop = 5;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--sax") {
+            options.useSax = true;
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--serve") {
+            serve = true;
+        } else if (arg == "--socket" && i + 1 < argc) {
+            serve = true;
+            socketPath = argv[++i];
+        } else if (arg == "--stats" || arg == "--stats-json") {
+            stats = true;
+            statsJson = arg == "--stats-json";
+        } else if (arg == "--stats-top" && i + 1 < argc) {
+            std::string count = argv[++i];
+            if (count.empty() || count.size() > 6 || count.find_first_not_of("0123456789") != std::string::npos) {
+                std::cerr << "Error: --stats-top expects a function count, got '" << count << "'" << std::endl;
+                return 1;
+            }
+            statsTop = std::stoul(count);
+        } else if (arg == "--first-error") {
+            options.firstError = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--flat") {
+            options.flat = true;
+        } else if (arg == "--max-errors" && i + 1 < argc) {
+            std::string count = argv[++i];
+            if (count.empty() || count.size() > 9 || count.find_first_not_of("0123456789") != std::string::npos ||
+                std::stoul(count) == 0) {
+                std::cerr << "Error: --max-errors expects a positive error count, got '" << count << "'" << std::endl;
+                return 1;
+            }
+            options.maxErrors = std::stoul(count);
+        } else if (arg == "--dump-types") {
+            options.dumpTypes = true;
+        } else if (arg == "--emit-binary" && i + 1 < argc) {
+            options.emitPath = argv[++i];
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cachePath = argv[++i];
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            std::string count = argv[++i];
+            if (count.empty() || count.size() > 6 || count.find_first_not_of("0123456789") != std::string::npos) {
+                std::cerr << "Error: --jobs expects a thread count, got '" << count << "'" << std::endl;
+                return 1;
+            }
+            options.jobs = static_cast<unsigned>(std::stoul(count));
+        } else if (arg == "--max-depth" && i + 1 < argc) {
+            std::string depth = argv[++i];
+            if (depth.empty() || depth.size() > 9 || depth.find_first_not_of("0123456789") != std::string::npos ||
+                std::stoul(depth) == 0) {
+                std::cerr << "Error: --max-depth expects a positive nesting depth, got '" << depth << "'" << std::endl;
+                return 1;
+            }
+            options.maxDepth = std::stoul(depth);
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (batch && !options.emitPath.empty()) {
+        std::cerr << "Error: --emit-binary takes a single input file, not --batch" << std::endl;
+        return 1;
+    }
+    if (options.firstError && !options.emitPath.empty()) {
+        std::cerr << "Error: --first-error only builds up to the first error, so it cannot --emit-binary" << std::endl;
+        return 1;
+    }
+    if (options.firstError && options.flat) {
+        std::cerr << "Error: --first-error checks each function as it is built, so it cannot --flat" << std::endl;
+        return 1;
+    }
+    if ((options.firstError || options.stream) && std::any_of(inputs.begin(), inputs.end(), isProgramBinary)) {
+        std::cerr << "Error: " << (options.stream ? "--stream" : "--first-error")
+                  << " builds from .astj text, so it cannot check .astb input" << std::endl;
+        return 1;
+    }
+    if (options.firstError && options.maxErrors) {
+        std::cerr << "Error: --first-error stops at the first error, so it cannot --max-errors" << std::endl;
+        return 1;
+    }
+    if (options.stream && (options.firstError || options.flat || options.maxErrors || options.dumpTypes ||
+                           !options.emitPath.empty())) {
+        std::cerr << "Error: --stream frees each function once checked, so it takes none of --first-error, --flat, --max-errors, --dump-types or --emit-binary" << std::endl;
+        return 1;
+    }
+    if (stats && (batch || serve)) {
+        std::cerr << "Error: --stats reports on a single input file, not --batch or --serve" << std::endl;
+        return 1;
+    }
+    if (serve && (batch || options.dumpTypes || !options.emitPath.empty() || options.maxErrors || !inputs.empty())) {
+        std::cerr << "Error: --serve reads its inputs from requests and takes none of --batch, --dump-types, --emit-binary, --max-errors or input files" << std::endl;
+        return 1;
+    }
+    if (!batch && !serve && inputs.size() != 1) {
+        std::cerr << "Usage: " << argv[0] << " [--sax | --first-error | --stream] [--flat] [--jobs N] [--max-depth N] [--cache FILE] [--dump-types] [--emit-binary out.astb]\n"
+                  << "       " << std::string(std::strlen(argv[0]), ' ') << " [--max-errors N] [--stats | --stats-json] [--stats-top N] <input.astj | input.astb | - (stdin)>\n"
+                  << "       " << argv[0] << " --batch [--sax | --first-error | --stream] [--flat] [--jobs N] [--max-depth N] [--cache FILE] [--max-errors N] [file | dir | -]...\n"
+                  << "       " << argv[0] << " --serve [--socket PATH] [--sax | --first-error | --stream] [--flat] [--jobs N] [--max-depth N] [--cache FILE]" << std::endl;
+        return 1;
+    }
+    // A server always caches, in memory only unless --cache names a file
+    std::unique_ptr<CheckCache> cache;
+    if (!cachePath.empty() || serve) {
+        cache = std::make_unique<CheckCache>(cachePath);
+        options.cache = cache.get();
+    }
+    // A cache that cannot be written back only costs the next run its hits
+    auto saveCache = [&]() {
+        if (cache && !cache->save()) std::cerr << "Warning: could not write cache file " << cachePath << std::endl;
+    };
+    if (batch) {
+        int status = runBatch(inputs, options);
+        saveCache();
+        return status;
+    }
+    if (serve) {
+        // A client hanging up must not take the server down with it
+        std::signal(SIGPIPE, SIG_IGN);
+        if (options.jobs == 0) options.jobs = std::max(1u, std::thread::hardware_concurrency());
+        CheckPool pool(options.jobs);
+        // Requests are the unit of parallelism, so each program is checked sequentially
+        CheckOptions perRequest = options;
+        perRequest.jobs = 1;
+        if (!socketPath.empty()) return serveSocket(socketPath, pool, perRequest);
+        serveSession(STDIN_FILENO, STDOUT_FILENO, pool, perRequest);
+        saveCache();
+        return 0;
+    }
+
+    RunStats runStats;
+    if (stats) options.stats = &runStats;
+    CheckResult result = checkFile(inputs[0], options);
+    saveCache();
+    int status = 0;
+    switch (result.status) {
+        case CheckResult::Valid:
+            std::cout << "valid" << std::endl;
+            std::cout << result.types << std::flush;
+            break;
+        case CheckResult::Invalid:
+            std::cout << "invalid: " << result.message << std::endl;
+            for (const auto& message : result.moreErrors) std::cout << "invalid: " << message << std::endl;
+            break; // Return 0 for invalid programs as per spec likely
+        case CheckResult::Error:
+            std::cerr << result.message << std::endl;
+            status = 1;
+            break;
+    }
+    if (stats) printStats(runStats, statsJson, statsTop, std::cerr);
+    return status;
+}